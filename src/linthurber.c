@@ -11,21 +11,23 @@
 #include <string.h>
 #include <math.h>
 #include <limits.h>
+#include <pthread.h>
 
 #include "ucvm_utils.h"
 #include "ucvm_config.h"
 #include "ucvm_proj_bilinear.h"
 
 #include "linthurber.h"
+#include "linthurber_parallel.h"
 
+/** Points per range when a query is spread over threads */
+#define LINTHURBER_QUERY_GRAIN 256
+/** Points tested against the model region at a time */
+#define LINTHURBER_CULL_BLOCK 64
 
 FILE  *stderrfp;
 int linthurber_ucvm_debug=1;
 
-/** The config of the model */
-char *linthurber_config_string=NULL;
-int linthurber_config_sz=0;
-
 // Constants
 /** The version of the model. */
 const char *linthurber_version_string = "linthurber";
@@ -34,12 +36,19 @@ const char *linthurber_version_string = "linthurber";
 /** Set to 1 when the model is ready for query. */
 int linthurber_is_initialized = 0;
 
-char linthurber_data_directory[128];
+/** Depth mode of linthurber_query */
+int linthurber_depth_mode = LINTHURBER_DEPTH_SURFACE;
 
-/** Configuration parameters. */
-linthurber_configuration_t *linthurber_configuration;
+/** Configuration parameters of the state this thread is working on. */
+__thread linthurber_configuration_t *linthurber_configuration;
 /** Holds pointers to the velocity model data OR indicates it can be read from file. */
-linthurber_model_t *linthurber_velocity_model;
+__thread linthurber_model_t *linthurber_velocity_model;
+
+extern __thread long linthurber_cull_tested;
+extern __thread long linthurber_cull_rejected;
+
+/** Serializes loads of new models. */
+pthread_mutex_t linthurber_load_lock = PTHREAD_MUTEX_INITIALIZER;
 
 /**
  * Initializes the linthurber plugin model within the UCVM framework. In order to initialize
@@ -51,35 +60,57 @@ linthurber_model_t *linthurber_velocity_model;
  * @return Success or failure, if initialization was successful.
  */
 int linthurber_init(const char *dir, const char *label) {
-
-    int tempVal = 0;
-    char configbuf[512];
-    double north_height_m = 0, east_width_m = 0, rotation_angle = 0;
+    int err;
 
    fprintf(stderr,"HERE 1");
 
-    if(linthurber_ucvm_debug) {
-      stderrfp = fopen("linthurber_debug.log", "w+");
-      fprintf(stderrfp," -- configure setting -- \n");
-    }
+    pthread_mutex_lock(&linthurber_load_lock);
+    err = _linthurber_load(dir, label);
+    pthread_mutex_unlock(&linthurber_load_lock);
+    return err;
+}
 
-    // Initialize variables.
-    linthurber_configuration = calloc(1, sizeof(linthurber_configuration_t));
-    linthurber_velocity_model = calloc(1, sizeof(linthurber_model_t));
+/**
+ * Loads a new configuration and model while queries keep running on the
+ * current one, then switches queries over to it. Queries already running
+ * finish on the model they started with, and the old model is freed once
+ * none is left. Must not be called from inside a query or a callback.
+ *
+ * @param dir The directory in which UCVM has been installed.
+ * @param label A unique identifier for the velocity model.
+ * @return SUCCESS, or FAIL with the current model left in place.
+ */
+int linthurber_reload(const char *dir, const char *label) {
+    int err;
 
-    linthurber_config_string = calloc(LINTHURBER_CONFIG_MAX, sizeof(char));
-    linthurber_config_string[0]='\0';
-    linthurber_config_sz=0;
+    pthread_mutex_lock(&linthurber_load_lock);
+    err = _linthurber_load(dir, label);
+    pthread_mutex_unlock(&linthurber_load_lock);
+    return err;
+}
 
-    // Configuration file location.
-    sprintf(configbuf, "%s/model/%s/data/config", dir, label);
+/**
+ * Reads the configuration and the model into a new state and publishes it.
+ *
+ * @param dir The directory in which UCVM has been installed.
+ * @param label A unique identifier for the velocity model.
+ * @return SUCCESS or FAIL.
+ */
+int _linthurber_load(const char *dir, const char *label) {
+
+    int tempVal = 0;
+    char configbuf[512];
+
+    // Initialize variables.
+    _linthurber_init_state(dir, label, configbuf);
 
     // Read the linthurber_configuration file.
     if (linthurber_read_configuration(configbuf, linthurber_configuration) != SUCCESS)
-        return FAIL;
+        return _linthurber_load_abort(NULL);
 
     // Set up the data directory.
-    sprintf(linthurber_data_directory, "%s/model/%s/data/%s/", dir, label, linthurber_configuration->model_dir);
+    if (_linthurber_data_directory(linthurber_configuration, dir, label) != SUCCESS)
+        return _linthurber_load_abort(NULL);
     // Can we allocate the model, or parts of it, to memory. If so, we do.
     tempVal = linthurber_try_reading_model(linthurber_velocity_model);
 
@@ -88,12 +119,87 @@ int linthurber_init(const char *dir, const char *label) {
 //        fprintf(stderr, "hard disk may result in slow performance.\n");
     } else if (tempVal == FAIL) {
         linthurber_print_error("No model file was found to read from.");
-        return FAIL;
+        return _linthurber_load_abort(NULL);
+    }
+
+    return _linthurber_init_done(configbuf);
+}
+
+/**
+ * Allocates the configuration and model structures and opens the debug log.
+ * Shared by the serial and MPI initialization paths. Nothing the current
+ * model uses is touched until the new one is published.
+ *
+ * @param dir The directory in which UCVM has been installed.
+ * @param label A unique identifier for the velocity model.
+ * @param configbuf Receives the location of the configuration file.
+ * @return SUCCESS
+ */
+int _linthurber_init_state(const char *dir, const char *label, char *configbuf) {
+
+    if(linthurber_ucvm_debug && (stderrfp == NULL)) {
+      stderrfp = fopen("linthurber_debug.log", "w+");
+      fprintf(stderrfp," -- configure setting -- \n");
+    }
+
+    /* Loaded through this thread's view until published */
+    linthurber_configuration = calloc(1, sizeof(linthurber_configuration_t));
+    linthurber_velocity_model = calloc(1, sizeof(linthurber_model_t));
+
+    // Configuration file location.
+    sprintf(configbuf, "%s/model/%s/data/config", dir, label);
+
+    return SUCCESS;
+}
+
+/**
+ * Publishes the configuration and model loaded on this thread once the
+ * model data are in place, replacing any model loaded before.
+ *
+ * @param configbuf The location of the configuration file.
+ * @return SUCCESS or FAIL.
+ */
+int _linthurber_init_done(const char *configbuf) {
+    linthurber_state_t *state;
+
+    // The config string travels with the model, for linthurber_config
+    snprintf(linthurber_configuration->config_string, LINTHURBER_CONFIG_MAX, "config = %s\n",
+             configbuf);
+    _linthurber_specialize(linthurber_configuration);
+    _linthurber_cull_init(linthurber_configuration);
+    _linthurber_isa_select(linthurber_velocity_model);
+
+    state = _linthurber_state_new(linthurber_configuration, linthurber_velocity_model);
+    if (state == NULL) return _linthurber_load_abort(NULL);
+
+    // Corner-packed cells, if the configuration asks for them
+    if (_linthurber_pack_model(linthurber_configuration, linthurber_velocity_model) != SUCCESS) {
+        linthurber_print_error("Could not allocate the packed model cells.");
+        return _linthurber_load_abort(state);
     }
 
-    // setup config_string 
-    sprintf(linthurber_config_string,"config = %s\n",configbuf);
-    linthurber_config_sz=1;
+    // Tricubic coefficients, if the configuration asks for them
+    if (_linthurber_cubic_model(linthurber_configuration, linthurber_velocity_model) != SUCCESS) {
+        linthurber_print_error("Could not allocate the tricubic coefficients.");
+        return _linthurber_load_abort(state);
+    }
+    // Cells with eight equal corners, for the trilinear fast path
+    if (_linthurber_uniform_model(linthurber_configuration, linthurber_velocity_model) != SUCCESS) {
+        linthurber_print_error("Could not allocate the uniform cell bitmaps.");
+        return _linthurber_load_abort(state);
+    }
+    _linthurber_kernel_select(linthurber_configuration, linthurber_velocity_model);
+
+    // Downsampled grids for coarse queries
+    if (_linthurber_lod_build(state) != SUCCESS) {
+        linthurber_print_error("Could not allocate the level-of-detail pyramid.");
+        return _linthurber_load_abort(state);
+    }
+
+    // Prefault the model memory, if the configuration asks for it
+    _linthurber_warmup_start(state);
+
+    _linthurber_state_publish(state);
 
     // Let everyone know that we are initialized and ready for business.
     linthurber_is_initialized = 1;
@@ -101,8 +207,131 @@ int linthurber_init(const char *dir, const char *label) {
     return SUCCESS;
 }
 
+/**
+ * Sets the directory the model files of a configuration are read from.
+ *
+ * @param config The configuration, with its model directory read.
+ * @param dir The directory in which UCVM has been installed.
+ * @param label A unique identifier for the velocity model.
+ * @return SUCCESS, or FAIL if the path is too long.
+ */
+int _linthurber_data_directory(linthurber_configuration_t *config, const char *dir, const char *label) {
+    int len;
+
+    len = snprintf(config->data_directory, sizeof(config->data_directory), "%s/model/%s/data/%s/",
+                   dir, label, config->model_dir);
+    if ((len < 0) || (len >= (int)sizeof(config->data_directory))) {
+        linthurber_print_error("The model data directory path is too long.");
+        return FAIL;
+    }
+    return SUCCESS;
+}
+
+/**
+ * Frees the configuration and model of a load that failed before it was
+ * published, leaving the current model in place.
+ *
+ * @param state The state made for them, or NULL if there is none yet.
+ * @return FAIL
+ */
+int _linthurber_load_abort(linthurber_state_t *state) {
+    if (state == NULL) state = calloc(1, sizeof(linthurber_state_t));
+    if (state != NULL) {
+        state->config = linthurber_configuration;
+        state->model = linthurber_velocity_model;
+        _linthurber_state_free(state);
+    }
+    linthurber_configuration = NULL;
+    linthurber_velocity_model = NULL;
+    return FAIL;
+}
+
+/**
+ * Marks the configuration as specialized if the library was built for its
+ * grids with linthurber_specialize.sh, so queries take the paths with the
+ * grid constants compiled in. A specialized library loading another model
+ * release warns and keeps to the generic paths.
+ *
+ * @param config The configuration just read.
+ */
+void _linthurber_specialize(linthurber_configuration_t *config) {
+    config->specialized = 0;
+#ifdef LINTHURBER_SPECIALIZED
+    int k, match;
+
+    match = (config->spacing_vp == LINTHURBER_FIXED_SPACING_VP) &&
+            (config->spacing_vs == LINTHURBER_FIXED_SPACING_VS) &&
+            (config->spacing_dem == LINTHURBER_FIXED_SPACING_DEM) &&
+            (config->num_z == LINTHURBER_FIXED_NUM_Z);
+    for (k = 0; match && (k < 3); k++) {
+        match = (config->vp_dims[k] == linthurber_fixed_vp_dims[k]) &&
+                (config->vs_dims[k] == linthurber_fixed_vs_dims[k]) &&
+                (config->dem_dims[k] == linthurber_fixed_dem_dims[k]);
+    }
+    for (k = 0; match && (k < LINTHURBER_FIXED_NUM_Z); k++) {
+        match = (config->depths_msl[k] == linthurber_fixed_depths_msl[k]);
+    }
+    if (!match) {
+        fprintf(stderr, "WARNING: The model grids differ from those the library was specialized for.\n");
+        fprintf(stderr, "Queries use the generic code.\n");
+        return;
+    }
+    config->specialized = 1;
+#endif
+}
+
+/** Arguments of a query spread over threads. */
+typedef struct linthurber_query_batch_t {
+     const linthurber_query_desc_t *desc;
+     int mode;
+} linthurber_query_batch_t;
+
+void _linthurber_query_range(void *arg, int begin, int end) {
+    linthurber_query_batch_t *batch = arg;
+
+    _linthurber_query_points(batch->desc, begin, end, batch->mode);
+}
+
+/**
+ * Describes arrays of linthurber_point_t and linthurber_properties_t, for
+ * the query paths that work on descriptors.
+ *
+ * @param desc The descriptor to fill in.
+ * @param points The points.
+ * @param data The properties returned; only vp, vs and rho are written.
+ */
+void _linthurber_desc_init(linthurber_query_desc_t *desc, linthurber_point_t *points,
+                           linthurber_properties_t *data) {
+    desc->points = points;
+    desc->point_stride = sizeof(linthurber_point_t);
+    desc->lon_offset = offsetof(linthurber_point_t, longitude);
+    desc->lat_offset = offsetof(linthurber_point_t, latitude);
+    desc->depth_offset = offsetof(linthurber_point_t, depth);
+    desc->data = data;
+    desc->data_stride = sizeof(linthurber_properties_t);
+    desc->vp_offset = offsetof(linthurber_properties_t, vp);
+    desc->vs_offset = offsetof(linthurber_properties_t, vs);
+    desc->rho_offset = offsetof(linthurber_properties_t, rho);
+}
+
+/**
+ * Sets the depth mode of linthurber_query, and of the APIs built on it, for
+ * every thread. Queries already running keep the mode they started with.
+ *
+ * @param mode LINTHURBER_DEPTH_SURFACE, LINTHURBER_DEPTH_MSL or LINTHURBER_ELEVATION.
+ * @return SUCCESS, or FAIL if the mode is unknown.
+ */
+int linthurber_set_depth_mode(int mode) {
+    if ((mode < LINTHURBER_DEPTH_SURFACE) || (mode > LINTHURBER_ELEVATION)) return FAIL;
+    __atomic_store_n(&linthurber_depth_mode, mode, __ATOMIC_RELAXED);
+    return SUCCESS;
+}
+
 /**
  * Queries linthurber at the given points and returns the data that it finds.
+ * Large batches are split into ranges of LINTHURBER_QUERY_GRAIN points and
+ * run on the work-stealing pool, so points that return early (outside the
+ * projection or the DEM) do not leave threads idle.
  *
  * @param points The points at which the queries will be made.
  * @param data The data that will be returned (Vp, Vs, rho, Qs, and/or Qp).
@@ -110,17 +339,228 @@ int linthurber_init(const char *dir, const char *label) {
  * @return SUCCESS or FAIL.
  */
 int linthurber_query(linthurber_point_t *points, linthurber_properties_t *data, int numpoints) {
+    return linthurber_query_mode(points, data, numpoints,
+                                 __atomic_load_n(&linthurber_depth_mode, __ATOMIC_RELAXED));
+}
+
+/**
+ * Queries linthurber at the given points, with the depth member of each
+ * point taken as given by a depth mode instead of the default one.
+ *
+ * @param points The points at which the queries will be made.
+ * @param data The data that will be returned (Vp, Vs, rho).
+ * @param numpoints The total number of points to query.
+ * @param mode LINTHURBER_DEPTH_SURFACE, LINTHURBER_DEPTH_MSL or LINTHURBER_ELEVATION.
+ * @return SUCCESS, or FAIL if the mode is unknown.
+ */
+int linthurber_query_mode(linthurber_point_t *points, linthurber_properties_t *data, int numpoints,
+                          int mode) {
+    linthurber_query_desc_t desc;
+
+    _linthurber_desc_init(&desc, points, data);
+    return linthurber_query_strided(&desc, numpoints, mode);
+}
+
+/**
+ * Writes the first points of a query and their model coordinates to the
+ * debug log, once per call on the calling thread, as the serial query did.
+ */
+void _linthurber_query_log(const linthurber_query_desc_t *desc, int numpoints) {
+    const linthurber_isa_t *isa = linthurber_velocity_model->isa;
+    const char *point;
+    double lon, lat, x, y;
+    int p;
+
+    if (!linthurber_ucvm_debug || (stderrfp == NULL)) return;
+    for (p = 0; (p < numpoints) && (p < 10); p++) {
+        point = (const char *)desc->points + (size_t)p * desc->point_stride;
+        lon = *(const double *)(point + desc->lon_offset);
+        lat = *(const double *)(point + desc->lat_offset);
+        if (isa->geo2xy(&(linthurber_configuration->proj), lon, lat, &x, &y) != 0) continue;
+        fprintf(stderrfp,"XXXX query, geo, %f %f \n", lon, lat);
+        fprintf(stderrfp,"XX query, xy, %f %f \n", x, y);
+    }
+}
+
+/**
+ * Queries linthurber at points kept in the caller's own structures, reading
+ * the coordinates and writing the properties in place. The descriptor gives
+ * the base address and byte stride of each array, and the byte offset of
+ * every double field within an element; properties with a negative offset
+ * are not written. With UCVM's ucvm_point_t, for instance, the offsets of
+ * the coordinates are those of coord[0], coord[1] and coord[2].
+ *
+ * @param desc The descriptor of the point and property arrays.
+ * @param numpoints The total number of points to query.
+ * @param mode LINTHURBER_DEPTH_SURFACE, LINTHURBER_DEPTH_MSL, LINTHURBER_ELEVATION
+ * or LINTHURBER_DEPTH_DEFAULT.
+ * @return SUCCESS, or FAIL if the mode is unknown.
+ */
+int linthurber_query_strided(const linthurber_query_desc_t *desc, int numpoints, int mode) {
+    linthurber_query_batch_t batch;
+
+    int err;
+
+    if (mode == LINTHURBER_DEPTH_DEFAULT) mode = __atomic_load_n(&linthurber_depth_mode, __ATOMIC_RELAXED);
+    if ((mode < LINTHURBER_DEPTH_SURFACE) || (mode > LINTHURBER_ELEVATION)) return FAIL;
+    if (_linthurber_state_enter(NULL) != SUCCESS) return FAIL;
+    _linthurber_query_log(desc, numpoints);
+    batch.desc = desc;
+    batch.mode = mode;
+    err = _linthurber_parallel_for(numpoints, LINTHURBER_QUERY_GRAIN, _linthurber_query_range, &batch);
+    _linthurber_state_exit();
+    return err;
+}
+
+/**
+ * The query loop for one depth mode. The mode is a constant in each caller
+ * below, so every mode gets its own loop with no per-point test of it:
+ * depths below the surface need the DEM of each column, depths below sea
+ * level and elevations never look it up.
+ */
+static inline void _linthurber_query_loop(const linthurber_query_desc_t *desc, int begin, int end,
+                                          const int mode) {
+    const linthurber_isa_t *isa = linthurber_velocity_model->isa;
+    linthurber_column_t scratch, *col;
+    linthurber_properties_t out;
+    const char *point;
+    char *data;
+    double lon[LINTHURBER_CULL_BLOCK], lat[LINTHURBER_CULL_BLOCK], depth;
+    unsigned char inside[LINTHURBER_CULL_BLOCK];
+    int b, n, q, p;
+
+    for (b = begin; b < end; b += n) {
+        n = (end - b < LINTHURBER_CULL_BLOCK) ? end - b : LINTHURBER_CULL_BLOCK;
+        for (q = 0; q < n; q++) {
+            point = (const char *)desc->points + (size_t)(b + q) * desc->point_stride;
+            lon[q] = *(const double *)(point + desc->lon_offset);
+            lat[q] = *(const double *)(point + desc->lat_offset);
+        }
+
+        /* Points outside of the model region are never projected */
+        linthurber_cull_rejected += isa->cull(&linthurber_configuration->cull, lon, lat, n, inside);
+        linthurber_cull_tested += n;
+
+        for (q = 0; q < n; q++) {
+            p = b + q;
+            if (!inside[q]) {
+                out.vp = -1.0;
+                out.vs = -1.0;
+                out.rho = -1.0;
+            } else {
+                point = (const char *)desc->points + (size_t)p * desc->point_stride;
+                depth = *(const double *)(point + desc->depth_offset);
+
+                /* Projection, DEM and horizontal weights, reused for repeated positions */
+                col = _linthurber_column_lookup(lon[q], lat[q], &scratch, mode == LINTHURBER_DEPTH_SURFACE);
+
+                if (mode == LINTHURBER_DEPTH_SURFACE) {
+                    _linthurber_column_eval(col, depth, &out);
+                } else if (mode == LINTHURBER_DEPTH_MSL) {
+                    _linthurber_column_eval_msl(col, depth, &out);
+                } else {
+                    _linthurber_column_eval_msl(col, -depth, &out);
+                }
+            }
+
+            data = (char *)desc->data + (size_t)p * desc->data_stride;
+            if (desc->vp_offset >= 0) *(double *)(data + desc->vp_offset) = out.vp;
+            if (desc->vs_offset >= 0) *(double *)(data + desc->vs_offset) = out.vs;
+            if (desc->rho_offset >= 0) *(double *)(data + desc->rho_offset) = out.rho;
+        }
+    }
+}
+
+void _linthurber_query_surface(const linthurber_query_desc_t *desc, int begin, int end) {
+    _linthurber_query_loop(desc, begin, end, LINTHURBER_DEPTH_SURFACE);
+}
+
+void _linthurber_query_msl(const linthurber_query_desc_t *desc, int begin, int end) {
+    _linthurber_query_loop(desc, begin, end, LINTHURBER_DEPTH_MSL);
+}
+
+void _linthurber_query_elevation(const linthurber_query_desc_t *desc, int begin, int end) {
+    _linthurber_query_loop(desc, begin, end, LINTHURBER_ELEVATION);
+}
+
+/**
+ * Queries linthurber at a range of described points on the calling thread.
+ *
+ * @param desc The descriptor of the point and property arrays.
+ * @param begin The first point of the range.
+ * @param end One past the last point of the range.
+ * @param mode The depth mode of the points.
+ * @return SUCCESS, or FAIL if the mode is unknown.
+ */
+int _linthurber_query_points(const linthurber_query_desc_t *desc, int begin, int end, int mode) {
+    switch (mode) {
+    case LINTHURBER_DEPTH_SURFACE:
+        _linthurber_query_surface(desc, begin, end);
+        break;
+    case LINTHURBER_DEPTH_MSL:
+        _linthurber_query_msl(desc, begin, end);
+        break;
+    case LINTHURBER_ELEVATION:
+        _linthurber_query_elevation(desc, begin, end);
+        break;
+    default:
+        return FAIL;
+    }
+    _linthurber_column_cache_flush();
+    return(SUCCESS);
+}
+
+
+/**
+ * Queries linthurber at the given points and returns the data along with
+ * the analytic gradient of each property. The gradient comes from the same
+ * trilinear cell evaluation as the value, including the change of the
+ * depth below sea level with the DEM surface, so no extra queries are
+ * needed for finite differences. Depths are taken as the depth mode of
+ * linthurber_query says. Values and gradients are always those of the
+ * trilinear interpolant on the full resolution grids: with interpolation
+ * set to anything but trilinear, the values can differ from those of
+ * linthurber_query.
+ *
+ * @param points The points at which the queries will be made.
+ * @param data The data that will be returned (Vp, Vs, rho).
+ * @param grad The gradients that will be returned, zero where no data.
+ * @param numpoints The total number of points to query.
+ * @param coords LINTHURBER_GRAD_MODEL or LINTHURBER_GRAD_GEO.
+ * @return SUCCESS or FAIL.
+ */
+int linthurber_query_gradient(linthurber_point_t *points, linthurber_properties_t *data,
+                              linthurber_gradient_t *grad, int numpoints, int coords) {
+    int err;
+
+    if (_linthurber_state_enter(NULL) != SUCCESS) return FAIL;
+    err = _linthurber_query_gradient(points, data, grad, numpoints, coords);
+    _linthurber_state_exit();
+    return err;
+}
+
+int _linthurber_query_gradient(linthurber_point_t *points, linthurber_properties_t *data,
+                               linthurber_gradient_t *grad, int numpoints, int coords) {
 
     linthurber_configuration_t *config=linthurber_configuration;
-    linthurber_model_t *model=linthurber_velocity_model;
-    
-    int k, p;
-    double x, y, z, depth_msl, depth_ratio;
 
-    /* Query model */
-    ucvm_point_t geo;      
+    int n, p;
+    double x, y, z, elev, depth_msl, dzdd;
+    double gdem[3], g[3], dxy[4], ddm[3], d[3];
+    double *val[2], *out[2];
+    double spacing[2] = { config->spacing_vp, config->spacing_vs };
+    int prop[2] = { LINTHURBER_VP, LINTHURBER_VS };
+
+    ucvm_point_t geo;
     ucvm_point_t xy;
 
+    int mode = __atomic_load_n(&linthurber_depth_mode, __ATOMIC_RELAXED);
+    double sign = (mode == LINTHURBER_ELEVATION) ? -1.0 : 1.0;
+
+    if ((coords != LINTHURBER_GRAD_MODEL) && (coords != LINTHURBER_GRAD_GEO)) {
+        return(FAIL);
+    }
+
     for (p = 0; p < numpoints; p++) {
         geo.coord[0]= points[p].longitude;
         geo.coord[1]= points[p].latitude;
@@ -128,90 +568,129 @@ int linthurber_query(linthurber_point_t *points, linthurber_properties_t *data,
         data[p].vp = -1.0;
         data[p].vs = -1.0;
         data[p].rho = -1.0;
+        memset(&grad[p], 0, sizeof(linthurber_gradient_t));
+
+        if (ucvm_bilinear_geo2xy(&(config->proj), &geo, &xy) != 0) { continue; }
+
+        x=xy.coord[0];
+        y=xy.coord[1];
+
+        /* Derivatives of depth_msl (km) along x, y and depth (m) */
+        if (mode == LINTHURBER_DEPTH_SURFACE) {
+            /* DEM elevation value and slope */
+            elev = 0.0;
+            gdem[0] = gdem[1] = gdem[2] = 0.0;
+            if (_linthurber_getval_grad(x/config->spacing_dem,
+                       y/config->spacing_dem,
+                       0.0, LINTHURBER_DEM,
+                       &elev, gdem) != SUCCESS) { continue; }
+
+            depth_msl = (points[p].depth - elev)/1000.0;
+            ddm[0] = -gdem[0] / config->spacing_dem / 1000.0;
+            ddm[1] = -gdem[1] / config->spacing_dem / 1000.0;
+        } else {
+            /* Below sea level, or above it with the sign flipped; no DEM */
+            depth_msl = sign * points[p].depth / 1000.0;
+            ddm[0] = 0.0;
+            ddm[1] = 0.0;
+        }
+        ddm[2] = sign / 1000.0;
+        z = _linthurber_depth_index(config, depth_msl, &dzdd);
 
-        if (ucvm_bilinear_geo2xy(&(config->proj), &geo, &xy) == 0) {
-
-          x=xy.coord[0];
-	  y=xy.coord[1];
-
-if(p < 10) {
-  fprintf(stderrfp,"XXXX query, geo, %f %f \n", geo.coord[0] , geo.coord[1]);
-  fprintf(stderrfp,"XX query, xy, %f %f \n", x, y);
-}
-
-          if (LINTHURBER_USE_DEM) {
-
-              /* DEM elevation value */
-              if (_linthurber_getval(x/config->spacing_dem,
-                         y/config->spacing_dem,
-                         0.0, LINTHURBER_DEM, 
-                         &depth_msl) != SUCCESS) { continue; }
-
-              depth_msl = (points[p].depth - depth_msl)/1000.0;
-              for (k = 0; k < config->num_z; k++) {
-                 if (config->depths_msl[k] >= depth_msl) { break; }
-              }
-
-              if (k == config->num_z) {
-                 k = config->num_z - 1;
-                 depth_ratio = 0.0;
-                 z = k;
-                 } else if (k == 0) {
-                    depth_ratio = 0.0;
-                    z = k;
-                    } else {
-                        depth_ratio = (depth_msl - config->depths_msl[k-1]) /
-                                  (config->depths_msl[k] - config->depths_msl[k-1]); 
-                        z = (k-1) + depth_ratio;
-               }
-       
-               /* Vp value */
-               _linthurber_getval(x / config->spacing_vp,
-                              y / config->spacing_vp, z, LINTHURBER_VP, &(data[p].vp));
-       
-              /* Vs value */
-               _linthurber_getval(x / config->spacing_vs,
-                              y / config->spacing_vs, z, LINTHURBER_VS, &(data[p].vs));
-              } else {
-    
-                  depth_msl = points[p].depth/1000.0;
-                  for (k = 0; k < config->num_z; k++) {
-                      if (config->depths_msl[k] >= depth_msl) { break; }
-                  }
-                  if (k == config->num_z) { k = config->num_z - 1; }
-                  z = k;
-   
-                  /* Vp value */
-                  _linthurber_getval(x / config->spacing_vp,
-                            y / config->spacing_vp, z, LINTHURBER_VP, &(data[p].vp));
-              
-                  /* Vs value */
-                  _linthurber_getval(x / config->spacing_vs,
-                            y / config->spacing_vs, z, LINTHURBER_VS, &(data[p].vs));
-          }
-
-         /* Calculate density */
-         if (data[p].vp > 0.0) { data[p].rho = _get_rho(data[p].vp); }
-       }
-    } // for loop
+        if (coords == LINTHURBER_GRAD_GEO) {
+            _linthurber_geo_jacobian(config, x, y, dxy);
+        }
+
+        val[0] = &(data[p].vp);
+        val[1] = &(data[p].vs);
+        out[0] = grad[p].vp;
+        out[1] = grad[p].vs;
+
+        for (n = 0; n < 2; n++) {
+            if (_linthurber_getval_grad(x / spacing[n], y / spacing[n], z,
+                       prop[n], val[n], g) != SUCCESS) { continue; }
+
+            d[0] = g[0] / spacing[n] + g[2] * dzdd * ddm[0];
+            d[1] = g[1] / spacing[n] + g[2] * dzdd * ddm[1];
+            d[2] = g[2] * dzdd * ddm[2];
+
+            if (coords == LINTHURBER_GRAD_GEO) {
+                out[n][0] = d[0] * dxy[0] + d[1] * dxy[2];
+                out[n][1] = d[0] * dxy[1] + d[1] * dxy[3];
+            } else {
+                out[n][0] = d[0];
+                out[n][1] = d[1];
+            }
+            out[n][2] = d[2];
+        }
+
+        /* Calculate density */
+        if (data[p].vp > 0.0) {
+            data[p].rho = _get_rho(data[p].vp);
+            for (n = 0; n < 3; n++) {
+                grad[p].rho[n] = _get_rho_deriv(data[p].vp) * grad[p].vp[n];
+            }
+        }
+    }
     return(SUCCESS);
 }
 
 
-int _linthurber_getval(double i, double j, double k, int prop,
-                  double *val) {
+/**
+ * Computes the derivatives of the model x/y coordinates with respect to
+ * longitude and latitude at a point, by inverting the Jacobian of the
+ * bilinear mapping from the model rectangle to the corner coordinates.
+ *
+ * @param config The model configuration.
+ * @param x The model x coordinate in meters.
+ * @param y The model y coordinate in meters.
+ * @param dxy dx/dlon, dx/dlat, dy/dlon and dy/dlat.
+ */
+void _linthurber_geo_jacobian(linthurber_configuration_t *config, double x, double y,
+                              double dxy[4]) {
+
+    double *xi = config->proj.xi, *yi = config->proj.yi;
+    double s = x / config->proj.dims[0], t = y / config->proj.dims[1];
+    double a, b, c, d, det;
+
+    /* Corners 0..3 sit at (0,0), (0,Y), (X,Y) and (X,0) */
+    a = ((1.0 - t) * (xi[3] - xi[0]) + t * (xi[2] - xi[1])) / config->proj.dims[0];
+    b = ((1.0 - s) * (xi[1] - xi[0]) + s * (xi[2] - xi[3])) / config->proj.dims[1];
+    c = ((1.0 - t) * (yi[3] - yi[0]) + t * (yi[2] - yi[1])) / config->proj.dims[0];
+    d = ((1.0 - s) * (yi[1] - yi[0]) + s * (yi[2] - yi[3])) / config->proj.dims[1];
+
+    det = a * d - b * c;
+    dxy[0] = d / det;
+    dxy[1] = -b / det;
+    dxy[2] = -c / det;
+    dxy[3] = a / det;
+}
+
+
+/**
+ * Gathers the eight corner values of the grid cell holding fractional
+ * index (i, j, k), replicating edge values where the cell extends past the
+ * grid.
+ *
+ * @param i The fractional x index.
+ * @param j The fractional y index.
+ * @param k The fractional z index.
+ * @param prop LINTHURBER_DEM, LINTHURBER_VP or LINTHURBER_VS.
+ * @param q The corner values, indexed [z][y][x].
+ * @param f The position of the point within the cell, per axis.
+ * @return SUCCESS, or FAIL if the point falls outside of the grid.
+ */
+int _linthurber_getcell(double i, double j, double k, int prop,
+                  double q[2][2][2], double f[3]) {
 
   linthurber_configuration_t *config=linthurber_configuration;
   linthurber_model_t *model=linthurber_velocity_model;
 
   int i0, j0, k0;
-  int a, b, c, x, y, z;
+  int a, b, c;
+  size_t sy, sz;
   int *dims = NULL;
-  float *buf = NULL;
-  double p[2][3];
-  double q[2][2][2];
-
-  *val = -1.0;
+  float *buf = NULL, *cell;
 
   i0 = (int)i;
   j0 = (int)j;
@@ -245,37 +724,46 @@ int _linthurber_getval(double i, double j, double k, int prop,
     return(FAIL);
   }
 
-  /* Values at corners of interpolation cube */
-  for (z = 0; z < 2; z++) {
-    for (y = 0; y < 2; y++) {
-      for (x = 0; x < 2; x++) {
-
-     a = i0 + x;
-     b = j0 + y;
-     c = k0 + z;
-
-     if (a < 0) {
-       a = 0;
-     }
-     if (b < 0) {
-       b = 0;
-     }
-     if (c < 0) {
-       c = 0;
-     }
-     if (a >= dims[0]) {
-       a = dims[0] - 1;
-     }
-     if (b >= dims[1]) {
-       b = dims[1] - 1;
-     }
-     if (c >= dims[2]) {
-       c = dims[2] - 1;
-     }
-
-     q[z][y][x] = buf[c*dims[0]*dims[1] + b*dims[0] + a];
-      }
-    }
+  /* Values at corners of interpolation cube; corners past the last node
+     fall on the padding, which repeats the edge */
+  sy = dims[0] + 1;
+  sz = sy * (dims[1] + 1);
+  cell = buf + LINTHURBER_NODE(dims, i0, j0, k0);
+
+  q[0][0][0] = cell[0];
+  q[0][0][1] = cell[1];
+  q[0][1][0] = cell[sy];
+  q[0][1][1] = cell[sy + 1];
+  q[1][0][0] = cell[sz];
+  q[1][0][1] = cell[sz + 1];
+  q[1][1][0] = cell[sz + sy];
+  q[1][1][1] = cell[sz + sy + 1];
+
+  f[0] = i - i0;
+  f[1] = j - j0;
+  f[2] = k - k0;
+
+  return(SUCCESS);
+}
+
+
+int _linthurber_getval(double i, double j, double k, int prop,
+                  double *val) {
+
+  int a, b;
+  double p[2][3];
+  double q[2][2][2];
+  double f[3];
+
+  /* Cells with eight equal corners need no interpolation */
+  if (_linthurber_uniform_value(i, j, k, prop, val) == SUCCESS) {
+    return(SUCCESS);
+  }
+
+  *val = -1.0;
+
+  if (_linthurber_getcell(i, j, k, prop, q, f) != SUCCESS) {
+    return(FAIL);
   }
 
   /* Corners of interpolation cube */
@@ -286,24 +774,128 @@ int _linthurber_getval(double i, double j, double k, int prop,
   }
 
   /* Trilinear interpolation from UCVM/src/ucvm/ucvm_utils.c */
-  *val = interpolate_trilinear(i-i0, j-j0, k-k0, p, q);
+  *val = interpolate_trilinear(f[0], f[1], f[2], p, q);
 
   return(SUCCESS);
 }
 
 
-/* Density derived from Vp via Nafe-Drake curve, Brocher (2005) eqn 1. */
-double _get_rho(double f) {
+/**
+ * Like _linthurber_getval, and also returns the analytic gradient of the
+ * trilinear field with respect to the fractional indices, taken from the
+ * same cell, which is read once.
+ *
+ * @param i The fractional x index.
+ * @param j The fractional y index.
+ * @param k The fractional z index.
+ * @param prop LINTHURBER_DEM, LINTHURBER_VP or LINTHURBER_VS.
+ * @param val The interpolated value, -1.0 outside of the grid.
+ * @param grad d/di, d/dj and d/dk of the value, 0.0 outside of the grid.
+ * @return SUCCESS or FAIL.
+ */
+int _linthurber_getval_grad(double i, double j, double k, int prop,
+                  double *val, double grad[3]) {
+
+  int a, b;
+  double p[2][3];
+  double q[2][2][2];
+  double f[3], g[3];
+
+  grad[0] = grad[1] = grad[2] = 0.0;
+  *val = -1.0;
+
+  if (_linthurber_getcell(i, j, k, prop, q, f) != SUCCESS) {
+    return(FAIL);
+  }
+
+  /* The blend of _linthurber_getval, without its uniform cell shortcut */
+  for (b = 0; b < 2; b++) {
+    for (a = 0; a < 3; a++) {
+      p[b][a] = (double)b;
+    }
+  }
+  *val = interpolate_trilinear(f[0], f[1], f[2], p, q);
+
+  g[0] = 1.0 - f[0];
+  g[1] = 1.0 - f[1];
+  g[2] = 1.0 - f[2];
+
+  grad[0] = g[2] * (g[1] * (q[0][0][1] - q[0][0][0]) + f[1] * (q[0][1][1] - q[0][1][0])) +
+            f[2] * (g[1] * (q[1][0][1] - q[1][0][0]) + f[1] * (q[1][1][1] - q[1][1][0]));
+  grad[1] = g[2] * (g[0] * (q[0][1][0] - q[0][0][0]) + f[0] * (q[0][1][1] - q[0][0][1])) +
+            f[2] * (g[0] * (q[1][1][0] - q[1][0][0]) + f[0] * (q[1][1][1] - q[1][0][1]));
+  grad[2] = g[1] * (g[0] * (q[1][0][0] - q[0][0][0]) + f[0] * (q[1][0][1] - q[0][0][1])) +
+            f[1] * (g[0] * (q[1][1][0] - q[0][1][0]) + f[0] * (q[1][1][1] - q[0][1][1]));
+
+  return(SUCCESS);
+}
+
+
+/**
+ * Converts a depth below mean sea level into a fractional z index with a
+ * given table of layer depths. Inlined with the table as a constant in a
+ * specialized build.
+ */
+static inline double _linthurber_depth_table(const double *depths_msl, const int num_z,
+                                             double depth_msl, double *dzdd) {
+
+  int k;
+  double depth_ratio, z;
+
+  if (dzdd) *dzdd = 0.0;
+
+  for (k = 0; k < num_z; k++) {
+     if (depths_msl[k] >= depth_msl) { break; }
+  }
+
+  if (k == num_z) {
+     k = num_z - 1;
+     z = k;
+  } else if (k == 0) {
+     z = k;
+  } else {
+     depth_ratio = (depth_msl - depths_msl[k-1]) /
+                   (depths_msl[k] - depths_msl[k-1]); 
+     z = (k-1) + depth_ratio;
+     if (dzdd) *dzdd = 1.0 / (depths_msl[k] - depths_msl[k-1]);
+  }
+  return(z);
+}
+
+/**
+ * Converts a depth below mean sea level into the fractional z index of the
+ * vp/vs grids, linear between the depths_msl layers and clamped to the top
+ * and bottom layers.
+ *
+ * @param config The model configuration.
+ * @param depth_msl The depth below mean sea level in kilometers.
+ * @param dzdd If not NULL, receives the derivative of the index with
+ * respect to depth_msl (per kilometer), 0.0 where the index is clamped.
+ * @return The fractional z index.
+ */
+double _linthurber_depth_index(linthurber_configuration_t *config, double depth_msl,
+                  double *dzdd) {
+#ifdef LINTHURBER_SPECIALIZED
+  if (config->specialized) {
+     return _linthurber_depth_table(linthurber_fixed_depths_msl, LINTHURBER_FIXED_NUM_Z,
+                                    depth_msl, dzdd);
+  }
+#endif
+  return _linthurber_depth_table(config->depths_msl, config->num_z, depth_msl, dzdd);
+}
+
+
+/* Derivative of _get_rho with respect to Vp, 0.0 where the density is clamped. */
+double _get_rho_deriv(double f) {
   double rho;
 
-  /* Convert m to km */
   f = f / 1000.0;
   rho = f * (1.6612 - f * (0.4721 - f * (0.0671 - f * (0.0043 - f * 0.000106))));
   if (rho < 1.0) {
-    rho = 1.0;
+    return(0.0);
   }
-  rho = rho * 1000.0;
-  return(rho);
+  /* d(rho in g/m^3)/d(vp in m/s) equals d(rho in g/cm^3)/d(vp in km/s) */
+  return(1.6612 - f * (2.0 * 0.4721 - f * (3.0 * 0.0671 - f * (4.0 * 0.0043 - f * 5.0 * 0.000106))));
 }
 
 
@@ -314,21 +906,19 @@ double _get_rho(double f) {
  */
 int linthurber_finalize() {
 
-    if(linthurber_ucvm_debug) {
+    /* Let submitted batches finish before the model goes away */
+    _linthurber_pool_shutdown();
+
+    if(linthurber_ucvm_debug && stderrfp) {
       fclose(stderrfp);
+      stderrfp = NULL;
     }
 
-    if (linthurber_configuration) free(linthurber_configuration);
-
-    if (linthurber_velocity_model) {
-      if (linthurber_velocity_model->vp_status == 2)
-          { free(linthurber_velocity_model->vp); }
-      if (linthurber_velocity_model->vs_status == 2)
-          { free(linthurber_velocity_model->vs); }
-      if (linthurber_velocity_model->dem_status == 2)
-          { free(linthurber_velocity_model->dem); }
-      free(linthurber_velocity_model);
-    }
+    /* Unpublish the model, freed once no query uses it */
+    _linthurber_state_publish(NULL);
+    linthurber_configuration = NULL;
+    linthurber_velocity_model = NULL;
+    linthurber_is_initialized = 0;
     return SUCCESS;
 }
 
@@ -352,21 +942,20 @@ int linthurber_version(char *ver, int len)
 }
 
 /**
- * Returns the model config information.
+ * Returns the model config information. The string belongs to the model
+ * in use and stays valid until the model is replaced or finalized.
  *
  * @param key Config key string to return.
  * @param sz number of config terms.
- * @return Zero
+ * @return SUCCESS, or FAIL if no model is loaded.
  */
 int linthurber_config(char **config, int *sz)
 {
-  int len=strlen(linthurber_config_string);
-  if(len > 0) {
-    *config=linthurber_config_string;
-    *sz=linthurber_config_sz;
-    return SUCCESS;
-  }
-  return FAIL;
+  if (_linthurber_state_enter(NULL) != SUCCESS) return FAIL;
+  *config = _linthurber_state_view()->config->config_string;
+  *sz = 1;
+  _linthurber_state_exit();
+  return SUCCESS;
 }
 
 
@@ -379,8 +968,8 @@ int linthurber_config(char **config, int *sz)
  */
 int linthurber_read_configuration(char *file, linthurber_configuration_t *config) {
     FILE *fp = fopen(file, "r");
-    char key[40];
-    char value[80];
+    char key[40] = "";
+    char value[80] = "";
     char line_holder[128];
 
     // If our file pointer is null, an error has occurred. Return fail.
@@ -389,6 +978,9 @@ int linthurber_read_configuration(char *file, linthurber_configuration_t *config
         return FAIL;
     }
 
+    config->interpolation = LINTHURBER_INTERP_TRILINEAR;
+    config->lod_levels = LINTHURBER_LOD_LEVELS;
+
     // Read the lines in the linthurber_configuration file.
     while (fgets(line_holder, sizeof(line_holder), fp) != NULL) {
         if (line_holder[0] != '#' && line_holder[0] != ' ' && line_holder[0] != '\n') {
@@ -423,9 +1015,27 @@ int linthurber_read_configuration(char *file, linthurber_configuration_t *config
             }
 
             if (strcmp(key, "interpolation") == 0) { 
-                config->interpolation=0;
-                if (strcmp(value,"on") == 0) config->interpolation=1;
+                config->interpolation=LINTHURBER_INTERP_BILINEAR;
+                if ((strcmp(value,"on") == 0) || (strcmp(value,"trilinear") == 0))
+                    config->interpolation=LINTHURBER_INTERP_TRILINEAR;
+                if (strcmp(value,"nearest") == 0) config->interpolation=LINTHURBER_INTERP_NEAREST;
+                if (strcmp(value,"cubic") == 0) config->interpolation=LINTHURBER_INTERP_CUBIC;
             }
+
+            if (strcmp(key, "lod_levels") == 0) config->lod_levels = atoi(value);
+
+            if (strcmp(key, "layout") == 0) {
+                config->layout = LINTHURBER_LAYOUT_GRID;
+                if (strcmp(value,"packed") == 0) config->layout = LINTHURBER_LAYOUT_PACKED;
+            }
+
+            if (strcmp(key, "warmup") == 0) {
+                config->warmup = LINTHURBER_WARMUP_OFF;
+                if (strcmp(value,"background") == 0) config->warmup = LINTHURBER_WARMUP_BACKGROUND;
+                if (strcmp(value,"block") == 0) config->warmup = LINTHURBER_WARMUP_BLOCK;
+            }
+            if (strcmp(key, "mlock") == 0) config->mlock = (strcmp(value,"on") == 0);
+            if (strcmp(key, "huge_pages") == 0) config->huge_pages = (strcmp(value,"on") == 0);
         }
     }
     // calculated config setting
@@ -498,6 +1108,10 @@ int _dump_linthurber_configuration(linthurber_configuration_t *config) {
     fprintf(stderrfp,"    vp_origin : %f %f\n",config->vp_origin[0],config->vp_origin[1]);
     fprintf(stderrfp,"    vs_origin : %f %f\n",config->vs_origin[0],config->vs_origin[1]);
     fprintf(stderrfp,"    interpolation : %d\n",config->interpolation);
+    fprintf(stderrfp,"    lod_levels : %d\n",config->lod_levels);
+    fprintf(stderrfp,"    layout : %d\n",config->layout);
+    fprintf(stderrfp,"    warmup : %d mlock : %d huge_pages : %d\n",config->warmup,config->mlock,
+            config->huge_pages);
 
     for(int i=0; i< config->num_z; i++) {
        fprintf(stderrfp,"       depths_msl <%d> (%f)\n",i,config->depths_msl[i]);
@@ -553,6 +1167,50 @@ int _too_big_vp() {
     }
 }
 
+/**
+ * Returns the number of values of a padded grid.
+ *
+ * @param dims The grid dimensions, padding excluded.
+ */
+size_t _linthurber_grid_len(int *dims) {
+    return (size_t)(dims[0] + 1) * (dims[1] + 1) * (dims[2] + 1);
+}
+
+/**
+ * Computes the number of values held by each model buffer.
+ *
+ * @param config The configuration the model is built from.
+ * @param model The model whose buffer lengths are set.
+ */
+void _linthurber_model_lengths(linthurber_configuration_t *config, linthurber_model_t *model) {
+    model->vp_len = _linthurber_grid_len(config->vp_dims);
+    model->vs_len = _linthurber_grid_len(config->vs_dims);
+    model->dem_len = _linthurber_grid_len(config->dem_dims);
+}
+
+/**
+ * Fills the padding of a grid with copies of its edge nodes: the node past
+ * the last along x, then the row past the last along y, then the layer past
+ * the last along z.
+ *
+ * @param buf The padded grid.
+ * @param dims The grid dimensions, padding excluded.
+ */
+void _linthurber_pad_grid(float *buf, int *dims) {
+    size_t row = dims[0] + 1;
+    int j, k;
+
+    for (k = 0; k < dims[2]; k++) {
+        for (j = 0; j < dims[1]; j++) {
+            buf[LINTHURBER_NODE(dims, dims[0], j, k)] = buf[LINTHURBER_NODE(dims, dims[0] - 1, j, k)];
+        }
+        memcpy(buf + LINTHURBER_NODE(dims, 0, dims[1], k), buf + LINTHURBER_NODE(dims, 0, dims[1] - 1, k),
+               row * sizeof(float));
+    }
+    memcpy(buf + LINTHURBER_NODE(dims, 0, 0, dims[2]), buf + LINTHURBER_NODE(dims, 0, 0, dims[2] - 1),
+           row * (dims[1] + 1) * sizeof(float));
+}
+
 /**
  * Tries to read the model into memory.
  *
@@ -569,14 +1227,21 @@ int linthurber_try_reading_model(linthurber_model_t *model) {
 
     linthurber_configuration_t *config=linthurber_configuration;
 
-    int vp_sz = (config->vp_dims[0] * config->vp_dims[1] * config->vp_dims[2]);
-    int vs_sz = (config->vs_dims[0] * config->vs_dims[1] * config->vs_dims[2]);
-    int dem_sz = (config->dem_dims[0] * config->dem_dims[1] * config->dem_dims[2]);
+    _linthurber_model_lengths(config, model);
+    size_t vp_sz = model->vp_len;
+    size_t vs_sz = model->vs_len;
+    size_t dem_sz = model->dem_len;
+    size_t n;
 
     /* Allocate buffers */
-    model->vp = malloc(vp_sz * sizeof(float));
-    model->vs = malloc(vs_sz * sizeof(float));
-    model->dem = malloc(dem_sz * sizeof(float));
+    model->vp = _linthurber_grid_alloc(config, vp_sz);
+    model->vs = _linthurber_grid_alloc(config, vs_sz);
+    model->dem = _linthurber_grid_alloc(config, dem_sz);
+
+    /* Owned by the model from here on, freed with it if the load fails */
+    model->vp_status = 2;
+    model->vs_status = 2;
+    model->dem_status = 2;
 
     if ((model->vp == NULL) || (model->vs == NULL) || (model->dem == NULL)) {
         fprintf(stderr, "Failed to allocate buffers Lin-Thurber model\n");
@@ -584,15 +1249,19 @@ int linthurber_try_reading_model(linthurber_model_t *model) {
     }
 
     /* initialize them to -1 */
-    for (i = 0; i < vp_sz; i++) { model->vp[i] = -1.0; }
-    for (i = 0; i < vs_sz; i++) { model->vs[i] = -1.0; }
-    for (i = 0; i < dem_sz; i++) { model->dem[i] = 0.0; }
+    for (n = 0; n < vp_sz; n++) { model->vp[n] = -1.0; }
+    for (n = 0; n < vs_sz; n++) { model->vs[n] = -1.0; }
+    for (n = 0; n < dem_sz; n++) { model->dem[n] = 0.0; }
 
     /* Load Vp velocity file*/
     /* Load Vp velocity file*/
-    sprintf(filename, "%s/lin-thurber.vp", linthurber_data_directory);
+    sprintf(filename, "%s/lin-thurber.vp", config->data_directory);
     num_read = 0;
     fp = fopen(filename, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "Failed to open Lin-Thurber Vp file %s\n", filename);
+        return(FAIL);
+    }
     while (!feof(fp)) {
         retval = fscanf(fp, "%*f %*f %f %f %f %f %*f", &dep, &y, &x, &val);
         if (retval != EOF) {
@@ -600,6 +1269,7 @@ int linthurber_try_reading_model(linthurber_model_t *model) {
                 fprintf(stderr, 
                     "Failed to read Lin-Thurber Vp file, line %d (parsed %d)\n",
                     num_read, retval);
+                fclose(fp);
                 return(FAIL);
             }
             for (k = 0; k < config->num_z; k++) {
@@ -617,19 +1287,23 @@ int linthurber_try_reading_model(linthurber_model_t *model) {
                                (j >= config->vp_dims[1]) || 
                                (k >= config->vp_dims[2])) {
               fprintf(stderr, "1)Invalid index %d,%d,%d calculated\n", i, j, k);
+              fclose(fp);
               return(FAIL);
             }
-            model->vp[k*config->vp_dims[0]*config->vp_dims[1] + 
-                                    j*config->vp_dims[0] + i] = val * 1000.0;
+            model->vp[LINTHURBER_NODE(config->vp_dims, i, j, k)] = val * 1000.0;
             num_read++;
         }
     }
     fclose(fp);
 
     /* Load Vs velocity file */
-    sprintf(filename, "%s/lin-thurber.vs", linthurber_data_directory);
+    sprintf(filename, "%s/lin-thurber.vs", config->data_directory);
     num_read = 0;
     fp = fopen(filename, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "Failed to open Lin-Thurber Vs file %s\n", filename);
+        return(FAIL);
+    }
     while (!feof(fp)) {
         retval = fscanf(fp, "%*f %*f %f %f %f %f %*f", &dep, &y, &x, &val);
         if (retval != EOF) {
@@ -637,6 +1311,7 @@ int linthurber_try_reading_model(linthurber_model_t *model) {
                 fprintf(stderr, 
                     "Failed to read Lin-Thurber Vs file, line %d (parsed %d)\n",
 		    num_read, retval);
+                fclose(fp);
                 return(FAIL);
             }
             for (k = 0; k < config->num_z; k++) {
@@ -653,23 +1328,33 @@ int linthurber_try_reading_model(linthurber_model_t *model) {
                      (j >= config->vs_dims[1]) || 
                      (k >= config->vs_dims[2])) {
                fprintf(stderr, "2)Invalid index %d,%d,%d calculated\n", i, j, k);
+               fclose(fp);
                return(FAIL);
             }
-            model->vs[k*config->vs_dims[0]*config->vs_dims[1] + 
-                             j*config->vs_dims[0] + i] = val * 1000.0;
+            model->vs[LINTHURBER_NODE(config->vs_dims, i, j, k)] = val * 1000.0;
             num_read++;
         }
     }
     fclose(fp);
 
     /* Load DEM file */
-    sprintf(filename, "%s/lin-thurber.dem", linthurber_data_directory);
+    sprintf(filename, "%s/lin-thurber.dem", config->data_directory);
     fp = fopen(filename, "r");
-    num_read = fread(model->dem, sizeof(float), dem_sz, fp);
-    if (num_read != dem_sz) {
-        fprintf(stderr, "Failed to read Lin-Thurber DEM file\n");
+    if (fp == NULL) {
+        fprintf(stderr, "Failed to open Lin-Thurber DEM file %s\n", filename);
         return(FAIL);
     }
+    for (j = 0; j < config->dem_dims[1]; j++) {
+        /* One row at a time, the file is not padded */
+        num_read = fread(model->dem + LINTHURBER_NODE(config->dem_dims, 0, j, 0), sizeof(float),
+                         config->dem_dims[0], fp);
+        if (num_read != config->dem_dims[0]) {
+            fprintf(stderr, "Failed to read Lin-Thurber DEM file\n");
+            fclose(fp);
+            return(FAIL);
+        }
+    }
+    fclose(fp);
 
     /* Swap endian from LSB to MSB */
 /** XXX ???
@@ -681,9 +1366,12 @@ int linthurber_try_reading_model(linthurber_model_t *model) {
     fclose(fp);
 **/
 
-    model->vp_status = 2;
-    model->vs_status = 2;
-    model->dem_status = 2;
+    _linthurber_pad_grid(model->vp, config->vp_dims);
+    _linthurber_pad_grid(model->vs, config->vs_dims);
+    _linthurber_pad_grid(model->dem, config->dem_dims);
+
+    /* Optional precomputed site map */
+    _linthurber_read_sitemap(model);
 
   return(SUCCESS);
 }
@@ -8,24 +8,106 @@
  *
  */
 
+#ifndef LINTHURBER_H
+#define LINTHURBER_H
+
+#include <stddef.h>
+
 #include "ucvm_dtypes.h"
+#include "ucvm_proj_bilinear.h"
+
+/* Grid constants of a specialized build, see linthurber_specialize.sh */
+#ifdef LINTHURBER_SPECIALIZED
+#include "linthurber_constants.h"
+#endif
 
 // Constants
 /* Property constants */
 #define LINTHURBER_DEM 0
 #define LINTHURBER_VP 1
 #define LINTHURBER_VS 2
+#define LINTHURBER_RHO 3
 
-/* Flags */
-#define LINTHURBER_USE_DEM 1
+/* Depth modes, how the depth member of a point is taken */
+/** Depth below the DEM surface in meters, the default */
+#define LINTHURBER_DEPTH_SURFACE 0
+/** Depth below mean sea level in meters */
+#define LINTHURBER_DEPTH_MSL 1
+/** Elevation above mean sea level in meters */
+#define LINTHURBER_ELEVATION 2
+/** The mode set with linthurber_set_depth_mode, for linthurber_query_strided */
+#define LINTHURBER_DEPTH_DEFAULT -1
 
 #define LINTHURBER_MAX_Z_DIM 100
 
 #define LINTHURBER_CONFIG_MAX 1000
 
+/* Interpolation settings */
+/** Bilinear within the nearest layer, interpolation = off or bilinear */
+#define LINTHURBER_INTERP_BILINEAR 0
+/** Trilinear, interpolation = on or trilinear */
+#define LINTHURBER_INTERP_TRILINEAR 1
+/** Value of the nearest node, interpolation = nearest */
+#define LINTHURBER_INTERP_NEAREST 2
+/** Catmull-Rom along each grid index, interpolation = cubic */
+#define LINTHURBER_INTERP_CUBIC 3
+
+/* Storage layouts of the vp and vs grids */
+/** Nodes only, x fastest, then y, then z */
+#define LINTHURBER_LAYOUT_GRID 0
+/** Nodes, plus the eight corners of every cell stored together */
+#define LINTHURBER_LAYOUT_PACKED 1
+
+/** Values per corner-packed cell */
+#define LINTHURBER_CELL_SIZE 8
+/** Tricubic coefficients per cell, indexed [z power][y power][x power] */
+#define LINTHURBER_CUBIC_SIZE 64
+
+/* Warmup of the model memory after a load */
+/** None, pages fault in as queries first read them */
+#define LINTHURBER_WARMUP_OFF 0
+/** In a background thread while queries are served */
+#define LINTHURBER_WARMUP_BACKGROUND 1
+/** Before the load returns */
+#define LINTHURBER_WARMUP_BLOCK 2
+
+/** Offset of a property linthurber_query_strided does not write */
+#define LINTHURBER_FIELD_NONE -1
+
+/* Instruction set levels of the query kernels */
+/** The best level the CPU supports */
+#define LINTHURBER_ISA_AUTO -1
+/** The target of the build */
+#define LINTHURBER_ISA_BASELINE 0
+#define LINTHURBER_ISA_SSE42 1
+/** AVX2 with FMA */
+#define LINTHURBER_ISA_AVX2 2
+/** AVX-512 F, VL and DQ */
+#define LINTHURBER_ISA_AVX512 3
+
+/* Level-of-detail pyramid */
+/** Most levels per grid, the grid itself included */
+#define LINTHURBER_MAX_LOD 8
+/** Levels built when the configuration does not set lod_levels */
+#define LINTHURBER_LOD_LEVELS 6
+
+/* Gradient coordinate systems */
+/** Per meter along the model x and y axes and per meter of depth */
+#define LINTHURBER_GRAD_MODEL 0
+/** Per degree of longitude and latitude and per meter of depth */
+#define LINTHURBER_GRAD_GEO 1
+
 #define SUCCESS 0
 #define FAIL 1
 
+/* Grids are stored padded with one node past the last along x, y and z,
+   holding a copy of the edge, so every corner of a cell in range exists */
+/** Offset of node (i, j, k) in a padded grid of the given dimensions */
+#define LINTHURBER_NODE(dims, i, j, k) \
+     ((((size_t)(k) * ((dims)[1] + 1) + (j)) * ((dims)[0] + 1)) + (i))
+/** 1 if cell n is set in a uniform cell bitmap */
+#define LINTHURBER_UNIFORM(map, n) (((map)[(n) >> 3] >> ((n) & 7)) & 1)
+
 // Structures
 /** Defines a point (latitude, longitude, and depth) in WGS84 format */
 typedef struct linthurber_point_t {
@@ -51,12 +133,100 @@ typedef struct linthurber_properties_t {
      double qs;
 } linthurber_properties_t;
 
+/** Spatial gradient of the material properties at a point. */
+typedef struct linthurber_gradient_t {
+     /** Derivatives of Vp along x (or longitude), y (or latitude) and depth */
+     double vp[3];
+     /** Derivatives of Vs along x (or longitude), y (or latitude) and depth */
+     double vs[3];
+     /** Derivatives of density along x (or longitude), y (or latitude) and depth */
+     double rho[3];
+} linthurber_gradient_t;
+
+/** A ray path given as a polyline, and its segment travel times. */
+typedef struct linthurber_ray_t {
+     /** The vertices of the path */
+     linthurber_point_t *points;
+     /** The number of vertices */
+     int numpoints;
+     /** The numpoints - 1 segment travel times in seconds, filled in by the query */
+     double *times;
+} linthurber_ray_t;
+
+/** Site parameters derived from the vertical Vs profile. */
+typedef struct linthurber_site_t {
+     /** Time-averaged Vs over the top 30 m, in meters per second */
+     double vs30;
+     /** Depth below the surface where Vs first reaches 1.0 km/s, in meters */
+     double z1p0;
+     /** Depth below the surface where Vs first reaches 2.5 km/s, in meters */
+     double z2p5;
+} linthurber_site_t;
+
+/** Counters of the work-stealing scheduler behind the parallel APIs. */
+typedef struct linthurber_sched_stats_t {
+     /** Worker threads in the pool */
+     int threads;
+     /** Ranges of items run */
+     long tasks;
+     /** Ranges taken from another worker's queue */
+     long steals;
+     /** Seconds workers spent without work, summed over workers */
+     double idle_time;
+} linthurber_sched_stats_t;
+
+/** A batch submitted with linthurber_submit. */
+typedef struct linthurber_ticket_t linthurber_ticket_t;
+
+/**
+ * Describes caller-owned arrays of points and properties, read and written
+ * in place by linthurber_query_strided. Every field is a double; offsets
+ * are in bytes from the start of an element.
+ */
+typedef struct linthurber_query_desc_t {
+     /** First point, and bytes from one point to the next */
+     const void *points;
+     size_t point_stride;
+     /** Longitude, latitude and depth (as the depth mode takes it) */
+     size_t lon_offset;
+     size_t lat_offset;
+     size_t depth_offset;
+     /** First element of the properties, and bytes from one to the next */
+     void *data;
+     size_t data_stride;
+     /** Vp, vs and rho, or LINTHURBER_FIELD_NONE not to write one */
+     ptrdiff_t vp_offset;
+     ptrdiff_t vs_offset;
+     ptrdiff_t rho_offset;
+} linthurber_query_desc_t;
+
+/** Called when a submitted batch has finished, with its status. */
+typedef void (*linthurber_callback_t)(void *arg, int status);
+/** Longitudes and latitudes that can fall in the model, tested before projecting. */
+typedef struct linthurber_cull_t {
+     /** Bounding box */
+     double lon_min;
+     double lon_max;
+     double lat_min;
+     double lat_max;
+     /** Edges of the quadrilateral, a * lon + b * lat + c >= 0 inside */
+     double a[4];
+     double b[4];
+     double c[4];
+} linthurber_cull_t;
+
 /** The LINTHURBER configuration structure. */
 typedef struct linthurber_configuration_t {
      /** The zone of UTM projection */
      int utm_zone;
      /** The model directory */
      char model_dir[128];
+     /** The directory the model files are read from */
+     char data_directory[128];
+     /** The config string linthurber_config returns for this model */
+     char config_string[LINTHURBER_CONFIG_MAX];
+     /** The full resolution configuration of a coarse view, NULL at full resolution */
+     const struct linthurber_configuration_t *lod_full;
 
      double spacing_vp;
      double spacing_vs;
@@ -89,11 +259,58 @@ typedef struct linthurber_configuration_t {
      int vs_dims[3];
      int dem_dims[3];
 
-     /** Bilinear or Trilinear Interpolation on or off (1 or 0) */
+     /** One of the LINTHURBER_INTERP settings */
      int interpolation;
 
+     /** Levels of the level-of-detail pyramid, including the grids; 1 for none */
+     int lod_levels;
+
+     /** LINTHURBER_LAYOUT_GRID or LINTHURBER_LAYOUT_PACKED */
+     int layout;
+
+     /** 1 if the grids match the constants of a specialized build */
+     int specialized;
+
+     /** One of the LINTHURBER_WARMUP settings */
+     int warmup;
+     /** 1 to lock the model buffers in memory */
+     int mlock;
+     /** 1 to ask for transparent huge pages for the model buffers */
+     int huge_pages;
+
+     /** Region outside of which no grid has data, from the corners and grids */
+     linthurber_cull_t cull;
+
 } linthurber_configuration_t;
 
+struct linthurber_hcell_t;
+
+/** Evaluates a grid at a column and fractional layer index z. */
+typedef double (*linthurber_kernel_t)(struct linthurber_hcell_t *cell, float *buf, double z);
+
+/** The query kernels compiled for one instruction set level. */
+typedef struct linthurber_isa_t {
+     const char *name;
+     int level;
+     linthurber_kernel_t value;
+     linthurber_kernel_t value_packed;
+     linthurber_kernel_t bilinear;
+     linthurber_kernel_t nearest;
+     linthurber_kernel_t cubic;
+     double (*rho)(double vp);
+     int (*geo2xy)(ucvm_bilinear_t *proj, double lon, double lat, double *x, double *y);
+     int (*cull)(const linthurber_cull_t *cull, const double *lon, const double *lat, int n,
+                 unsigned char *inside);
+} linthurber_isa_t;
+
+/** Level-of-detail pyramid of one grid, each level half as fine as the one before. */
+typedef struct linthurber_pyramid_t {
+     /** Level buffers; level 0 is the grid itself and not owned by the pyramid */
+     float *buf[LINTHURBER_MAX_LOD];
+     int dims[LINTHURBER_MAX_LOD][3];
+     int levels;
+} linthurber_pyramid_t;
+
 /** The model structure which points to available portions of the model. */
 typedef struct linthurber_model_t {
      /** A pointer to the Vp data either in memory or disk. Null if does not exist. */
@@ -102,12 +319,100 @@ typedef struct linthurber_model_t {
      float *vs;
      /** A pointer to the dem data either in memory or disk. Null if does not exist. */
      float *dem;
-     /** status: 0 = not found, 1 = found and not in memory, 2 = found and in memory */
+     /** status: 0 = not found, 1 = found and not in memory, 2 = found and in memory,
+         3 = in memory shared with other processes (not owned) */
      int vp_status;
      int vs_status;
      int dem_status;
+     /** Number of values in each buffer, padding included */
+     size_t vp_len;
+     size_t vs_len;
+     size_t dem_len;
+     /** Precomputed vs30, z1p0 and z2p5 rasters, the padded layers of one grid. Null if not built. */
+     float *site;
+     int site_status;
+     size_t site_len;
+     /** Site raster nodes along x and y (and the 3 rasters), and their spacing in meters */
+     int site_dims[3];
+     double site_spacing;
+     /** Downsampled vp, vs and dem, owned by the full resolution model */
+     linthurber_pyramid_t vp_lod;
+     linthurber_pyramid_t vs_lod;
+     linthurber_pyramid_t dem_lod;
+     /** Corner-packed vp and vs cells, 32-byte aligned. Null unless the layout is packed. */
+     float *vp_cells;
+     float *vs_cells;
+     /** Tricubic coefficients of every vp and vs cell, 64-byte aligned. Null unless cubic. */
+     float *vp_coef;
+     float *vs_coef;
+     /** One bit per vp, vs and dem cell, set where its eight corners are equal. Null in coarser views. */
+     unsigned char *vp_uniform;
+     unsigned char *vs_uniform;
+     unsigned char *dem_uniform;
+     /** Evaluates vp and vs in queries, chosen at load from the interpolation setting */
+     linthurber_kernel_t kernel;
+     /** The buffers the kernel reads: the node grids, packed cells or coefficients */
+     float *vp_eval;
+     float *vs_eval;
+     /** The kernels of the instruction set level chosen for the load */
+     const linthurber_isa_t *isa;
 } linthurber_model_t;
 
+/** One loaded configuration and model, published to queries as a unit. */
+typedef struct linthurber_state_t {
+     linthurber_configuration_t *config;
+     linthurber_model_t *model;
+     /** Unique per load, for caches derived from the model */
+     unsigned long serial;
+     /** Asynchronous batches and warmup still running on this state */
+     int refs;
+     /** 1 once the model memory has been warmed up, or the warmup given up */
+     int warm;
+     /** 1 once the state is replaced, stops a background warmup early */
+     int retired;
+     /** Coarser views of the model for linthurber_query_lod, finest first */
+     struct linthurber_state_t **lod;
+     int num_lod;
+     /** Smallest target resolution in meters this view is used for */
+     double lod_resolution;
+} linthurber_state_t;
+
+/** Horizontal corners and weights of one grid at a column. */
+typedef struct linthurber_hcell_t {
+     /** Offsets of the four corners within a layer, x fastest */
+     int offset[4];
+     /** Bilinear weights along x and y */
+     double fx;
+     double fy;
+     /** Values per layer and number of layers */
+     int plane;
+     int nz;
+     /** Index of the cell within a layer, and cells per layer, when corner-packed */
+     int cell;
+     int layer_cells;
+     /** 1 if the column lies within this grid */
+     int valid;
+     /** The grid's uniform cell bitmap, or NULL */
+     const unsigned char *uniform;
+} linthurber_hcell_t;
+
+/** Depth-independent state of a query position. */
+typedef struct linthurber_column_t {
+     /** Model x and y in meters */
+     double x;
+     double y;
+     /** DEM elevation in meters */
+     double elev;
+     linthurber_hcell_t vp;
+     linthurber_hcell_t vs;
+     /** 1 if the position was projected and has a DEM value */
+     int valid;
+     /** 1 if the position was projected */
+     int projected;
+     /** 1 once the DEM has been looked up */
+     int dem;
+} linthurber_column_t;
+
 // UCVM API Required Functions
 #ifdef DYNAMIC_LIBRARY
 /** Initializes the model */
@@ -120,6 +425,86 @@ int model_version(char *ver, int len);
 int model_query(linthurber_point_t *points, linthurber_properties_t *data, int numpts);
 #endif
 
+// LINTHURBER API Functions
+/** Initializes the model */
+int linthurber_init(const char *dir, const char *label);
+/** Cleans up the model (frees memory, etc.) */
+int linthurber_finalize();
+/** Loads a new model and switches queries over to it without stopping them */
+int linthurber_reload(const char *dir, const char *label);
+/** Returns version information */
+int linthurber_version(char *ver, int len);
+/** Returns the model config information */
+int linthurber_config(char **config, int *sz);
+/** Queries the model */
+int linthurber_query(linthurber_point_t *points, linthurber_properties_t *data, int numpts);
+/** Queries the model with depths taken as given by a depth mode */
+int linthurber_query_mode(linthurber_point_t *points, linthurber_properties_t *data, int numpts,
+                          int mode);
+/** Queries points in caller-owned arrays, in place */
+int linthurber_query_strided(const linthurber_query_desc_t *desc, int numpoints, int mode);
+/** Sets the depth mode of linthurber_query and the APIs built on it */
+int linthurber_set_depth_mode(int mode);
+/** Waits until the memory of the current model has been warmed up */
+int linthurber_wait_warm();
+/** Forces the instruction set level of the query kernels from the next load */
+int linthurber_set_isa(int level);
+/** Returns the instruction set level of the query kernels in use */
+int linthurber_get_isa(const char **name);
+/** Queries the model on grids downsampled to a target resolution */
+int linthurber_query_lod(linthurber_point_t *points, linthurber_properties_t *data, int numpts,
+                         double resolution);
+/** Queries the model and the gradient of each property, always trilinear */
+int linthurber_query_gradient(linthurber_point_t *points, linthurber_properties_t *data,
+                              linthurber_gradient_t *grad, int numpts, int coords);
+/** Queries one position at many depths */
+int linthurber_query_column(linthurber_point_t *point, double *depths,
+                            linthurber_properties_t *data, int numdepths);
+/** Computes Vs30, Z1.0 and Z2.5 at many sites in parallel */
+int linthurber_query_site(linthurber_point_t *points, linthurber_site_t *sites, int numpoints);
+/** Looks up Vs30, Z1.0 and Z2.5 in the precomputed site map */
+int linthurber_query_sitemap(linthurber_point_t *points, linthurber_site_t *sites, int numpoints);
+/** Builds the site map of the loaded model and writes it to a file */
+int linthurber_build_sitemap(const char *filename);
+/** Extracts a depth slice into an image buffer */
+int linthurber_slice(double lon0, double lat0, double lon1, double lat1, double depth,
+                     int nx, int ny, int prop, float *buf);
+/** Extracts a vertical cross-section along a great circle into an image buffer */
+int linthurber_cross_section(double lon0, double lat0, double lon1, double lat1,
+                             double depth0, double depth1, int nh, int nz, int prop, float *buf);
+/** Computes the travel time along each segment of a ray path */
+int linthurber_traveltime(linthurber_point_t *points, int numpoints, int prop, double *times);
+/** Computes segment travel times for a batch of rays in parallel */
+int linthurber_traveltime_batch(linthurber_ray_t *rays, int numrays, int prop);
+/** Starts querying a batch in the background */
+linthurber_ticket_t *linthurber_submit(linthurber_point_t *points, linthurber_properties_t *data,
+                                       int numpoints, linthurber_callback_t callback,
+                                       void *callback_arg);
+/** Tells whether a submitted batch has finished */
+int linthurber_poll(linthurber_ticket_t *ticket);
+/** Waits for a submitted batch and releases its ticket */
+int linthurber_wait(linthurber_ticket_t *ticket);
+/** Sets the number of threads used by the parallel APIs, 0 for all cpus, default 1 */
+int linthurber_set_num_threads(int n);
+/** Sets the number of query positions cached per thread, 0 to disable */
+int linthurber_set_column_cache(int capacity);
+/** Returns the column cache hit and miss counters */
+int linthurber_get_column_cache_stats(long *hits, long *misses);
+/** Clears the column cache hit and miss counters */
+int linthurber_reset_column_cache_stats();
+/** Returns the trilinear evaluations and how many fell in uniform cells */
+int linthurber_get_uniform_stats(long *evals, long *hits);
+/** Clears the uniform cell counters */
+int linthurber_reset_uniform_stats();
+/** Returns the points tested against the model region and how many were outside */
+int linthurber_get_cull_stats(long *tested, long *rejected);
+/** Clears the region test counters */
+int linthurber_reset_cull_stats();
+/** Returns the counters of the work-stealing scheduler */
+int linthurber_get_sched_stats(linthurber_sched_stats_t *stats);
+/** Clears the counters of the work-stealing scheduler */
+int linthurber_reset_sched_stats();
+
 // Non-UCVM Helper Functions
 /** Reads the configuration file. */
 int linthurber_read_configuration(char *file, linthurber_configuration_t *config);
@@ -128,8 +513,81 @@ void linthurber_print_error(char *err);
 /** Attempts to malloc the model size in memory and read it in. */
 int linthurber_try_reading_model(linthurber_model_t *model);
 
+int _linthurber_query_points(const linthurber_query_desc_t *desc, int begin, int end, int mode);
+void _linthurber_desc_init(linthurber_query_desc_t *desc, linthurber_point_t *points,
+                           linthurber_properties_t *data);
+int _linthurber_load(const char *dir, const char *label);
+int _linthurber_query_gradient(linthurber_point_t *points, linthurber_properties_t *data,
+                               linthurber_gradient_t *grad, int numpoints, int coords);
+int _linthurber_traveltime(linthurber_point_t *points, int numpoints, int prop, double *times);
+int _linthurber_build_sitemap(const char *filename);
+int _linthurber_query_sitemap(linthurber_point_t *points, linthurber_site_t *sites, int numpoints);
+int _linthurber_cross_section(double lon0, double lat0, double lon1, double lat1,
+                              double depth0, double depth1, int nh, int nz, int prop, float *buf);
+int _linthurber_state_enter(linthurber_state_t *state);
+void _linthurber_state_exit();
+linthurber_state_t *_linthurber_state_view();
+linthurber_state_t *_linthurber_state_new(linthurber_configuration_t *config, linthurber_model_t *model);
+void _linthurber_state_free(linthurber_state_t *state);
+void _linthurber_state_publish(linthurber_state_t *state);
+linthurber_state_t *_linthurber_state_use(linthurber_state_t *state);
+int _linthurber_lod_build(linthurber_state_t *state);
+float *_linthurber_grid_alloc(linthurber_configuration_t *config, size_t len);
+void _linthurber_warmup_start(linthurber_state_t *state);
+void _linthurber_warmup_release(linthurber_state_t *state);
+void _linthurber_lod_free(linthurber_state_t *state);
+int _linthurber_init_state(const char *dir, const char *label, char *configbuf);
+int _linthurber_init_done(const char *configbuf);
+int _linthurber_data_directory(linthurber_configuration_t *config, const char *dir, const char *label);
+int _linthurber_load_abort(linthurber_state_t *state);
+void _linthurber_model_lengths(linthurber_configuration_t *config, linthurber_model_t *model);
+size_t _linthurber_grid_len(int *dims);
+void _linthurber_pad_grid(float *buf, int *dims);
+int _linthurber_getcell(double i, double j, double k, int prop, double q[2][2][2], double f[3]);
 int _linthurber_getval(double i, double j, double k, int prop, double *val);
+int _linthurber_getval_grad(double i, double j, double k, int prop, double *val, double grad[3]);
+double _linthurber_depth_index(linthurber_configuration_t *config, double depth_msl, double *dzdd);
+void _linthurber_specialize(linthurber_configuration_t *config);
+void _linthurber_geo_jacobian(linthurber_configuration_t *config, double x, double y, double dxy[4]);
+int _linthurber_column_init(double lon, double lat, linthurber_column_t *col);
+int _linthurber_column_init_xy(double x, double y, linthurber_column_t *col);
+int _linthurber_column_project(double lon, double lat, linthurber_column_t *col);
+void _linthurber_column_xy(double x, double y, linthurber_column_t *col);
+int _linthurber_column_dem(linthurber_column_t *col);
+void _linthurber_column_site(linthurber_column_t *col, linthurber_site_t *site);
+double _linthurber_profile_reach(double *d, double *v, int n, double target);
+double _linthurber_profile_time(double *d, double *v, int n, double bottom);
+int _linthurber_read_sitemap(linthurber_model_t *model);
+linthurber_column_t *_linthurber_column_lookup(double lon, double lat, linthurber_column_t *scratch,
+                                               int dem);
+void _linthurber_column_cache_flush();
+void _linthurber_column_eval(linthurber_column_t *col, double depth, linthurber_properties_t *data);
+void _linthurber_column_eval_msl(linthurber_column_t *col, double depth_msl,
+                                 linthurber_properties_t *data);
+void _linthurber_hcell_init(linthurber_hcell_t *cell, double i, double j, const int *dims);
+double _linthurber_hcell_layer(linthurber_hcell_t *cell, float *buf, int c);
+double _linthurber_hcell_value(linthurber_hcell_t *cell, float *buf, double z);
+double _linthurber_hcell_value_packed(linthurber_hcell_t *cell, float *cells, double z);
+double _linthurber_hcell_bilinear(linthurber_hcell_t *cell, float *buf, double z);
+double _linthurber_hcell_nearest(linthurber_hcell_t *cell, float *buf, double z);
+double _linthurber_hcell_cubic(linthurber_hcell_t *cell, float *table, double z);
+int _linthurber_cubic_model(linthurber_configuration_t *config, linthurber_model_t *model);
+int _linthurber_uniform_model(linthurber_configuration_t *config, linthurber_model_t *model);
+int _linthurber_uniform_value(double i, double j, double k, int prop, double *val);
+void _linthurber_uniform_flush();
+void _linthurber_kernel_select(linthurber_configuration_t *config, linthurber_model_t *model);
+int _linthurber_pack_model(linthurber_configuration_t *config, linthurber_model_t *model);
 double _get_rho(double f);
+double _get_rho_deriv(double f);
+int _linthurber_geo2xy(ucvm_bilinear_t *par, double lon, double lat, double *rx, double *ry);
+int _linthurber_cull(const linthurber_cull_t *cull, const double *lon, const double *lat, int n,
+                     unsigned char *inside);
+void _linthurber_cull_init(linthurber_configuration_t *config);
+void _linthurber_cull_flush();
+int _linthurber_isa_detect();
+void _linthurber_isa_select(linthurber_model_t *model);
 int _split4float(char *str, double *val, int cnt);
 int _dump_linthurber_configuration(linthurber_configuration_t *config);
 void _splitline(char* lptr, char key[], char value[]);
+
+#endif
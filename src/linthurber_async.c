@@ -0,0 +1,152 @@
+/*
+ * @file linthurber_async.c
+ * @brief Asynchronous batch queries of the LINTHURBER model.
+ * @author - SCEC
+ * @version 1.0.1
+ *
+ * A submitted batch is queued on the internal work-stealing pool as one
+ * range of points. Workers split it into ranges of LINTHURBER_ASYNC_GRAIN
+ * points, so large batches spread over all workers while several batches
+ * can be in flight at once. The caller keeps going and collects the batch
+ * later with linthurber_poll or linthurber_wait, or is told by a callback.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "linthurber.h"
+#include "linthurber_parallel.h"
+
+extern int linthurber_depth_mode;
+
+/** Smallest range of points a batch is split into */
+#define LINTHURBER_ASYNC_GRAIN 256
+
+/** A submitted batch. */
+struct linthurber_ticket_t {
+     /** Completion of the batch on the pool, first so done() can cast back */
+     linthurber_group_t group;
+     /** The points and properties of the batch */
+     linthurber_query_desc_t desc;
+     linthurber_callback_t callback;
+     void *callback_arg;
+     /** The model the batch runs on, kept until it finishes */
+     linthurber_state_t *state;
+     /** The depth mode at submission */
+     int mode;
+     int status;
+     /** Set once every point is done and the callback has returned */
+     int finished;
+     pthread_mutex_t lock;
+     pthread_cond_t cond;
+};
+
+void _linthurber_ticket_range(void *arg, int begin, int end) {
+    linthurber_ticket_t *ticket = arg;
+
+    _linthurber_query_points(&ticket->desc, begin, end, ticket->mode);
+}
+
+void _linthurber_ticket_done(linthurber_group_t *group) {
+    linthurber_ticket_t *ticket = (linthurber_ticket_t *)group;
+
+    if (ticket->callback) ticket->callback(ticket->callback_arg, ticket->status);
+    __atomic_fetch_sub(&ticket->state->refs, 1, __ATOMIC_RELEASE);
+
+    /* The ticket may be freed by linthurber_wait as soon as this unlocks */
+    pthread_mutex_lock(&ticket->lock);
+    ticket->finished = 1;
+    pthread_cond_broadcast(&ticket->cond);
+    pthread_mutex_unlock(&ticket->lock);
+}
+
+/**
+ * Starts querying a batch of points in the background and returns at once.
+ * The points and data must stay valid until the batch has finished. Every
+ * ticket must be released with linthurber_wait.
+ *
+ * @param points The points at which the queries will be made.
+ * @param data The data that will be returned (Vp, Vs, rho).
+ * @param numpoints The total number of points to query.
+ * @param callback If not NULL, called on a pool thread with callback_arg
+ * and the batch status once all points are done. It must not wait on
+ * tickets.
+ * @param callback_arg The argument passed to the callback.
+ * @return The ticket of the batch, or NULL if it could not be submitted.
+ */
+linthurber_ticket_t *linthurber_submit(linthurber_point_t *points, linthurber_properties_t *data,
+                                       int numpoints, linthurber_callback_t callback,
+                                       void *callback_arg) {
+    linthurber_ticket_t *ticket;
+    int err;
+
+    ticket = malloc(sizeof(linthurber_ticket_t));
+    if (ticket == NULL) return NULL;
+
+    /* Pin the current model for the lifetime of the batch */
+    if (_linthurber_state_enter(NULL) != SUCCESS) {
+        free(ticket);
+        return NULL;
+    }
+    ticket->state = _linthurber_state_view();
+    __atomic_fetch_add(&ticket->state->refs, 1, __ATOMIC_ACQUIRE);
+
+    ticket->group.done = _linthurber_ticket_done;
+    _linthurber_desc_init(&ticket->desc, points, data);
+    ticket->callback = callback;
+    ticket->callback_arg = callback_arg;
+    ticket->mode = __atomic_load_n(&linthurber_depth_mode, __ATOMIC_RELAXED);
+    ticket->status = SUCCESS;
+    ticket->finished = 0;
+    pthread_mutex_init(&ticket->lock, NULL);
+    pthread_cond_init(&ticket->cond, NULL);
+
+    err = _linthurber_pool_submit(&ticket->group, numpoints, LINTHURBER_ASYNC_GRAIN,
+                                  _linthurber_ticket_range, ticket);
+    _linthurber_state_exit();
+    if (err != SUCCESS) {
+        __atomic_fetch_sub(&ticket->state->refs, 1, __ATOMIC_RELEASE);
+        pthread_mutex_destroy(&ticket->lock);
+        pthread_cond_destroy(&ticket->cond);
+        free(ticket);
+        return NULL;
+    }
+    return ticket;
+}
+
+/**
+ * Tells whether a batch has finished, without blocking.
+ *
+ * @param ticket The ticket of the batch.
+ * @return 1 if finished, 0 if still running.
+ */
+int linthurber_poll(linthurber_ticket_t *ticket) {
+    int finished;
+
+    pthread_mutex_lock(&ticket->lock);
+    finished = ticket->finished;
+    pthread_mutex_unlock(&ticket->lock);
+    return finished;
+}
+
+/**
+ * Waits for a batch to finish and releases its ticket.
+ *
+ * @param ticket The ticket of the batch, invalid afterwards.
+ * @return The status of the batch, SUCCESS or FAIL.
+ */
+int linthurber_wait(linthurber_ticket_t *ticket) {
+    int status;
+
+    pthread_mutex_lock(&ticket->lock);
+    while (!ticket->finished) pthread_cond_wait(&ticket->cond, &ticket->lock);
+    status = ticket->status;
+    pthread_mutex_unlock(&ticket->lock);
+
+    pthread_mutex_destroy(&ticket->lock);
+    pthread_cond_destroy(&ticket->cond);
+    free(ticket);
+    return status;
+}
@@ -0,0 +1,75 @@
+/**
+ * @file linthurber_build_sitemap.c
+ * @brief Builds the precomputed site map of the LINTHURBER model.
+ * @author - SCEC
+ * @version 1.0.1
+ *
+ * Computes Vs30, Z1.0 and Z2.5 on the vp grid nodes and stores them as
+ * lin-thurber.site in the model data directory, where linthurber_init
+ * picks them up for linthurber_query_sitemap.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "linthurber.h"
+
+void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s -d ucvm_dir [-l label] [-t threads] [-o output]\n", prog);
+}
+
+/**
+ * Builds the site map.
+ *
+ * @param argc The number of arguments.
+ * @param argv The argument strings.
+ * @return Zero on success.
+ */
+int main(int argc, char **argv) {
+    char *dir = NULL, *label = "linthurber", *output = NULL;
+    int opt;
+
+    /* A standalone tool, all cpus unless -t says otherwise */
+    linthurber_set_num_threads(0);
+    while ((opt = getopt(argc, argv, "d:l:t:o:")) != -1) {
+        switch (opt) {
+        case 'd':
+            dir = optarg;
+            break;
+        case 'l':
+            label = optarg;
+            break;
+        case 't':
+            if (linthurber_set_num_threads(atoi(optarg)) != SUCCESS) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (dir == NULL) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (linthurber_init(dir, label) != SUCCESS) {
+        fprintf(stderr, "Failed to initialize the model\n");
+        return 1;
+    }
+    if (linthurber_build_sitemap(output) != SUCCESS) {
+        linthurber_finalize();
+        return 1;
+    }
+    linthurber_finalize();
+
+    printf("Site map written\n");
+    return 0;
+}
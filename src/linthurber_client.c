@@ -0,0 +1,184 @@
+/*
+ * @file linthurber_client.c
+ * @brief Client of the linthurberd query daemon.
+ * @author - SCEC
+ * @version 1.0.1
+ *
+ * A query is split into chunks of at most LINTHURBER_CLIENT_CHUNK points,
+ * and up to LINTHURBER_CLIENT_WINDOW chunks are kept in flight on the
+ * socket so the daemon's workers can evaluate them concurrently. Responses
+ * are matched to their chunk by id. One connection per process; the client
+ * is not meant to be called from several threads at once.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "linthurber_client.h"
+
+/** Points per request */
+#define LINTHURBER_CLIENT_CHUNK 4096
+/** Requests in flight at a time */
+#define LINTHURBER_CLIENT_WINDOW 8
+
+/** Connection to the daemon, -1 if not connected */
+int linthurber_client_fd = -1;
+
+/**
+ * Reads exactly len bytes.
+ *
+ * @return SUCCESS, or FAIL on error or end of file.
+ */
+int _linthurber_read_full(int fd, void *buf, size_t len) {
+    char *p = buf;
+    ssize_t n;
+
+    while (len > 0) {
+        n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return FAIL;
+        p += n;
+        len -= n;
+    }
+    return SUCCESS;
+}
+
+/**
+ * Writes exactly len bytes.
+ *
+ * @return SUCCESS or FAIL.
+ */
+int _linthurber_write_full(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    ssize_t n;
+
+    while (len > 0) {
+        n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return FAIL;
+        p += n;
+        len -= n;
+    }
+    return SUCCESS;
+}
+
+/**
+ * Connects to a running linthurberd.
+ *
+ * @param path The daemon's socket, NULL for LINTHURBER_SOCKET_PATH.
+ * @return SUCCESS or FAIL.
+ */
+int linthurber_client_init(const char *path) {
+    struct sockaddr_un addr;
+
+    if (path == NULL) path = LINTHURBER_SOCKET_PATH;
+    if (strlen(path) >= sizeof(addr.sun_path)) return FAIL;
+    if (linthurber_client_fd >= 0) linthurber_client_finalize();
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    linthurber_client_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (linthurber_client_fd < 0) return FAIL;
+    if (connect(linthurber_client_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "Failed to connect to linthurberd at %s\n", path);
+        close(linthurber_client_fd);
+        linthurber_client_fd = -1;
+        return FAIL;
+    }
+    return SUCCESS;
+}
+
+/**
+ * Closes the connection to linthurberd.
+ *
+ * @return SUCCESS
+ */
+int linthurber_client_finalize() {
+    if (linthurber_client_fd >= 0) close(linthurber_client_fd);
+    linthurber_client_fd = -1;
+    return SUCCESS;
+}
+
+/**
+ * Sends the request for chunk c of a query.
+ */
+int _linthurber_client_send(linthurber_point_t *points, int numpoints, int c) {
+    linthurber_wire_header_t header;
+    int first = c * LINTHURBER_CLIENT_CHUNK;
+
+    header.magic = LINTHURBER_WIRE_MAGIC;
+    header.id = c;
+    header.numpoints = (numpoints - first < LINTHURBER_CLIENT_CHUNK) ?
+                       numpoints - first : LINTHURBER_CLIENT_CHUNK;
+    header.status = 0;
+    if (_linthurber_write_full(linthurber_client_fd, &header, sizeof(header)) != SUCCESS) return FAIL;
+    return _linthurber_write_full(linthurber_client_fd, points + first,
+                                  header.numpoints * sizeof(linthurber_point_t));
+}
+
+/**
+ * Queries the model through linthurberd. Same arguments and results as
+ * linthurber_query.
+ *
+ * @param points The points at which the queries will be made.
+ * @param data The data that will be returned (Vp, Vs, rho).
+ * @param numpoints The total number of points to query.
+ * @return SUCCESS, or FAIL if not connected or the daemon failed.
+ */
+int linthurber_client_query(linthurber_point_t *points, linthurber_properties_t *data, int numpoints) {
+    linthurber_wire_header_t header;
+    double *vals;
+    int nchunks, sent, done, p, first, err = SUCCESS;
+
+    if (linthurber_client_fd < 0) return FAIL;
+    if (numpoints <= 0) return SUCCESS;
+
+    vals = malloc(LINTHURBER_CLIENT_CHUNK * LINTHURBER_WIRE_NPROP * sizeof(double));
+    if (vals == NULL) return FAIL;
+
+    nchunks = (numpoints + LINTHURBER_CLIENT_CHUNK - 1) / LINTHURBER_CLIENT_CHUNK;
+    for (sent = 0; sent < nchunks && sent < LINTHURBER_CLIENT_WINDOW; sent++) {
+        if (_linthurber_client_send(points, numpoints, sent) != SUCCESS) goto broken;
+    }
+
+    for (done = 0; done < nchunks; done++) {
+        if (_linthurber_read_full(linthurber_client_fd, &header, sizeof(header)) != SUCCESS) goto broken;
+        first = header.id * LINTHURBER_CLIENT_CHUNK;
+        if ((header.magic != LINTHURBER_WIRE_MAGIC) || (header.id >= (uint32_t)nchunks) ||
+            (header.numpoints > LINTHURBER_CLIENT_CHUNK) ||
+            (first + header.numpoints > (uint32_t)numpoints)) goto broken;
+        if (_linthurber_read_full(linthurber_client_fd, vals,
+                                  header.numpoints * LINTHURBER_WIRE_NPROP * sizeof(double)) != SUCCESS) {
+            goto broken;
+        }
+        if (header.status != SUCCESS) err = FAIL;
+        for (p = 0; p < (int)header.numpoints; p++) {
+            data[first + p].vp = vals[p * LINTHURBER_WIRE_NPROP];
+            data[first + p].vs = vals[p * LINTHURBER_WIRE_NPROP + 1];
+            data[first + p].rho = vals[p * LINTHURBER_WIRE_NPROP + 2];
+        }
+
+        /* Keep the window full */
+        if (sent < nchunks) {
+            if (_linthurber_client_send(points, numpoints, sent) != SUCCESS) goto broken;
+            sent++;
+        }
+    }
+    free(vals);
+    return err;
+
+broken:
+    /* The stream is out of step, drop the connection */
+    fprintf(stderr, "Lost connection to linthurberd\n");
+    free(vals);
+    linthurber_client_finalize();
+    return FAIL;
+}
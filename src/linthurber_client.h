@@ -0,0 +1,55 @@
+/**
+ * @file linthurber_client.h
+ * @brief Client of the linthurberd query daemon.
+ * @author - SCEC
+ * @version 1.0.1
+ *
+ * Provided by liblinthurber_client. Jobs that only need a few points can
+ * connect to a running linthurberd instead of loading the model with
+ * linthurber_init.
+ *
+ */
+
+#ifndef LINTHURBER_CLIENT_H
+#define LINTHURBER_CLIENT_H
+
+#include <stdint.h>
+
+#include "linthurber.h"
+
+/** Socket used when none is given */
+#define LINTHURBER_SOCKET_PATH "/tmp/linthurberd.sock"
+
+/* Wire protocol */
+/** Marks every request and response header */
+#define LINTHURBER_WIRE_MAGIC 0x4c544851
+/** Largest number of points in one request */
+#define LINTHURBER_WIRE_MAX_POINTS 65536
+/** Values returned per point: vp, vs and rho */
+#define LINTHURBER_WIRE_NPROP 3
+
+/**
+ * Header of a request or response. A request is followed by numpoints
+ * linthurber_point_t, a response by numpoints vp/vs/rho triplets of
+ * doubles, both in native byte order. Responses carry the id of their
+ * request and may come back in any order.
+ */
+typedef struct linthurber_wire_header_t {
+     uint32_t magic;
+     uint32_t id;
+     uint32_t numpoints;
+     /** SUCCESS or FAIL in responses, 0 in requests */
+     uint32_t status;
+} linthurber_wire_header_t;
+
+/** Connects to linthurberd, NULL for LINTHURBER_SOCKET_PATH */
+int linthurber_client_init(const char *path);
+/** Closes the connection */
+int linthurber_client_finalize();
+/** Queries the model through linthurberd, as linthurber_query */
+int linthurber_client_query(linthurber_point_t *points, linthurber_properties_t *data, int numpoints);
+
+int _linthurber_read_full(int fd, void *buf, size_t len);
+int _linthurber_write_full(int fd, const void *buf, size_t len);
+
+#endif
@@ -0,0 +1,634 @@
+/*
+ * @file linthurber_column.c
+ * @brief Vertical profile queries of the LINTHURBER model.
+ * @author - SCEC
+ * @version 1.0.1
+ *
+ * A column holds everything about a lon/lat position that does not depend
+ * on depth: the projected x/y, the DEM elevation and, for the vp and vs
+ * grids, the four horizontal corners and their bilinear weights. Once a
+ * column is set up, a value at any depth is a blend of two layer values,
+ * and the whole vertical profile is piecewise linear between the
+ * depths_msl layers, which lets site parameters be computed exactly.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "ucvm_utils.h"
+
+#include "linthurber.h"
+#include "linthurber_parallel.h"
+
+/** Sites handed to a thread at a time by the batch API */
+#define LINTHURBER_SITE_GRAIN 64
+
+/** Default number of columns cached per thread */
+#define LINTHURBER_COLUMN_CACHE_DEFAULT 2048
+
+extern __thread linthurber_configuration_t *linthurber_configuration;
+extern __thread linthurber_model_t *linthurber_velocity_model;
+
+/** A cached column and the position it was set up for. */
+typedef struct linthurber_column_entry_t {
+     double lon;
+     double lat;
+     /** Serial of the model state the column was set up on, 0 if unused */
+     unsigned long serial;
+     linthurber_column_t col;
+} linthurber_column_entry_t;
+
+/** Two-way set-associative cache of columns owned by one thread. */
+typedef struct linthurber_column_cache_t {
+     linthurber_column_entry_t *entries;
+     /** Number of entries, a power of two, or 0 when disabled */
+     int capacity;
+     /** Capacity generation the entries were allocated for */
+     int generation;
+     /** Hits and misses not yet added to the global counters */
+     long hits;
+     long misses;
+} linthurber_column_cache_t;
+
+/** Requested entries per thread, 0 to disable caching. */
+int linthurber_column_cache_capacity = LINTHURBER_COLUMN_CACHE_DEFAULT;
+/** Bumped whenever the requested capacity changes. */
+int linthurber_column_cache_generation = 1;
+/** Hits and misses over all threads */
+long linthurber_column_cache_hits = 0;
+long linthurber_column_cache_misses = 0;
+
+__thread linthurber_column_cache_t *linthurber_column_cache = NULL;
+pthread_key_t linthurber_column_cache_key;
+pthread_once_t linthurber_column_cache_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Sets up the horizontal corners and weights of a grid at a fractional
+ * index, with the same bounds test as _linthurber_getcell. Corners past the
+ * last node fall on the grid padding.
+ */
+void _linthurber_hcell_init(linthurber_hcell_t *cell, double i, double j, const int *dims) {
+    int i0 = (int)i, j0 = (int)j;
+    int a = round(i), b = round(j);
+    int row = dims[0] + 1;
+
+    cell->valid = !((a < 0) || (b < 0) || (a >= dims[0]) || (b >= dims[1]));
+    cell->uniform = NULL;
+    if (!cell->valid) return;
+
+    cell->offset[0] = j0 * row + i0;
+    cell->offset[1] = cell->offset[0] + 1;
+    cell->offset[2] = cell->offset[0] + row;
+    cell->offset[3] = cell->offset[2] + 1;
+    cell->fx = i - i0;
+    cell->fy = j - j0;
+    cell->plane = row * (dims[1] + 1);
+    cell->nz = dims[2];
+    cell->cell = j0 * dims[0] + i0;
+    cell->layer_cells = dims[0] * dims[1];
+}
+
+/**
+ * Chooses the kernel queries evaluate vp and vs with, from the
+ * interpolation setting and the storage layout, once per load so that
+ * queries do not test the settings at every point. The kernels are those
+ * of the instruction set level chosen for the load.
+ *
+ * @param config The model configuration.
+ * @param model The model, with its grids and packed cells in place.
+ */
+void _linthurber_kernel_select(linthurber_configuration_t *config, linthurber_model_t *model) {
+    model->vp_eval = model->vp;
+    model->vs_eval = model->vs;
+
+    switch (config->interpolation) {
+    case LINTHURBER_INTERP_NEAREST:
+        model->kernel = model->isa->nearest;
+        break;
+    case LINTHURBER_INTERP_BILINEAR:
+        model->kernel = model->isa->bilinear;
+        break;
+    case LINTHURBER_INTERP_CUBIC:
+        if (model->vp_coef) {
+            model->kernel = model->isa->cubic;
+            model->vp_eval = model->vp_coef;
+            model->vs_eval = model->vs_coef;
+            break;
+        }
+        /* Coarser views have no coefficients, and are trilinear */
+        /* fall through */
+    default:
+        model->kernel = model->isa->value;
+        if (model->vp_cells) {
+            model->kernel = model->isa->value_packed;
+            model->vp_eval = model->vp_cells;
+            model->vs_eval = model->vs_cells;
+        }
+        break;
+    }
+}
+
+/**
+ * Sets up the column at a longitude and latitude: projects the position
+ * once, looks up the DEM and prepares the vp and vs horizontal cells.
+ *
+ * @param lon The longitude.
+ * @param lat The latitude.
+ * @param col The column to fill in.
+ * @return SUCCESS, or FAIL if the position is outside of the model.
+ */
+int _linthurber_column_init(double lon, double lat, linthurber_column_t *col) {
+    if (_linthurber_column_project(lon, lat, col) != SUCCESS) return FAIL;
+    return _linthurber_column_dem(col);
+}
+
+/**
+ * Sets up the column at a longitude and latitude without looking up the
+ * DEM, for depths already referenced to sea level.
+ *
+ * @param lon The longitude.
+ * @param lat The latitude.
+ * @param col The column to fill in.
+ * @return SUCCESS, or FAIL if the position cannot be projected.
+ */
+int _linthurber_column_project(double lon, double lat, linthurber_column_t *col) {
+    linthurber_configuration_t *config = linthurber_configuration;
+    const linthurber_isa_t *isa = linthurber_velocity_model->isa;
+    ucvm_point_t geo, xy;
+    unsigned char inside;
+
+    col->valid = 0;
+    col->projected = 0;
+    col->dem = 0;
+    col->vp.valid = 0;
+    col->vs.valid = 0;
+
+    /* Outside of the model region, no grid would accept it */
+    if (isa->cull(&config->cull, &lon, &lat, 1, &inside) != 0) return FAIL;
+
+    geo.coord[0] = lon;
+    geo.coord[1] = lat;
+    if (isa->geo2xy(&(config->proj), geo.coord[0], geo.coord[1],
+                    &xy.coord[0], &xy.coord[1]) != 0) return FAIL;
+    _linthurber_column_xy(xy.coord[0], xy.coord[1], col);
+    return SUCCESS;
+}
+
+/**
+ * Tells whether a grid has a node nearest to fractional indices, the test
+ * _linthurber_hcell_init and _linthurber_getcell accept positions with.
+ */
+static inline int _linthurber_grid_inside(double i, double j, const int *dims) {
+    int a = round(i), b = round(j);
+
+    return !((a < 0) || (b < 0) || (a >= dims[0]) || (b >= dims[1]));
+}
+
+/**
+ * Sets up the horizontal cells of the column at a position in model
+ * coordinates, leaving the DEM to _linthurber_column_dem.
+ */
+void _linthurber_column_xy(double x, double y, linthurber_column_t *col) {
+    linthurber_configuration_t *config = linthurber_configuration;
+    linthurber_model_t *model = linthurber_velocity_model;
+    const linthurber_configuration_t *full;
+
+    col->x = x;
+    col->y = y;
+    col->elev = 0.0;
+    col->valid = 0;
+    col->dem = 0;
+#ifdef LINTHURBER_SPECIALIZED
+    /* Constant spacings and dimensions, for the release built for. Dividing
+       rather than multiplying by reciprocals keeps results bit-identical. */
+    if (config->specialized) {
+        _linthurber_hcell_init(&col->vp, x / LINTHURBER_FIXED_SPACING_VP,
+                               y / LINTHURBER_FIXED_SPACING_VP, linthurber_fixed_vp_dims);
+        _linthurber_hcell_init(&col->vs, x / LINTHURBER_FIXED_SPACING_VS,
+                               y / LINTHURBER_FIXED_SPACING_VS, linthurber_fixed_vs_dims);
+        col->vp.uniform = model->vp_uniform;
+        col->vs.uniform = model->vs_uniform;
+        col->projected = 1;
+        return;
+    }
+#endif
+    _linthurber_hcell_init(&col->vp, col->x / config->spacing_vp, col->y / config->spacing_vp,
+                           config->vp_dims);
+    _linthurber_hcell_init(&col->vs, col->x / config->spacing_vs, col->y / config->spacing_vs,
+                           config->vs_dims);
+    col->vp.uniform = model->vp_uniform;
+    col->vs.uniform = model->vs_uniform;
+    col->projected = 1;
+
+    /* Coarse grids reach past the last fine node; answer only where full resolution does */
+    full = config->lod_full;
+    if (full != NULL) {
+        if (!_linthurber_grid_inside(x / full->spacing_vp, y / full->spacing_vp, full->vp_dims))
+            col->vp.valid = 0;
+        if (!_linthurber_grid_inside(x / full->spacing_vs, y / full->spacing_vs, full->vs_dims))
+            col->vs.valid = 0;
+    }
+}
+
+/**
+ * Looks up the DEM elevation of a projected column.
+ *
+ * @param col The column.
+ * @return SUCCESS, or FAIL if the position has no DEM value.
+ */
+int _linthurber_column_dem(linthurber_column_t *col) {
+    linthurber_configuration_t *config = linthurber_configuration;
+
+    col->dem = 1;
+#ifdef LINTHURBER_SPECIALIZED
+    if (config->specialized) {
+        if (_linthurber_getval(col->x / LINTHURBER_FIXED_SPACING_DEM,
+                               col->y / LINTHURBER_FIXED_SPACING_DEM,
+                               0.0, LINTHURBER_DEM, &col->elev) != SUCCESS) return FAIL;
+        col->valid = 1;
+        return SUCCESS;
+    }
+#endif
+    if ((config->lod_full != NULL) &&
+        !_linthurber_grid_inside(col->x / config->lod_full->spacing_dem,
+                                 col->y / config->lod_full->spacing_dem, config->lod_full->dem_dims)) {
+        col->elev = -1.0;
+        return FAIL;
+    }
+    if (_linthurber_getval(col->x / config->spacing_dem, col->y / config->spacing_dem,
+                           0.0, LINTHURBER_DEM, &col->elev) != SUCCESS) return FAIL;
+    col->valid = 1;
+    return SUCCESS;
+}
+
+/**
+ * Sets up the column at a position already in model coordinates.
+ *
+ * @param x The model x coordinate in meters.
+ * @param y The model y coordinate in meters.
+ * @param col The column to fill in.
+ * @return SUCCESS, or FAIL if the position has no DEM value.
+ */
+int _linthurber_column_init_xy(double x, double y, linthurber_column_t *col) {
+    _linthurber_column_xy(x, y, col);
+    return _linthurber_column_dem(col);
+}
+
+void _linthurber_column_cache_free(void *ptr) {
+    linthurber_column_cache_t *cache = ptr;
+
+    free(cache->entries);
+    free(cache);
+}
+
+void _linthurber_column_cache_key_init() {
+    pthread_key_create(&linthurber_column_cache_key, _linthurber_column_cache_free);
+}
+
+/**
+ * Returns the calling thread's column cache, resized if the requested
+ * capacity changed since it was last used. NULL if caching is disabled or
+ * the cache cannot be allocated.
+ */
+linthurber_column_cache_t *_linthurber_column_cache_get() {
+    linthurber_column_cache_t *cache = linthurber_column_cache;
+    int generation = __atomic_load_n(&linthurber_column_cache_generation, __ATOMIC_ACQUIRE);
+    int capacity;
+
+    if (cache == NULL) {
+        pthread_once(&linthurber_column_cache_once, _linthurber_column_cache_key_init);
+        cache = calloc(1, sizeof(linthurber_column_cache_t));
+        if (cache == NULL) return NULL;
+        pthread_setspecific(linthurber_column_cache_key, cache);
+        linthurber_column_cache = cache;
+    }
+
+    if (cache->generation != generation) {
+        /* Round the requested capacity up to a power of two, at least one set */
+        for (capacity = 2; capacity < linthurber_column_cache_capacity; capacity *= 2);
+        if (linthurber_column_cache_capacity <= 0) capacity = 0;
+
+        free(cache->entries);
+        cache->entries = NULL;
+        cache->capacity = 0;
+        if (capacity > 0) {
+            cache->entries = calloc(capacity, sizeof(linthurber_column_entry_t));
+            if (cache->entries) cache->capacity = capacity;
+        }
+        cache->generation = generation;
+    }
+    return (cache->capacity > 0) ? cache : NULL;
+}
+
+/**
+ * Returns the column at a longitude and latitude from the calling thread's
+ * cache, setting it up on a miss. Positions are matched exactly, so a hit
+ * gives the same column _linthurber_column_init would. Entries set up on
+ * another model state never match. The DEM is only looked up when asked
+ * for, and then at most once per entry.
+ *
+ * @param lon The longitude.
+ * @param lat The latitude.
+ * @param scratch Where the column is set up when caching is disabled.
+ * @param dem 1 if the column needs its DEM elevation.
+ * @return The column, valid until the next lookup on this thread.
+ */
+linthurber_column_t *_linthurber_column_lookup(double lon, double lat, linthurber_column_t *scratch,
+                                               int dem) {
+    linthurber_column_cache_t *cache = _linthurber_column_cache_get();
+    linthurber_column_entry_t *entry;
+    unsigned long serial;
+    uint64_t a, b, h;
+    int way;
+
+    if (cache == NULL) {
+        if (_linthurber_column_project(lon, lat, scratch) == SUCCESS && dem) {
+            _linthurber_column_dem(scratch);
+        }
+        return scratch;
+    }
+
+    serial = _linthurber_state_view()->serial;
+    memcpy(&a, &lon, sizeof(a));
+    memcpy(&b, &lat, sizeof(b));
+    h = (a * 0x9e3779b97f4a7c15ULL) ^ (b * 0xc2b2ae3d27d4eb4fULL);
+    entry = &cache->entries[((h ^ (h >> 29)) & (cache->capacity / 2 - 1)) * 2];
+
+    /* Two-way sets, most recently set up entry first */
+    for (way = 0; way < 2; way++) {
+        if ((entry[way].serial == serial) && (entry[way].lon == lon) && (entry[way].lat == lat)) {
+            cache->hits++;
+            if (dem && entry[way].col.projected && !entry[way].col.dem) {
+                _linthurber_column_dem(&entry[way].col);
+            }
+            return &entry[way].col;
+        }
+    }
+
+    cache->misses++;
+    entry[1] = entry[0];
+    if (_linthurber_column_project(lon, lat, &entry->col) == SUCCESS && dem) {
+        _linthurber_column_dem(&entry->col);
+    }
+    entry->lon = lon;
+    entry->lat = lat;
+    entry->serial = serial;
+    return &entry->col;
+}
+
+/**
+ * Adds the calling thread's hits and misses to the global counters, once
+ * per query rather than per point.
+ */
+void _linthurber_column_cache_flush() {
+    linthurber_column_cache_t *cache = linthurber_column_cache;
+
+    if ((cache == NULL) || (cache->hits + cache->misses == 0)) return;
+    __atomic_fetch_add(&linthurber_column_cache_hits, cache->hits, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&linthurber_column_cache_misses, cache->misses, __ATOMIC_RELAXED);
+    cache->hits = 0;
+    cache->misses = 0;
+}
+
+/**
+ * Sets the number of columns each thread caches between queries. Repeated
+ * query positions then skip the projection, the DEM lookup and the setup
+ * of the horizontal weights. Takes effect on each thread's next query.
+ *
+ * @param capacity The number of entries per thread, rounded up to a power
+ * of two, 0 to disable the cache. The default is 2048.
+ * @return SUCCESS or FAIL.
+ */
+int linthurber_set_column_cache(int capacity) {
+    if (capacity < 0) return FAIL;
+    linthurber_column_cache_capacity = capacity;
+    __atomic_fetch_add(&linthurber_column_cache_generation, 1, __ATOMIC_RELEASE);
+    return SUCCESS;
+}
+
+/**
+ * Returns the column cache hits and misses counted over all threads since
+ * the last reset.
+ *
+ * @param hits The number of hits returned.
+ * @param misses The number of misses returned.
+ * @return SUCCESS
+ */
+int linthurber_get_column_cache_stats(long *hits, long *misses) {
+    *hits = __atomic_load_n(&linthurber_column_cache_hits, __ATOMIC_RELAXED);
+    *misses = __atomic_load_n(&linthurber_column_cache_misses, __ATOMIC_RELAXED);
+    return SUCCESS;
+}
+
+/**
+ * Clears the column cache hit and miss counters.
+ *
+ * @return SUCCESS
+ */
+int linthurber_reset_column_cache_stats() {
+    __atomic_store_n(&linthurber_column_cache_hits, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&linthurber_column_cache_misses, 0, __ATOMIC_RELAXED);
+    return SUCCESS;
+}
+
+/**
+ * Evaluates vp, vs and rho at a depth below the surface of a column, with
+ * the kernel of the interpolation setting.
+ */
+void _linthurber_column_eval(linthurber_column_t *col, double depth, linthurber_properties_t *data) {
+    if (!col->valid) {
+        data->vp = -1.0;
+        data->vs = -1.0;
+        data->rho = -1.0;
+        return;
+    }
+    _linthurber_column_eval_msl(col, depth - col->elev, data);
+}
+
+/**
+ * Evaluates vp, vs and rho at a depth below mean sea level, in meters, of
+ * a projected column; the DEM is not needed.
+ */
+void _linthurber_column_eval_msl(linthurber_column_t *col, double depth_msl,
+                                 linthurber_properties_t *data) {
+    linthurber_model_t *model = linthurber_velocity_model;
+    double z;
+
+    data->vp = -1.0;
+    data->vs = -1.0;
+    data->rho = -1.0;
+    if (!col->projected) return;
+
+    z = _linthurber_depth_index(linthurber_configuration, depth_msl / 1000.0, NULL);
+    if (col->vp.valid) data->vp = model->kernel(&col->vp, model->vp_eval, z);
+    if (col->vs.valid) data->vs = model->kernel(&col->vs, model->vs_eval, z);
+    if (data->vp > 0.0) data->rho = model->isa->rho(data->vp);
+}
+
+/**
+ * Queries a vertical profile: one position, many depths. The position is
+ * projected and its horizontal cells are set up once for all depths.
+ *
+ * @param point The position; its depth is ignored.
+ * @param depths The depths below the surface in meters.
+ * @param data The numdepths material properties returned.
+ * @param numdepths The number of depths.
+ * @return SUCCESS or FAIL.
+ */
+int linthurber_query_column(linthurber_point_t *point, double *depths,
+                            linthurber_properties_t *data, int numdepths) {
+    linthurber_column_t col;
+    int d;
+
+    if (_linthurber_state_enter(NULL) != SUCCESS) return FAIL;
+    _linthurber_column_init(point->longitude, point->latitude, &col);
+    for (d = 0; d < numdepths; d++) {
+        _linthurber_column_eval(&col, depths[d], &data[d]);
+    }
+    _linthurber_state_exit();
+    return SUCCESS;
+}
+
+/**
+ * Returns the value of a piecewise-linear profile at a depth, constant
+ * above the first and below the last layer.
+ */
+double _linthurber_profile_at(double *d, double *v, int n, double depth) {
+    int k;
+
+    if (depth <= d[0]) return v[0];
+    for (k = 1; k < n; k++) {
+        if (depth <= d[k]) {
+            return v[k-1] + (v[k] - v[k-1]) * (depth - d[k-1]) / (d[k] - d[k-1]);
+        }
+    }
+    return v[n-1];
+}
+
+/**
+ * Returns the depth below the surface where a piecewise-linear profile
+ * first reaches a velocity, or -1.0 if it never does.
+ */
+double _linthurber_profile_reach(double *d, double *v, int n, double target) {
+    double da, va;
+    int k;
+
+    va = _linthurber_profile_at(d, v, n, 0.0);
+    if (va >= target) return 0.0;
+
+    /* Walk the layers below the surface; each starts below target */
+    for (k = 1; k < n; k++) {
+        if (d[k] <= 0.0) continue;
+        da = (d[k-1] > 0.0) ? d[k-1] : 0.0;
+        va = _linthurber_profile_at(d, v, n, da);
+        if (v[k] >= target) {
+            return da + (target - va) / (v[k] - va) * (d[k] - da);
+        }
+    }
+    return -1.0;
+}
+
+/**
+ * Returns the travel time of a vertical S wave from the surface down to a
+ * depth, or -1.0 if the profile has no data over that interval.
+ */
+double _linthurber_profile_time(double *d, double *v, int n, double bottom) {
+    double t = 0.0, lo, hi, vl, vh;
+    int k;
+
+    for (k = 0; k <= n; k++) {
+        /* Piece k spans [d[k-1], d[k]], with open ends above and below */
+        lo = (k == 0) ? -1.0e30 : d[k-1];
+        hi = (k == n) ? 1.0e30 : d[k];
+        if (lo < 0.0) lo = 0.0;
+        if (hi > bottom) hi = bottom;
+        if (hi <= lo) continue;
+
+        if ((k == 0) || (k == n)) {
+            vl = vh = v[(k == 0) ? 0 : n - 1];
+        } else {
+            vl = v[k-1] + (v[k] - v[k-1]) * (lo - d[k-1]) / (d[k] - d[k-1]);
+            vh = v[k-1] + (v[k] - v[k-1]) * (hi - d[k-1]) / (d[k] - d[k-1]);
+        }
+        if ((vl <= 0.0) || (vh <= 0.0)) return -1.0;
+
+        /* Exact integral of 1/v for v linear in depth */
+        if (fabs(vh - vl) < 1.0e-9 * vl) {
+            t += (hi - lo) / vl;
+        } else {
+            t += (hi - lo) / (vh - vl) * log(vh / vl);
+        }
+    }
+    return t;
+}
+
+/**
+ * Computes Vs30, Z1.0 and Z2.5 at a column from its vs layer values.
+ */
+void _linthurber_column_site(linthurber_column_t *col, linthurber_site_t *site) {
+    linthurber_configuration_t *config = linthurber_configuration;
+    double d[LINTHURBER_MAX_Z_DIM], v[LINTHURBER_MAX_Z_DIM], t;
+    int k;
+
+    site->vs30 = -1.0;
+    site->z1p0 = -1.0;
+    site->z2p5 = -1.0;
+    if (!col->valid || !col->vs.valid) return;
+
+    /* Layer depths below the surface in meters, and the Vs at each */
+    for (k = 0; k < config->num_z; k++) {
+        d[k] = config->depths_msl[k] * 1000.0 + col->elev;
+        v[k] = _linthurber_hcell_layer(&col->vs, linthurber_velocity_model->vs, k);
+    }
+
+    t = _linthurber_profile_time(d, v, config->num_z, 30.0);
+    if (t > 0.0) site->vs30 = 30.0 / t;
+    site->z1p0 = _linthurber_profile_reach(d, v, config->num_z, 1000.0);
+    site->z2p5 = _linthurber_profile_reach(d, v, config->num_z, 2500.0);
+}
+
+/** Arguments of a batch of sites. */
+typedef struct linthurber_site_batch_t {
+     linthurber_point_t *points;
+     linthurber_site_t *sites;
+} linthurber_site_batch_t;
+
+void _linthurber_site_range(void *arg, int begin, int end) {
+    linthurber_site_batch_t *batch = arg;
+    linthurber_column_t col;
+    int p;
+
+    for (p = begin; p < end; p++) {
+        _linthurber_column_init(batch->points[p].longitude, batch->points[p].latitude, &col);
+        _linthurber_column_site(&col, &batch->sites[p]);
+    }
+}
+
+/**
+ * Computes site parameters from the vertical Vs profile below each point:
+ * Vs30 (time-averaged Vs over the top 30 m) and the depths to the 1.0 and
+ * 2.5 km/s isosurfaces. The profile is piecewise linear between the
+ * depths_msl layers, so all three are exact rather than sampled. Runs on
+ * the threads set with linthurber_set_num_threads.
+ *
+ * @param points The sites; depths are ignored.
+ * @param sites The site parameters returned, -1.0 where undefined.
+ * @param numpoints The number of sites.
+ * @return SUCCESS or FAIL.
+ */
+int linthurber_query_site(linthurber_point_t *points, linthurber_site_t *sites, int numpoints) {
+    linthurber_site_batch_t batch;
+    int err;
+
+    if (_linthurber_state_enter(NULL) != SUCCESS) return FAIL;
+    batch.points = points;
+    batch.sites = sites;
+    err = _linthurber_parallel_for(numpoints, LINTHURBER_SITE_GRAIN, _linthurber_site_range, &batch);
+    _linthurber_state_exit();
+    return err;
+}
@@ -0,0 +1,161 @@
+/*
+ * @file linthurber_cubic.c
+ * @brief Tricubic interpolation of the LINTHURBER vp and vs grids.
+ * @author - SCEC
+ * @version 1.0.1
+ *
+ * With interpolation = cubic in the model configuration, vp and vs are
+ * interpolated with a Catmull-Rom spline along each grid index, which
+ * passes through the nodes and is smooth across cell faces. Within a cell
+ * the spline is a polynomial of degree three in each of fx, fy and fz. Its
+ * 64 coefficients are computed from the 4x4x4 surrounding nodes at load
+ * time and stored per cell in a 64-byte aligned table, so a query is a
+ * nested Horner evaluation of one cell's coefficients.
+ *
+ * Cells near missing data (values not above zero) store the coefficients
+ * of their trilinear interpolant instead, which gives the same values as
+ * the trilinear kernel there without a test in the query path.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "linthurber.h"
+
+/** Catmull-Rom basis, times two: row d gives the t^d coefficient from p[-1..2] */
+static const double linthurber_catmull_rom[4][4] = {
+     {  0.0,  2.0,  0.0,  0.0 },
+     { -1.0,  0.0,  1.0,  0.0 },
+     {  2.0, -5.0,  4.0, -1.0 },
+     { -1.0,  3.0, -3.0,  1.0 }
+};
+
+/** Linear basis on p[0..1], in the same form */
+static const double linthurber_linear[4][4] = {
+     {  0.0,  2.0,  0.0,  0.0 },
+     {  0.0, -2.0,  2.0,  0.0 },
+     {  0.0,  0.0,  0.0,  0.0 },
+     {  0.0,  0.0,  0.0,  0.0 }
+};
+
+int _linthurber_cubic_clamp(int v, int n) {
+    return (v < 0) ? 0 : ((v >= n) ? n - 1 : v);
+}
+
+/**
+ * Computes the coefficients of one cell from its 4x4x4 neighborhood,
+ * applying a basis along x, then y, then z.
+ */
+void _linthurber_cubic_cell(double p[4][4][4], const double (*basis)[4], float *coef) {
+    double a[4][4][4], b[4][4][4], s;
+    int d, e, f, u;
+
+    for (f = 0; f < 4; f++) {
+        for (e = 0; e < 4; e++) {
+            for (d = 0; d < 4; d++) {
+                for (s = 0.0, u = 0; u < 4; u++) s += basis[d][u] * p[f][e][u];
+                a[f][e][d] = 0.5 * s;
+            }
+        }
+    }
+    for (f = 0; f < 4; f++) {
+        for (e = 0; e < 4; e++) {
+            for (d = 0; d < 4; d++) {
+                for (s = 0.0, u = 0; u < 4; u++) s += basis[e][u] * a[f][u][d];
+                b[f][e][d] = 0.5 * s;
+            }
+        }
+    }
+    for (f = 0; f < 4; f++) {
+        for (e = 0; e < 4; e++) {
+            for (d = 0; d < 4; d++) {
+                for (s = 0.0, u = 0; u < 4; u++) s += basis[f][u] * b[u][e][d];
+                coef[(f * 4 + e) * 4 + d] = (float)(0.5 * s);
+            }
+        }
+    }
+}
+
+/**
+ * Computes the coefficient table of a padded grid, cells ordered like the
+ * corner-packed layout.
+ *
+ * @param buf The padded node grid.
+ * @param dims The grid dimensions, padding excluded.
+ * @return The table, or NULL if it cannot be allocated.
+ */
+float *_linthurber_cubic_grid(float *buf, int *dims) {
+    double p[4][4][4];
+    float *table;
+    void *ptr;
+    size_t n;
+    int i, j, k, a, b, c, missing;
+
+    if (posix_memalign(&ptr, 64, (size_t)dims[0] * dims[1] * dims[2] *
+                       LINTHURBER_CUBIC_SIZE * sizeof(float)) != 0) return NULL;
+    table = ptr;
+
+    n = 0;
+    for (k = 0; k < dims[2]; k++) {
+        for (j = 0; j < dims[1]; j++) {
+            for (i = 0; i < dims[0]; i++) {
+                /* Nodes -1..2 around the cell, edges repeated */
+                missing = 0;
+                for (c = 0; c < 4; c++) {
+                    for (b = 0; b < 4; b++) {
+                        for (a = 0; a < 4; a++) {
+                            p[c][b][a] = buf[LINTHURBER_NODE(dims,
+                                                _linthurber_cubic_clamp(i + a - 1, dims[0]),
+                                                _linthurber_cubic_clamp(j + b - 1, dims[1]),
+                                                _linthurber_cubic_clamp(k + c - 1, dims[2]))];
+                            if (p[c][b][a] <= 0.0) missing = 1;
+                        }
+                    }
+                }
+
+                /* The linear basis reads p[0..1], the cell's own corners */
+                if (missing) {
+                    for (c = 0; c < 2; c++) {
+                        for (b = 0; b < 2; b++) {
+                            for (a = 0; a < 2; a++) {
+                                p[c + 1][b + 1][a + 1] =
+                                    buf[LINTHURBER_NODE(dims, i, j, k) +
+                                        ((size_t)c * (dims[1] + 1) + b) * (dims[0] + 1) + a];
+                            }
+                        }
+                    }
+                }
+                _linthurber_cubic_cell(p, missing ? linthurber_linear : linthurber_catmull_rom,
+                                       table + n * LINTHURBER_CUBIC_SIZE);
+                n++;
+            }
+        }
+    }
+    return table;
+}
+
+/**
+ * Builds the tricubic coefficients of vp and vs if the configuration asks
+ * for cubic interpolation.
+ *
+ * @param config The model configuration.
+ * @param model The model, with its node grids in place.
+ * @return SUCCESS, or FAIL if the tables cannot be allocated.
+ */
+int _linthurber_cubic_model(linthurber_configuration_t *config, linthurber_model_t *model) {
+    if (config->interpolation != LINTHURBER_INTERP_CUBIC) return SUCCESS;
+
+    model->vp_coef = _linthurber_cubic_grid(model->vp, config->vp_dims);
+    model->vs_coef = _linthurber_cubic_grid(model->vs, config->vs_dims);
+    if ((model->vp_coef == NULL) || (model->vs_coef == NULL)) {
+        free(model->vp_coef);
+        free(model->vs_coef);
+        model->vp_coef = NULL;
+        model->vs_coef = NULL;
+        return FAIL;
+    }
+    return SUCCESS;
+}
+
@@ -0,0 +1,172 @@
+/*
+ * @file linthurber_cull.c
+ * @brief Rejection of query points outside of the LINTHURBER model region.
+ * @author - SCEC
+ * @version 1.0.1
+ *
+ * Projecting a longitude and latitude runs up to ten Newton iterations,
+ * and a point outside of the model is only rejected after that, by the
+ * grid bounds. In multi-model stacks most points queried against this
+ * model are outside of it. The bilinear map of the model corners takes the
+ * rectangle of model coordinates any grid accepts to a quadrilateral with
+ * straight edges, so a bounding box and four edge tests, computed once
+ * per load, reject those points in a few flops each. The rectangle takes
+ * in the half cell past the edge nodes that the grids round onto them,
+ * and as much again so that rounding never rejects a point the grids
+ * would accept. Where the map is not convex on the rectangle the test is
+ * the box alone, and where it folds over there is no test.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "linthurber.h"
+
+/** Points tested, and those rejected, by this thread */
+__thread long linthurber_cull_tested = 0;
+__thread long linthurber_cull_rejected = 0;
+/** The same, over all threads, since the last reset */
+long linthurber_cull_total_tested = 0;
+long linthurber_cull_total_rejected = 0;
+
+/**
+ * Maps model coordinates in meters to a longitude and latitude, the
+ * inverse of ucvm_bilinear_geo2xy, extended past the model corners; also
+ * returns the Jacobian determinant of the map there.
+ */
+void _linthurber_cull_xy2geo(ucvm_bilinear_t *par, double x, double y, double *geo, double *det) {
+    static const double csii[] =  {-1.0, -1.0, 1.0,  1.0 };
+    static const double ethai[] = {-1.0,  1.0, 1.0, -1.0 };
+    double u = 2.0 * x / par->dims[0] - 1.0, v = 2.0 * y / par->dims[1] - 1.0;
+    double j[4] = { 0.0, 0.0, 0.0, 0.0 };
+    int i;
+
+    geo[0] = 0.0;
+    geo[1] = 0.0;
+    for (i = 0; i < 4; i++) {
+        geo[0] += par->xi[i] * 0.25 * (1.0 + csii[i] * u) * (1.0 + ethai[i] * v);
+        geo[1] += par->yi[i] * 0.25 * (1.0 + csii[i] * u) * (1.0 + ethai[i] * v);
+        j[0] += par->xi[i] * 0.25 * csii[i] * (1.0 + ethai[i] * v);
+        j[1] += par->xi[i] * 0.25 * ethai[i] * (1.0 + csii[i] * u);
+        j[2] += par->yi[i] * 0.25 * csii[i] * (1.0 + ethai[i] * v);
+        j[3] += par->yi[i] * 0.25 * ethai[i] * (1.0 + csii[i] * u);
+    }
+    *det = j[0] * j[3] - j[1] * j[2];
+}
+
+/**
+ * Computes the region of a configuration from its corners and grids. Grid
+ * g accepts x from -spacing / 2 to (dims[0] - 1/2) * spacing, and so on
+ * for y.
+ *
+ * @param config The configuration, with its projection and grids set up.
+ */
+void _linthurber_cull_init(linthurber_configuration_t *config) {
+    linthurber_cull_t *cull = &config->cull;
+    double spacing[3] = { config->spacing_vp, config->spacing_vs, config->spacing_dem };
+    int *dims[3] = { config->vp_dims, config->vs_dims, config->dem_dims };
+    double smax = 0.0, x[2], y[2], geo[4][2], det[4], area = 0.0, turn;
+    int g, n, m;
+
+    /* Until the corners are known to be usable, everything may be inside */
+    cull->lon_min = -HUGE_VAL;
+    cull->lon_max = HUGE_VAL;
+    cull->lat_min = -HUGE_VAL;
+    cull->lat_max = HUGE_VAL;
+    for (n = 0; n < 4; n++) {
+        cull->a[n] = 0.0;
+        cull->b[n] = 0.0;
+        cull->c[n] = 1.0;
+    }
+
+    x[1] = 0.0;
+    y[1] = 0.0;
+    for (g = 0; g < 3; g++) {
+        if (spacing[g] > smax) smax = spacing[g];
+        if ((dims[g][0] - 0.5) * spacing[g] > x[1]) x[1] = (dims[g][0] - 0.5) * spacing[g];
+        if ((dims[g][1] - 0.5) * spacing[g] > y[1]) y[1] = (dims[g][1] - 0.5) * spacing[g];
+    }
+    /* Half a cell of the coarsest grid, plus as much again for rounding */
+    x[0] = -smax;
+    y[0] = -smax;
+    x[1] += 0.5 * smax;
+    y[1] += 0.5 * smax;
+
+    /* Corners in the order of the model corners, around the rectangle */
+    _linthurber_cull_xy2geo(&config->proj, x[0], y[0], geo[0], &det[0]);
+    _linthurber_cull_xy2geo(&config->proj, x[0], y[1], geo[1], &det[1]);
+    _linthurber_cull_xy2geo(&config->proj, x[1], y[1], geo[2], &det[2]);
+    _linthurber_cull_xy2geo(&config->proj, x[1], y[0], geo[3], &det[3]);
+
+    /* The determinant is affine in u and v, one sign at the corners means no fold */
+    for (n = 1; n < 4; n++) {
+        if ((det[n] * det[0] <= 0.0) || !isfinite(det[n])) return;
+    }
+
+    cull->lon_min = fmin(fmin(geo[0][0], geo[1][0]), fmin(geo[2][0], geo[3][0]));
+    cull->lon_max = fmax(fmax(geo[0][0], geo[1][0]), fmax(geo[2][0], geo[3][0]));
+    cull->lat_min = fmin(fmin(geo[0][1], geo[1][1]), fmin(geo[2][1], geo[3][1]));
+    cull->lat_max = fmax(fmax(geo[0][1], geo[1][1]), fmax(geo[2][1], geo[3][1]));
+
+    for (n = 0; n < 4; n++) {
+        m = (n + 1) % 4;
+        area += geo[n][0] * geo[m][1] - geo[m][0] * geo[n][1];
+    }
+    for (n = 0; n < 4; n++) {
+        m = (n + 1) % 4;
+        g = (n + 2) % 4;
+        turn = (geo[m][0] - geo[n][0]) * (geo[g][1] - geo[m][1]) -
+               (geo[m][1] - geo[n][1]) * (geo[g][0] - geo[m][0]);
+        /* Not convex, the box alone */
+        if (turn * area <= 0.0) return;
+    }
+
+    /* Edge n from corner n to n + 1, oriented so the inside is positive */
+    for (n = 0; n < 4; n++) {
+        m = (n + 1) % 4;
+        turn = (area > 0.0) ? 1.0 : -1.0;
+        cull->a[n] = -turn * (geo[m][1] - geo[n][1]);
+        cull->b[n] = turn * (geo[m][0] - geo[n][0]);
+        cull->c[n] = -(cull->a[n] * geo[n][0] + cull->b[n] * geo[n][1]);
+    }
+}
+
+/**
+ * Adds the calling thread's counts to the global counters, when it leaves
+ * a query.
+ */
+void _linthurber_cull_flush() {
+    if (linthurber_cull_tested == 0) return;
+    __atomic_fetch_add(&linthurber_cull_total_tested, linthurber_cull_tested, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&linthurber_cull_total_rejected, linthurber_cull_rejected, __ATOMIC_RELAXED);
+    linthurber_cull_tested = 0;
+    linthurber_cull_rejected = 0;
+}
+
+/**
+ * Returns how many query points were tested against the model region over
+ * all threads since the last reset, and how many of them were rejected as
+ * outside of it without being projected.
+ *
+ * @param tested The number of points tested returned.
+ * @param rejected The number of points rejected returned.
+ * @return SUCCESS
+ */
+int linthurber_get_cull_stats(long *tested, long *rejected) {
+    *tested = __atomic_load_n(&linthurber_cull_total_tested, __ATOMIC_RELAXED);
+    *rejected = __atomic_load_n(&linthurber_cull_total_rejected, __ATOMIC_RELAXED);
+    return SUCCESS;
+}
+
+/**
+ * Clears the region test counters.
+ *
+ * @return SUCCESS
+ */
+int linthurber_reset_cull_stats() {
+    __atomic_store_n(&linthurber_cull_total_tested, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&linthurber_cull_total_rejected, 0, __ATOMIC_RELAXED);
+    return SUCCESS;
+}
@@ -0,0 +1,159 @@
+/**
+ * @file linthurber_isa.c
+ * @brief Instruction set dispatch of the LINTHURBER query kernels.
+ * @author - SCEC
+ * @version 1.0.1
+ *
+ * The library is built with the user's CFLAGS, which usually target a
+ * baseline x86-64. The kernels in linthurber_kernels.h are compiled here
+ * once more for each of SSE4.2, AVX2 with FMA and AVX-512, and the best
+ * level the CPU supports is chosen from CPUID whenever a model is loaded.
+ * linthurber_set_isa forces a lower level, e.g. to compare them. Every
+ * level gives the same results to the bit, so the nodes of a heterogeneous
+ * MPI job agree: the kernels are compiled without contracting a multiply
+ * and an add into an FMA, which rounds once instead of twice.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "linthurber.h"
+
+/* No FMA contraction in any instantiation, including a baseline built
+   with -march=native, so that all levels round alike */
+#pragma GCC optimize("fp-contract=off")
+
+extern __thread long linthurber_uniform_evals;
+extern __thread long linthurber_uniform_hits;
+
+/* Baseline, the target of the build */
+#define LINTHURBER_ISA_SUFFIX
+#define LINTHURBER_ISA_LINKAGE
+#define LINTHURBER_ISA_NAME "baseline"
+#define LINTHURBER_ISA_LEVEL LINTHURBER_ISA_BASELINE
+#include "linthurber_kernels.h"
+#undef LINTHURBER_ISA_SUFFIX
+#undef LINTHURBER_ISA_LINKAGE
+#undef LINTHURBER_ISA_NAME
+#undef LINTHURBER_ISA_LEVEL
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#pragma GCC push_options
+#pragma GCC target("sse4.2,popcnt")
+#define LINTHURBER_ISA_SUFFIX _sse42
+#define LINTHURBER_ISA_LINKAGE static
+#define LINTHURBER_ISA_NAME "sse4.2"
+#define LINTHURBER_ISA_LEVEL LINTHURBER_ISA_SSE42
+#include "linthurber_kernels.h"
+#undef LINTHURBER_ISA_SUFFIX
+#undef LINTHURBER_ISA_LINKAGE
+#undef LINTHURBER_ISA_NAME
+#undef LINTHURBER_ISA_LEVEL
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+#define LINTHURBER_ISA_SUFFIX _avx2
+#define LINTHURBER_ISA_LINKAGE static
+#define LINTHURBER_ISA_NAME "avx2"
+#define LINTHURBER_ISA_LEVEL LINTHURBER_ISA_AVX2
+#include "linthurber_kernels.h"
+#undef LINTHURBER_ISA_SUFFIX
+#undef LINTHURBER_ISA_LINKAGE
+#undef LINTHURBER_ISA_NAME
+#undef LINTHURBER_ISA_LEVEL
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512vl,avx512dq,avx2,fma")
+#define LINTHURBER_ISA_SUFFIX _avx512
+#define LINTHURBER_ISA_LINKAGE static
+#define LINTHURBER_ISA_NAME "avx512"
+#define LINTHURBER_ISA_LEVEL LINTHURBER_ISA_AVX512
+#include "linthurber_kernels.h"
+#undef LINTHURBER_ISA_SUFFIX
+#undef LINTHURBER_ISA_LINKAGE
+#undef LINTHURBER_ISA_NAME
+#undef LINTHURBER_ISA_LEVEL
+#pragma GCC pop_options
+
+#endif
+
+/** Kernels of every level, indexed by level */
+static const linthurber_isa_t *linthurber_isa_tables[] = {
+     &linthurber_isa_table,
+#if defined(__x86_64__) || defined(__i386__)
+     &linthurber_isa_table_sse42,
+     &linthurber_isa_table_avx2,
+     &linthurber_isa_table_avx512
+#endif
+};
+
+/** Level forced by linthurber_set_isa, or LINTHURBER_ISA_AUTO */
+int linthurber_isa_forced = LINTHURBER_ISA_AUTO;
+
+/**
+ * Returns the highest level of kernels the CPU, and the operating system's
+ * saving of vector registers, supports.
+ */
+int _linthurber_isa_detect() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl") &&
+        __builtin_cpu_supports("avx512dq")) return LINTHURBER_ISA_AVX512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return LINTHURBER_ISA_AVX2;
+    if (__builtin_cpu_supports("sse4.2")) return LINTHURBER_ISA_SSE42;
+#endif
+    return LINTHURBER_ISA_BASELINE;
+}
+
+/**
+ * Chooses the kernels of the forced level, or of the best level the CPU
+ * supports. Called while a model is being loaded, before its kernels are
+ * selected. Each model keeps its own, so a reload at another level never
+ * changes the kernels of queries still running on the model before it.
+ *
+ * @param model The model being loaded.
+ */
+void _linthurber_isa_select(linthurber_model_t *model) {
+    int level = _linthurber_isa_detect();
+
+    if ((linthurber_isa_forced != LINTHURBER_ISA_AUTO) && (linthurber_isa_forced < level)) {
+        level = linthurber_isa_forced;
+    }
+    model->isa = linthurber_isa_tables[level];
+}
+
+/**
+ * Forces the instruction set level of the query kernels, from the next
+ * linthurber_init or linthurber_reload on.
+ *
+ * @param level One of the LINTHURBER_ISA levels, or LINTHURBER_ISA_AUTO for
+ * the best the CPU supports.
+ * @return SUCCESS, or FAIL if the CPU does not support the level.
+ */
+int linthurber_set_isa(int level) {
+    if ((level < LINTHURBER_ISA_AUTO) || (level > _linthurber_isa_detect())) return FAIL;
+    linthurber_isa_forced = level;
+    return SUCCESS;
+}
+
+/**
+ * Returns the instruction set level of the query kernels in use, baseline
+ * until a model is loaded.
+ *
+ * @param name If not NULL, receives the name of the level.
+ * @return One of the LINTHURBER_ISA levels.
+ */
+int linthurber_get_isa(const char **name) {
+    const linthurber_isa_t *isa = &linthurber_isa_table;
+
+    if (_linthurber_state_enter(NULL) == SUCCESS) {
+        isa = _linthurber_state_view()->model->isa;
+        _linthurber_state_exit();
+    }
+    if (name) *name = isa->name;
+    return isa->level;
+}
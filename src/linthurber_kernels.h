@@ -0,0 +1,259 @@
+/**
+ * @file linthurber_kernels.h
+ * @brief Query kernels of the LINTHURBER model, one copy per instruction set.
+ * @author - SCEC
+ * @version 1.0.1
+ *
+ * Included by linthurber_isa.c once for each instruction set level, with
+ * LINTHURBER_ISA_SUFFIX appended to every name and the target of the
+ * instantiation set by a pragma. The baseline copy has no suffix and is the
+ * one the rest of the library calls directly. There is deliberately no
+ * include guard.
+ *
+ */
+
+#define LINTHURBER_ISA_CAT2(a, b) a##b
+#define LINTHURBER_ISA_CAT(a, b) LINTHURBER_ISA_CAT2(a, b)
+#define LINTHURBER_ISA_FN(name) LINTHURBER_ISA_CAT(name, LINTHURBER_ISA_SUFFIX)
+
+/**
+ * Returns the bilinear value of layer c of a grid at a column.
+ */
+LINTHURBER_ISA_LINKAGE double LINTHURBER_ISA_FN(_linthurber_hcell_layer)(linthurber_hcell_t *cell,
+                                                                         float *buf, int c) {
+    float *layer = buf + (size_t)c * cell->plane;
+    double gx = 1.0 - cell->fx, gy = 1.0 - cell->fy;
+
+    return gy * (gx * layer[cell->offset[0]] + cell->fx * layer[cell->offset[1]]) +
+           cell->fy * (gx * layer[cell->offset[2]] + cell->fx * layer[cell->offset[3]]);
+}
+
+/**
+ * Returns the value of a grid at fractional layer index z of a column,
+ * matching _linthurber_getval at the same point, the corner itself in a
+ * uniform cell.
+ */
+LINTHURBER_ISA_LINKAGE double LINTHURBER_ISA_FN(_linthurber_hcell_value)(linthurber_hcell_t *cell,
+                                                                         float *buf, double z) {
+    int k0 = (int)z, k1 = k0 + 1;
+    double fz = z - k0;
+
+    if (cell->uniform) {
+        size_t n = (size_t)k0 * cell->layer_cells + cell->cell;
+
+        linthurber_uniform_evals++;
+        if (LINTHURBER_UNIFORM(cell->uniform, n)) {
+            linthurber_uniform_hits++;
+            return buf[(size_t)k0 * cell->plane + cell->offset[0]];
+        }
+    }
+
+    /* Layer nz is the padding, a copy of the last */
+    return (1.0 - fz) * LINTHURBER_ISA_FN(_linthurber_hcell_layer)(cell, buf, k0) +
+           fz * LINTHURBER_ISA_FN(_linthurber_hcell_layer)(cell, buf, k1);
+}
+
+/**
+ * Returns the value of a corner-packed grid at fractional layer index z of
+ * a column, bit-identical to _linthurber_hcell_value on the node grid.
+ */
+LINTHURBER_ISA_LINKAGE double LINTHURBER_ISA_FN(_linthurber_hcell_value_packed)(linthurber_hcell_t *cell,
+                                                                                float *cells, double z) {
+    int k0 = (int)z;
+    size_t n = (size_t)k0 * cell->layer_cells + cell->cell;
+    float *q = cells + n * LINTHURBER_CELL_SIZE;
+    double fz = z - k0;
+    double gx = 1.0 - cell->fx, gy = 1.0 - cell->fy;
+
+    if (cell->uniform) {
+        linthurber_uniform_evals++;
+        if (LINTHURBER_UNIFORM(cell->uniform, n)) {
+            linthurber_uniform_hits++;
+            return q[0];
+        }
+    }
+    return (1.0 - fz) * (gy * (gx * q[0] + cell->fx * q[1]) + cell->fy * (gx * q[2] + cell->fx * q[3])) +
+           fz * (gy * (gx * q[4] + cell->fx * q[5]) + cell->fy * (gx * q[6] + cell->fx * q[7]));
+}
+
+/**
+ * Returns the bilinear value of a grid in the layer nearest to fractional
+ * layer index z of a column.
+ */
+LINTHURBER_ISA_LINKAGE double LINTHURBER_ISA_FN(_linthurber_hcell_bilinear)(linthurber_hcell_t *cell,
+                                                                            float *buf, double z) {
+    return LINTHURBER_ISA_FN(_linthurber_hcell_layer)(cell, buf, (int)(z + 0.5));
+}
+
+/**
+ * Returns the value of a grid at the node nearest to fractional layer
+ * index z of a column.
+ */
+LINTHURBER_ISA_LINKAGE double LINTHURBER_ISA_FN(_linthurber_hcell_nearest)(linthurber_hcell_t *cell,
+                                                                           float *buf, double z) {
+    int n = ((cell->fy >= 0.5) ? 2 : 0) + ((cell->fx >= 0.5) ? 1 : 0);
+
+    return buf[(size_t)(int)(z + 0.5) * cell->plane + cell->offset[n]];
+}
+
+/**
+ * Returns the tricubic value of a grid at fractional layer index z of a
+ * column, from the grid's coefficient table.
+ */
+LINTHURBER_ISA_LINKAGE double LINTHURBER_ISA_FN(_linthurber_hcell_cubic)(linthurber_hcell_t *cell,
+                                                                         float *table, double z) {
+    int k0 = (int)z;
+    float *c = table + ((size_t)k0 * cell->layer_cells + cell->cell) * LINTHURBER_CUBIC_SIZE;
+    double fx = cell->fx, fy = cell->fy, fz = z - k0;
+    double py[4], pz[4];
+    int e, f;
+
+    for (f = 0; f < 4; f++) {
+        for (e = 0; e < 4; e++, c += 4) {
+            py[e] = ((c[3] * fx + c[2]) * fx + c[1]) * fx + c[0];
+        }
+        pz[f] = ((py[3] * fy + py[2]) * fy + py[1]) * fy + py[0];
+    }
+    return ((pz[3] * fz + pz[2]) * fz + pz[1]) * fz + pz[0];
+}
+
+/* Density derived from Vp via Nafe-Drake curve, Brocher (2005) eqn 1. */
+LINTHURBER_ISA_LINKAGE double LINTHURBER_ISA_FN(_get_rho)(double f) {
+  double rho;
+
+  /* Convert m to km */
+  f = f / 1000.0;
+  rho = f * (1.6612 - f * (0.4721 - f * (0.0671 - f * (0.0043 - f * 0.000106))));
+  if (rho < 1.0) {
+    rho = 1.0;
+  }
+  rho = rho * 1000.0;
+  return(rho);
+}
+
+/**
+ * Converts a longitude and latitude to model x and y in meters, inverting
+ * the bilinear map of the model corners by Newton iteration as
+ * ucvm_bilinear_geo2xy does.
+ *
+ * @return 0, or 1 if the iteration does not converge.
+ */
+LINTHURBER_ISA_LINKAGE int LINTHURBER_ISA_FN(_linthurber_geo2xy)(ucvm_bilinear_t *par, double lon,
+                                                                 double lat, double *rx, double *ry) {
+  static const double csii[] =  {-1.0, -1.0, 1.0,  1.0 };
+  static const double ethai[] = {-1.0,  1.0, 1.0, -1.0 };
+  int i, k=0;
+  double x=0, y=0, x0, y0, dx, dy;
+  double j[4], j1[4], j2[4], jinv[4];
+  double xce=0, yce=0;
+  double res=1, d, p, q;
+
+  j1[0] = 0;
+  j1[1] = 0;
+  j1[2] = 0;
+  j1[3] = 0;
+
+  for(i=0; i<4; i++){
+    j1[0] += par->xi[i] * csii[i];
+    j1[1] += par->xi[i] * ethai[i];
+    j1[2] += par->yi[i] * csii[i];
+    j1[3] += par->yi[i] * ethai[i];
+    xce += par->xi[i] * csii[i] * ethai[i];
+    yce += par->yi[i] * csii[i] * ethai[i];
+  }
+
+  do {
+    k++;
+
+    j2[0] = y * xce;
+    j2[1] = x * xce;
+    j2[2] = y * yce;
+    j2[3] = x * yce;
+
+    j[0] = .25 * (j1[0] + j2[0]);
+    j[1] = .25 * (j1[1] + j2[1]);
+    j[2] = .25 * (j1[2] + j2[2]);
+    j[3] = .25 * (j1[3] + j2[3]);
+
+    d = (j[0]*j[3]) - (j[2]*j[1]);
+    jinv[0] =  j[3] / d;
+    jinv[1] = -j[1] / d;
+    jinv[2] = -j[2] / d;
+    jinv[3] =  j[0] / d;
+
+    x0 = 0;
+    y0 = 0;
+
+    for(i=0; i<4; i++){
+      x0 += par->xi[i] * (.25 * (1 + (csii[i]  * x))
+                          * (1 + (ethai[i] * y)));
+      y0 += par->yi[i] * (.25 * (1 + (csii[i]  * x))
+                          * (1 + (ethai[i] * y)));
+    }
+
+    p = lon - x0;
+    q = lat - y0;
+    dx = (jinv[0]*p) + (jinv[1]*q);
+    dy = (jinv[2]*p) + (jinv[3]*q);
+
+    x += dx;
+    y += dy;
+
+    res = dx*dx + dy*dy;
+
+  } while(res > 1e-12 && k<10);
+
+  if(k>=10){
+    return 1;
+  }
+
+  *rx = (x + 1) * par->dims[0]/2.0;
+  *ry = (y + 1) * par->dims[1]/2.0;
+
+  return 0;
+}
+
+/**
+ * Tests a batch of longitudes and latitudes against the region of the
+ * model, without branches so that the loop vectorizes.
+ *
+ * @param cull The region.
+ * @param lon The n longitudes.
+ * @param lat The n latitudes.
+ * @param n The number of points.
+ * @param inside Set to 1 for the points that may fall in the model, 0 else.
+ * @return The number of points outside.
+ */
+LINTHURBER_ISA_LINKAGE int LINTHURBER_ISA_FN(_linthurber_cull)(const linthurber_cull_t *cull,
+                                                               const double *lon, const double *lat,
+                                                               int n, unsigned char *inside) {
+    /* Local copies, inside may alias the region */
+    double lon0 = cull->lon_min, lon1 = cull->lon_max, lat0 = cull->lat_min, lat1 = cull->lat_max;
+    double a0 = cull->a[0], a1 = cull->a[1], a2 = cull->a[2], a3 = cull->a[3];
+    double b0 = cull->b[0], b1 = cull->b[1], b2 = cull->b[2], b3 = cull->b[3];
+    double c0 = cull->c[0], c1 = cull->c[1], c2 = cull->c[2], c3 = cull->c[3];
+    int p, in, outside = 0;
+
+    for (p = 0; p < n; p++) {
+        in = (lon[p] >= lon0) & (lon[p] <= lon1) & (lat[p] >= lat0) & (lat[p] <= lat1) &
+             (a0 * lon[p] + b0 * lat[p] + c0 >= 0.0) & (a1 * lon[p] + b1 * lat[p] + c1 >= 0.0) &
+             (a2 * lon[p] + b2 * lat[p] + c2 >= 0.0) & (a3 * lon[p] + b3 * lat[p] + c3 >= 0.0);
+        inside[p] = in;
+        outside += !in;
+    }
+    return outside;
+}
+
+/** The kernels of this instantiation */
+static const linthurber_isa_t LINTHURBER_ISA_FN(linthurber_isa_table) = {
+     LINTHURBER_ISA_NAME,
+     LINTHURBER_ISA_LEVEL,
+     LINTHURBER_ISA_FN(_linthurber_hcell_value),
+     LINTHURBER_ISA_FN(_linthurber_hcell_value_packed),
+     LINTHURBER_ISA_FN(_linthurber_hcell_bilinear),
+     LINTHURBER_ISA_FN(_linthurber_hcell_nearest),
+     LINTHURBER_ISA_FN(_linthurber_hcell_cubic),
+     LINTHURBER_ISA_FN(_get_rho),
+     LINTHURBER_ISA_FN(_linthurber_geo2xy),
+     LINTHURBER_ISA_FN(_linthurber_cull)
+};
@@ -0,0 +1,273 @@
+/*
+ * @file linthurber_lod.c
+ * @brief Level-of-detail pyramid of the LINTHURBER model.
+ * @author - SCEC
+ * @version 1.0.1
+ *
+ * Each grid is reduced to a series of levels, each with twice the
+ * horizontal spacing of the one before. A coarse node is the [1/4 1/2 1/4]
+ * weighted average of the fine nodes around it along x and y, so features
+ * finer than the level spacing are averaged out instead of aliased. Layers
+ * are not reduced; there are only a few of them and they are unevenly
+ * spaced.
+ *
+ * For every target resolution there is a view of the model whose grids are
+ * each the coarsest level still at least as fine as the target. Views are
+ * complete states sharing the pyramid buffers, so the regular query path,
+ * the thread pool and the column cache work on them unchanged. The last
+ * coarse node along an axis may lie past the last fine one; views keep the
+ * region of the full resolution model, and answer nowhere it does not.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "linthurber.h"
+
+/** Weights of the reduction filter around a coarse node */
+static const double linthurber_lod_weight[3] = { 0.25, 0.5, 0.25 };
+
+/**
+ * Reduces a grid to half its horizontal resolution. Coarse node (I, J) sits
+ * on fine node (2I, 2J); fine nodes past the edge are clamped to it.
+ *
+ * @param src The fine grid, padded, x fastest, then y, then z.
+ * @param dims The fine grid dimensions.
+ * @param out The coarse grid dimensions returned.
+ * @param masked If non-zero, values not above zero are missing data: they
+ * are left out of the average, and a node with no data around it is -1.0.
+ * @return The coarse grid, or NULL if it cannot be allocated.
+ */
+float *_linthurber_lod_reduce(float *src, int *dims, int *out, int masked) {
+    float *dst, v;
+    double sum, wsum, w;
+    int a, b, c, i, j, x, y;
+
+    out[0] = dims[0] / 2 + 1;
+    out[1] = dims[1] / 2 + 1;
+    out[2] = dims[2];
+    dst = malloc(_linthurber_grid_len(out) * sizeof(float));
+    if (dst == NULL) return NULL;
+
+    for (c = 0; c < dims[2]; c++) {
+        for (j = 0; j < out[1]; j++) {
+            for (i = 0; i < out[0]; i++) {
+                sum = 0.0;
+                wsum = 0.0;
+                for (b = -1; b <= 1; b++) {
+                    y = 2 * j + b;
+                    if (y < 0) y = 0;
+                    if (y >= dims[1]) y = dims[1] - 1;
+                    for (a = -1; a <= 1; a++) {
+                        x = 2 * i + a;
+                        if (x < 0) x = 0;
+                        if (x >= dims[0]) x = dims[0] - 1;
+                        v = src[LINTHURBER_NODE(dims, x, y, c)];
+                        if (masked && (v <= 0.0)) continue;
+                        w = linthurber_lod_weight[a + 1] * linthurber_lod_weight[b + 1];
+                        sum += w * v;
+                        wsum += w;
+                    }
+                }
+                dst[LINTHURBER_NODE(out, i, j, c)] = (wsum > 0.0) ? sum / wsum : -1.0;
+            }
+        }
+    }
+    _linthurber_pad_grid(dst, out);
+    return dst;
+}
+
+/**
+ * Builds the pyramid of a grid, stopping early once a level is down to two
+ * nodes along x or y.
+ *
+ * @return SUCCESS, or FAIL if a level cannot be allocated.
+ */
+int _linthurber_lod_pyramid(linthurber_pyramid_t *pyr, float *grid, int *dims, int levels,
+                            int masked) {
+    int l;
+
+    pyr->buf[0] = grid;
+    memcpy(pyr->dims[0], dims, sizeof(pyr->dims[0]));
+    pyr->levels = 1;
+
+    for (l = 1; l < levels; l++) {
+        if ((pyr->dims[l-1][0] < 3) || (pyr->dims[l-1][1] < 3)) break;
+        pyr->buf[l] = _linthurber_lod_reduce(pyr->buf[l-1], pyr->dims[l-1], pyr->dims[l], masked);
+        if (pyr->buf[l] == NULL) return FAIL;
+        pyr->levels++;
+    }
+    return SUCCESS;
+}
+
+/**
+ * Creates the view of a model on the given level of each grid.
+ *
+ * @param state The full resolution state.
+ * @param level The vp, vs and dem levels.
+ * @param resolution The smallest target resolution the view is used for.
+ * @return The view, or NULL if it cannot be allocated.
+ */
+linthurber_state_t *_linthurber_lod_view(linthurber_state_t *state, int *level, double resolution) {
+    linthurber_model_t *full = state->model;
+    linthurber_configuration_t *config;
+    linthurber_model_t *model;
+    linthurber_state_t *view;
+
+    config = malloc(sizeof(linthurber_configuration_t));
+    model = calloc(1, sizeof(linthurber_model_t));
+    if ((config == NULL) || (model == NULL)) {
+        free(config);
+        free(model);
+        return NULL;
+    }
+
+    *config = *state->config;
+    config->spacing_vp *= (double)(1 << level[0]);
+    config->spacing_vs *= (double)(1 << level[1]);
+    config->spacing_dem *= (double)(1 << level[2]);
+    memcpy(config->vp_dims, full->vp_lod.dims[level[0]], sizeof(config->vp_dims));
+    memcpy(config->vs_dims, full->vs_lod.dims[level[1]], sizeof(config->vs_dims));
+    memcpy(config->dem_dims, full->dem_lod.dims[level[2]], sizeof(config->dem_dims));
+    config->specialized = 0;
+    /* The region and grid extents stay those of full resolution */
+    config->lod_full = state->config;
+
+    /* The buffers belong to the full resolution model */
+    model->vp = full->vp_lod.buf[level[0]];
+    model->vs = full->vs_lod.buf[level[1]];
+    model->dem = full->dem_lod.buf[level[2]];
+    model->vp_status = 3;
+    model->vs_status = 3;
+    model->dem_status = 3;
+    _linthurber_model_lengths(config, model);
+    model->isa = full->isa;
+    _linthurber_kernel_select(config, model);
+
+    view = _linthurber_state_new(config, model);
+    if (view == NULL) {
+        free(config);
+        free(model);
+        return NULL;
+    }
+    view->lod_resolution = resolution;
+    return view;
+}
+
+/**
+ * Builds the pyramids of a loaded state and its coarser views, one per
+ * target resolution at which a grid moves to a coarser level.
+ *
+ * @param state The state, not yet published.
+ * @return SUCCESS or FAIL.
+ */
+int _linthurber_lod_build(linthurber_state_t *state) {
+    linthurber_configuration_t *config = state->config;
+    linthurber_model_t *model = state->model;
+    linthurber_pyramid_t *pyr[3] = { &model->vp_lod, &model->vs_lod, &model->dem_lod };
+    double spacing[3] = { config->spacing_vp, config->spacing_vs, config->spacing_dem };
+    double next, step;
+    int level[3] = { 0, 0, 0 };
+    int levels = config->lod_levels;
+    int g;
+
+    if (levels < 1) levels = 1;
+    if (levels > LINTHURBER_MAX_LOD) levels = LINTHURBER_MAX_LOD;
+
+    if ((_linthurber_lod_pyramid(&model->vp_lod, model->vp, config->vp_dims, levels, 1) != SUCCESS) ||
+        (_linthurber_lod_pyramid(&model->vs_lod, model->vs, config->vs_dims, levels, 1) != SUCCESS) ||
+        (_linthurber_lod_pyramid(&model->dem_lod, model->dem, config->dem_dims, levels, 0) != SUCCESS)) {
+        _linthurber_lod_free(state);
+        return FAIL;
+    }
+
+    state->lod = calloc(3 * LINTHURBER_MAX_LOD, sizeof(linthurber_state_t *));
+    if (state->lod == NULL) {
+        _linthurber_lod_free(state);
+        return FAIL;
+    }
+
+    while (1) {
+        /* The next resolution at which some grid can go one level coarser */
+        next = -1.0;
+        for (g = 0; g < 3; g++) {
+            if (level[g] + 1 >= pyr[g]->levels) continue;
+            step = spacing[g] * (double)(1 << (level[g] + 1));
+            if ((next < 0.0) || (step < next)) next = step;
+        }
+        if (next < 0.0) break;
+
+        for (g = 0; g < 3; g++) {
+            if ((level[g] + 1 < pyr[g]->levels) &&
+                (spacing[g] * (double)(1 << (level[g] + 1)) <= next)) level[g]++;
+        }
+        state->lod[state->num_lod] = _linthurber_lod_view(state, level, next);
+        if (state->lod[state->num_lod] == NULL) {
+            _linthurber_lod_free(state);
+            return FAIL;
+        }
+        state->num_lod++;
+    }
+    return SUCCESS;
+}
+
+/**
+ * Frees the coarser views and the pyramids of a state.
+ */
+void _linthurber_lod_free(linthurber_state_t *state) {
+    linthurber_model_t *model = state->model;
+    linthurber_pyramid_t *pyr[3];
+    int g, l;
+
+    for (l = 0; l < state->num_lod; l++) {
+        _linthurber_state_free(state->lod[l]);
+    }
+    free(state->lod);
+    state->lod = NULL;
+    state->num_lod = 0;
+
+    if (model == NULL) return;
+    pyr[0] = &model->vp_lod;
+    pyr[1] = &model->vs_lod;
+    pyr[2] = &model->dem_lod;
+    for (g = 0; g < 3; g++) {
+        for (l = 1; l < pyr[g]->levels; l++) {
+            free(pyr[g]->buf[l]);
+        }
+        memset(pyr[g], 0, sizeof(linthurber_pyramid_t));
+    }
+}
+
+/**
+ * Queries the model on grids downsampled to a target resolution, for maps
+ * and meshes much coarser than the model. Each grid is read at the
+ * coarsest level of its pyramid whose spacing does not exceed the
+ * resolution, or at full resolution if the resolution is finer than the
+ * grid. Results otherwise match linthurber_query.
+ *
+ * @param points The points at which the queries will be made.
+ * @param data The data that will be returned (Vp, Vs, rho).
+ * @param numpoints The total number of points to query.
+ * @param resolution The spacing of the caller's samples in meters.
+ * @return SUCCESS or FAIL.
+ */
+int linthurber_query_lod(linthurber_point_t *points, linthurber_properties_t *data, int numpoints,
+                         double resolution) {
+    linthurber_state_t *state, *view, *prev;
+    int l, err;
+
+    if (_linthurber_state_enter(NULL) != SUCCESS) return FAIL;
+    state = _linthurber_state_view();
+    view = state;
+    for (l = 0; l < state->num_lod; l++) {
+        if (state->lod[l]->lod_resolution <= resolution) view = state->lod[l];
+    }
+
+    prev = _linthurber_state_use(view);
+    err = linthurber_query(points, data, numpoints);
+    _linthurber_state_use(prev);
+    _linthurber_state_exit();
+    return err;
+}
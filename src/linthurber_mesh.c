@@ -0,0 +1,349 @@
+/**
+ * @file linthurber_mesh.c
+ * @brief Extracts a regular mesh from the LINTHURBER model.
+ * @author - SCEC
+ * @version 1.0.1
+ *
+ * Generates raw float vp/vs/rho volumes for a regular mesh on a single node.
+ * A pool of worker threads queries the model one z-slab at a time while a
+ * dedicated writer thread stores finished slabs with pwrite(), so model
+ * evaluation overlaps with disk I/O. Buffers circulate between the workers
+ * and the writer through two bounded queues, which caps memory use at a few
+ * slabs per worker.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "linthurber_mesh.h"
+
+/** Target number of nodes per slab handed to a worker. */
+#define LINTHURBER_MESH_SLAB_NODES 65536
+
+/** A slab of planes [k0, k0 + nk) and the buffer holding its values. */
+typedef struct linthurber_slab_t {
+     int k0;
+     int nk;
+     float *buf;
+} linthurber_slab_t;
+
+/** Bounded FIFO of slabs, protected by a mutex. */
+typedef struct linthurber_slab_queue_t {
+     linthurber_slab_t *items;
+     int cap;
+     int head;
+     int count;
+     pthread_mutex_t lock;
+     pthread_cond_t cond;
+} linthurber_slab_queue_t;
+
+linthurber_mesh_t mesh;
+/** Surface nodes of the mesh, shared read-only by all workers. */
+linthurber_point_t *mesh_surface;
+size_t mesh_plane_nodes;
+int mesh_slab_planes;
+int mesh_num_slabs;
+
+/** Next slab to be claimed by a worker. */
+int mesh_next_slab = 0;
+pthread_mutex_t mesh_slab_lock = PTHREAD_MUTEX_INITIALIZER;
+
+linthurber_slab_queue_t mesh_free_queue;
+linthurber_slab_queue_t mesh_write_queue;
+
+int mesh_fd[LINTHURBER_MESH_NPROP];
+/** Set by any thread that fails, read by all; accessed atomically */
+int mesh_error = 0;
+
+/**
+ * Initializes a slab queue able to hold cap entries.
+ */
+int _slab_queue_init(linthurber_slab_queue_t *q, int cap) {
+    q->items = calloc(cap, sizeof(linthurber_slab_t));
+    if (q->items == NULL) return FAIL;
+    q->cap = cap;
+    q->head = 0;
+    q->count = 0;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->cond, NULL);
+    return SUCCESS;
+}
+
+void _slab_queue_push(linthurber_slab_queue_t *q, linthurber_slab_t *s) {
+    pthread_mutex_lock(&q->lock);
+    q->items[(q->head + q->count) % q->cap] = *s;
+    q->count++;
+    pthread_cond_signal(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+}
+
+void _slab_queue_pop(linthurber_slab_queue_t *q, linthurber_slab_t *s) {
+    pthread_mutex_lock(&q->lock);
+    while (q->count == 0) {
+        pthread_cond_wait(&q->cond, &q->lock);
+    }
+    *s = q->items[q->head];
+    q->head = (q->head + 1) % q->cap;
+    q->count--;
+    pthread_mutex_unlock(&q->lock);
+}
+
+/**
+ * Writes len bytes at offset, retrying on short writes.
+ */
+int _pwrite_all(int fd, const void *buf, size_t len, off_t offset) {
+    const char *p = buf;
+    ssize_t n;
+
+    while (len > 0) {
+        n = pwrite(fd, p, len, offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return FAIL;
+        }
+        p += n;
+        len -= n;
+        offset += n;
+    }
+    return SUCCESS;
+}
+
+/**
+ * Writer thread. Stores each finished slab at its final offset and returns
+ * the buffer to the free queue. A slab with nk == 0 ends the thread.
+ */
+void *_mesh_writer(void *arg) {
+    linthurber_slab_t slab;
+    size_t plane = mesh_plane_nodes;
+    size_t bytes;
+    off_t offset;
+    int k, p;
+
+    (void)arg;
+    while (1) {
+        _slab_queue_pop(&mesh_write_queue, &slab);
+        if (slab.nk == 0) break;
+
+        if (!__atomic_load_n(&mesh_error, __ATOMIC_RELAXED)) {
+            if (mesh.format == LINTHURBER_MESH_AWP) {
+                bytes = (size_t)slab.nk * plane * LINTHURBER_MESH_NPROP * sizeof(float);
+                offset = (off_t)slab.k0 * plane * LINTHURBER_MESH_NPROP * sizeof(float);
+                if (_pwrite_all(mesh_fd[0], slab.buf, bytes, offset) != SUCCESS) {
+                    __atomic_store_n(&mesh_error, 1, __ATOMIC_RELAXED);
+                }
+            } else {
+                for (k = 0; k < slab.nk; k++) {
+                    for (p = 0; p < LINTHURBER_MESH_NPROP; p++) {
+                        offset = (off_t)(slab.k0 + k) * plane * sizeof(float);
+                        if (_pwrite_all(mesh_fd[p],
+                                        slab.buf + ((size_t)k * LINTHURBER_MESH_NPROP + p) * plane,
+                                        plane * sizeof(float), offset) != SUCCESS) {
+                            __atomic_store_n(&mesh_error, 1, __ATOMIC_RELAXED);
+                        }
+                    }
+                }
+            }
+        }
+        _slab_queue_push(&mesh_free_queue, &slab);
+    }
+    return NULL;
+}
+
+/**
+ * Worker thread. Claims slabs in order, queries the model for every plane
+ * of the slab and hands the packed buffer to the writer.
+ */
+void *_mesh_worker(void *arg) {
+    linthurber_point_t *points;
+    linthurber_properties_t *data;
+    linthurber_slab_t slab;
+    size_t n, plane = mesh_plane_nodes;
+    int s, k;
+    double depth;
+
+    (void)arg;
+    points = malloc(plane * sizeof(linthurber_point_t));
+    data = malloc(plane * sizeof(linthurber_properties_t));
+    if ((points == NULL) || (data == NULL)) {
+        __atomic_store_n(&mesh_error, 1, __ATOMIC_RELAXED);
+        free(points);
+        free(data);
+        return NULL;
+    }
+    memcpy(points, mesh_surface, plane * sizeof(linthurber_point_t));
+
+    while (!__atomic_load_n(&mesh_error, __ATOMIC_RELAXED)) {
+        pthread_mutex_lock(&mesh_slab_lock);
+        s = mesh_next_slab++;
+        pthread_mutex_unlock(&mesh_slab_lock);
+        if (s >= mesh_num_slabs) break;
+
+        _slab_queue_pop(&mesh_free_queue, &slab);
+        slab.k0 = s * mesh_slab_planes;
+        slab.nk = mesh_slab_planes;
+        if (slab.k0 + slab.nk > mesh.dims[2]) slab.nk = mesh.dims[2] - slab.k0;
+
+        for (k = 0; k < slab.nk; k++) {
+            depth = (slab.k0 + k) * mesh.spacing;
+            for (n = 0; n < plane; n++) {
+                points[n].depth = depth;
+            }
+            linthurber_query(points, data, (int)plane);
+            linthurber_mesh_pack(&mesh, data, plane,
+                                 slab.buf + (size_t)k * plane * LINTHURBER_MESH_NPROP);
+        }
+        _slab_queue_push(&mesh_write_queue, &slab);
+    }
+
+    free(points);
+    free(data);
+    return NULL;
+}
+
+/**
+ * Opens and preallocates the output files.
+ */
+int _mesh_open_output(char *prefix) {
+    const char *ext[LINTHURBER_MESH_NPROP] = { "vp", "vs", "rho" };
+    char filename[1024];
+    off_t size;
+    int p, nfiles;
+
+    nfiles = (mesh.format == LINTHURBER_MESH_AWP) ? 1 : LINTHURBER_MESH_NPROP;
+    size = (off_t)mesh_plane_nodes * mesh.dims[2] * sizeof(float) *
+           ((mesh.format == LINTHURBER_MESH_AWP) ? LINTHURBER_MESH_NPROP : 1);
+
+    for (p = 0; p < nfiles; p++) {
+        if (mesh.format == LINTHURBER_MESH_AWP) {
+            snprintf(filename, sizeof(filename), "%s", prefix);
+        } else {
+            snprintf(filename, sizeof(filename), "%s.%s", prefix, ext[p]);
+        }
+        mesh_fd[p] = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (mesh_fd[p] < 0) {
+            fprintf(stderr, "Failed to open output file %s\n", filename);
+            return FAIL;
+        }
+        if (ftruncate(mesh_fd[p], size) != 0) {
+            fprintf(stderr, "Failed to size output file %s\n", filename);
+            return FAIL;
+        }
+    }
+    return SUCCESS;
+}
+
+/**
+ * Extracts the mesh described on the command line.
+ *
+ * @param argc The number of arguments.
+ * @param argv The argument strings.
+ * @return Zero on success.
+ */
+int main(int argc, char **argv) {
+    char *dir, *label, *prefix;
+    int nthreads, nbufs, i, p;
+    pthread_t *workers, writer;
+    linthurber_slab_t slab;
+    struct timeval t0, t1;
+    double secs, bytes;
+
+    if (linthurber_mesh_parse_args(argc, argv, &mesh, &dir, &label, &prefix, &nthreads) != SUCCESS) {
+        linthurber_mesh_usage(argv[0]);
+        return 1;
+    }
+
+    mesh_plane_nodes = (size_t)mesh.dims[0] * mesh.dims[1];
+    mesh_slab_planes = (int)(LINTHURBER_MESH_SLAB_NODES / mesh_plane_nodes);
+    if (mesh_slab_planes < 1) mesh_slab_planes = 1;
+    if (mesh_slab_planes > mesh.dims[2]) mesh_slab_planes = mesh.dims[2];
+    mesh_num_slabs = (mesh.dims[2] + mesh_slab_planes - 1) / mesh_slab_planes;
+
+    if (linthurber_init(dir, label) != SUCCESS) {
+        fprintf(stderr, "Failed to initialize the model\n");
+        return 1;
+    }
+    /* The slab workers already use every thread; query each slab inline */
+    linthurber_set_num_threads(1);
+
+    mesh_surface = malloc(mesh_plane_nodes * sizeof(linthurber_point_t));
+    if (mesh_surface == NULL) {
+        fprintf(stderr, "Failed to allocate mesh surface\n");
+        return 1;
+    }
+    linthurber_mesh_surface(&mesh, 0, 0, mesh.dims[0], mesh.dims[1], mesh_surface);
+
+    if (_mesh_open_output(prefix) != SUCCESS) return 1;
+
+    /* Two buffers per worker keep every worker busy while the writer drains */
+    nbufs = 2 * nthreads;
+    if ((_slab_queue_init(&mesh_free_queue, nbufs) != SUCCESS) ||
+        (_slab_queue_init(&mesh_write_queue, nbufs + 1) != SUCCESS)) {
+        fprintf(stderr, "Failed to allocate slab queues\n");
+        return 1;
+    }
+    for (i = 0; i < nbufs; i++) {
+        slab.k0 = 0;
+        slab.nk = 0;
+        slab.buf = malloc((size_t)mesh_slab_planes * mesh_plane_nodes *
+                          LINTHURBER_MESH_NPROP * sizeof(float));
+        if (slab.buf == NULL) {
+            fprintf(stderr, "Failed to allocate slab buffers\n");
+            return 1;
+        }
+        _slab_queue_push(&mesh_free_queue, &slab);
+    }
+
+    gettimeofday(&t0, NULL);
+
+    workers = malloc(nthreads * sizeof(pthread_t));
+    pthread_create(&writer, NULL, _mesh_writer, NULL);
+    for (i = 0; i < nthreads; i++) {
+        pthread_create(&workers[i], NULL, _mesh_worker, NULL);
+    }
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(workers[i], NULL);
+    }
+
+    /* Tell the writer to stop once the queued slabs are written */
+    slab.k0 = 0;
+    slab.nk = 0;
+    slab.buf = NULL;
+    _slab_queue_push(&mesh_write_queue, &slab);
+    pthread_join(writer, NULL);
+
+    for (p = 0; p < LINTHURBER_MESH_NPROP; p++) {
+        if ((p == 0) || (mesh.format == LINTHURBER_MESH_SPLIT)) {
+            if (fsync(mesh_fd[p]) != 0) __atomic_store_n(&mesh_error, 1, __ATOMIC_RELAXED);
+            close(mesh_fd[p]);
+        }
+    }
+
+    gettimeofday(&t1, NULL);
+    secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) / 1.0e6;
+    bytes = (double)mesh_plane_nodes * mesh.dims[2] * LINTHURBER_MESH_NPROP * sizeof(float);
+
+    while (mesh_free_queue.count > 0) {
+        _slab_queue_pop(&mesh_free_queue, &slab);
+        free(slab.buf);
+    }
+    free(workers);
+    free(mesh_surface);
+    linthurber_finalize();
+
+    if (__atomic_load_n(&mesh_error, __ATOMIC_RELAXED)) {
+        fprintf(stderr, "Failed to generate mesh %s\n", prefix);
+        return 1;
+    }
+
+    printf("Wrote %d x %d x %d nodes (%.1f MB) in %.2f s, %.1f MB/s with %d threads\n",
+           mesh.dims[0], mesh.dims[1], mesh.dims[2], bytes / 1.0e6, secs,
+           bytes / 1.0e6 / secs, nthreads);
+    return 0;
+}
@@ -0,0 +1,55 @@
+/**
+ * @file linthurber_mesh.h
+ * @brief Mesh geometry shared by the LINTHURBER mesh extraction tools.
+ * @author - SCEC
+ * @version 1.0.1
+ *
+ * A mesh is a regular grid of nx * ny * nz nodes with uniform spacing,
+ * anchored at a geographic origin, its x axis optionally rotated clockwise
+ * from east. Node (i, j, k) lies i*h metres along the mesh x axis, j*h metres
+ * along the mesh y axis and k*h metres below the free surface. Values are
+ * written x fastest, then y, then z, as raw native-endian floats.
+ *
+ */
+
+#ifndef LINTHURBER_MESH_H
+#define LINTHURBER_MESH_H
+
+#include "linthurber.h"
+
+/* Output formats */
+/** One file, vp/vs/rho interleaved per node (AWP-ODC style) */
+#define LINTHURBER_MESH_AWP 0
+/** Three files, <prefix>.vp, <prefix>.vs and <prefix>.rho */
+#define LINTHURBER_MESH_SPLIT 1
+
+/** Number of properties written per node */
+#define LINTHURBER_MESH_NPROP 3
+
+/** Defines the extent and layout of an output mesh. */
+typedef struct linthurber_mesh_t {
+     /** Longitude and latitude of node (0, 0) */
+     double origin[2];
+     /** Clockwise rotation of the mesh x axis from east, in degrees */
+     double rotation;
+     /** Node spacing in meters, identical in all three directions */
+     double spacing;
+     /** Number of nodes along x, y and z */
+     int dims[3];
+     /** LINTHURBER_MESH_AWP or LINTHURBER_MESH_SPLIT */
+     int format;
+} linthurber_mesh_t;
+
+/** Parses the common mesh command line options. */
+int linthurber_mesh_parse_args(int argc, char **argv, linthurber_mesh_t *mesh,
+                               char **dir, char **label, char **prefix, int *nthreads);
+/** Prints the common mesh command line usage. */
+void linthurber_mesh_usage(const char *prog);
+/** Computes the geographic position of every surface node of the mesh. */
+int linthurber_mesh_surface(linthurber_mesh_t *mesh, int x0, int y0, int nx, int ny,
+                            linthurber_point_t *points);
+/** Packs queried properties into the on-disk float layout. */
+void linthurber_mesh_pack(linthurber_mesh_t *mesh, linthurber_properties_t *data,
+                          size_t count, float *buf);
+
+#endif
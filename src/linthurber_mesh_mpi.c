@@ -0,0 +1,207 @@
+/**
+ * @file linthurber_mesh_mpi.c
+ * @brief Extracts a regular mesh from the LINTHURBER model with MPI.
+ * @author - SCEC
+ * @version 1.0.1
+ *
+ * The output volume is decomposed into a 3D grid of blocks, one per rank.
+ * Each rank queries only the nodes of its own block and all ranks store
+ * their blocks into a single shared file per output with an MPI-IO
+ * collective write through a subarray file view. The model is read once by
+ * rank 0 and shared between the ranks of each node. Takes the same options as
+ * linthurber_mesh, except for -t.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+
+#include "linthurber_mesh.h"
+#include "linthurber_mpi.h"
+
+/**
+ * Splits n nodes over p parts and returns the extent of part r.
+ */
+void _block_range(int n, int p, int r, int *start, int *count) {
+    int base = n / p, rem = n % p;
+
+    *count = base + ((r < rem) ? 1 : 0);
+    *start = r * base + ((r < rem) ? r : rem);
+}
+
+/**
+ * Collectively writes one block buffer into its place in the global volume.
+ */
+int _write_block(MPI_Comm comm, char *filename, int gsizes[3], int lsizes[3], int starts[3],
+                 MPI_Datatype etype, void *buf, int count) {
+    MPI_File fh;
+    MPI_Datatype filetype;
+    MPI_Status status;
+    int err;
+
+    MPI_Type_create_subarray(3, gsizes, lsizes, starts, MPI_ORDER_C, etype, &filetype);
+    MPI_Type_commit(&filetype);
+
+    err = MPI_File_open(comm, filename, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh);
+    if (err != MPI_SUCCESS) {
+        MPI_Type_free(&filetype);
+        return FAIL;
+    }
+    /* Drop any stale contents from a previous run */
+    MPI_File_set_size(fh, 0);
+    MPI_File_set_view(fh, 0, etype, filetype, "native", MPI_INFO_NULL);
+    err = MPI_File_write_all(fh, buf, count, etype, &status);
+    MPI_File_close(&fh);
+    MPI_Type_free(&filetype);
+
+    return (err == MPI_SUCCESS) ? SUCCESS : FAIL;
+}
+
+/**
+ * Extracts the mesh described on the command line.
+ *
+ * @param argc The number of arguments.
+ * @param argv The argument strings.
+ * @return Zero on success.
+ */
+int main(int argc, char **argv) {
+    const char *ext[LINTHURBER_MESH_NPROP] = { "vp", "vs", "rho" };
+    linthurber_mesh_t mesh;
+    char *dir, *label, *prefix;
+    char filename[1024];
+    int rank, nprocs, pdims[3] = { 0, 0, 0 }, periods[3] = { 0, 0, 0 }, coords[3];
+    int gsizes[3], lsizes[3], starts[3];
+    int k, p, err = 0, allerr;
+    size_t n, plane, block;
+    MPI_Comm cart;
+    MPI_Datatype node_type;
+    linthurber_point_t *surface, *points;
+    linthurber_properties_t *data;
+    float *buf, *tmp = NULL;
+    double t0, t1, t2, tq, tw, tmax[2], tloc[2];
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &nprocs);
+
+    if (linthurber_mesh_parse_args(argc, argv, &mesh, &dir, &label, &prefix, NULL) != SUCCESS) {
+        if (rank == 0) linthurber_mesh_usage(argv[0]);
+        MPI_Finalize();
+        return 1;
+    }
+
+    /* Decompose z, y, x (slowest to fastest) over a cartesian grid of ranks */
+    gsizes[0] = mesh.dims[2];
+    gsizes[1] = mesh.dims[1];
+    gsizes[2] = mesh.dims[0];
+    MPI_Dims_create(nprocs, 3, pdims);
+    MPI_Cart_create(MPI_COMM_WORLD, 3, pdims, periods, 1, &cart);
+    MPI_Comm_rank(cart, &rank);
+    MPI_Cart_coords(cart, rank, 3, coords);
+    for (k = 0; k < 3; k++) {
+        if (gsizes[k] < pdims[k]) {
+            if (rank == 0) fprintf(stderr, "Mesh is too small for %d ranks\n", nprocs);
+            MPI_Finalize();
+            return 1;
+        }
+        _block_range(gsizes[k], pdims[k], coords[k], &starts[k], &lsizes[k]);
+    }
+
+    /* Rank 0 reads the model, ranks on a node share one copy of it */
+    if (linthurber_init_mpi(cart, dir, label, 1) != SUCCESS) {
+        fprintf(stderr, "Rank %d failed to initialize the model\n", rank);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    /* One rank per core already; keep each rank's queries on its own thread */
+    linthurber_set_num_threads(1);
+
+    plane = (size_t)lsizes[1] * lsizes[2];
+    block = plane * lsizes[0];
+    surface = malloc(plane * sizeof(linthurber_point_t));
+    points = malloc(plane * sizeof(linthurber_point_t));
+    data = malloc(plane * sizeof(linthurber_properties_t));
+    buf = malloc(block * LINTHURBER_MESH_NPROP * sizeof(float));
+    if (mesh.format == LINTHURBER_MESH_SPLIT) {
+        tmp = malloc(plane * LINTHURBER_MESH_NPROP * sizeof(float));
+    }
+    if ((surface == NULL) || (points == NULL) || (data == NULL) || (buf == NULL) ||
+        ((mesh.format == LINTHURBER_MESH_SPLIT) && (tmp == NULL))) {
+        fprintf(stderr, "Rank %d failed to allocate its block\n", rank);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    MPI_Barrier(cart);
+    t0 = MPI_Wtime();
+
+    /* Query this rank's block one plane at a time */
+    linthurber_mesh_surface(&mesh, starts[2], starts[1], lsizes[2], lsizes[1], surface);
+    memcpy(points, surface, plane * sizeof(linthurber_point_t));
+    for (k = 0; k < lsizes[0]; k++) {
+        for (n = 0; n < plane; n++) {
+            points[n].depth = (starts[0] + k) * mesh.spacing;
+        }
+        linthurber_query(points, data, (int)plane);
+        if (mesh.format == LINTHURBER_MESH_AWP) {
+            linthurber_mesh_pack(&mesh, data, plane, buf + (size_t)k * plane * LINTHURBER_MESH_NPROP);
+        } else {
+            /* Gather each property into its own block-sized buffer */
+            linthurber_mesh_pack(&mesh, data, plane, tmp);
+            for (p = 0; p < LINTHURBER_MESH_NPROP; p++) {
+                memcpy(buf + p * block + (size_t)k * plane, tmp + p * plane, plane * sizeof(float));
+            }
+        }
+    }
+
+    t1 = MPI_Wtime();
+
+    /* Collective writes into the shared output files */
+    if (mesh.format == LINTHURBER_MESH_AWP) {
+        MPI_Type_contiguous(LINTHURBER_MESH_NPROP, MPI_FLOAT, &node_type);
+        MPI_Type_commit(&node_type);
+        snprintf(filename, sizeof(filename), "%s", prefix);
+        err = _write_block(cart, filename, gsizes, lsizes, starts, node_type, buf, (int)block);
+        MPI_Type_free(&node_type);
+    } else {
+        for (p = 0; p < LINTHURBER_MESH_NPROP; p++) {
+            snprintf(filename, sizeof(filename), "%s.%s", prefix, ext[p]);
+            if (_write_block(cart, filename, gsizes, lsizes, starts, MPI_FLOAT,
+                             buf + p * block, (int)block) != SUCCESS) {
+                err = FAIL;
+            }
+        }
+    }
+
+    t2 = MPI_Wtime();
+
+    tloc[0] = t1 - t0;
+    tloc[1] = t2 - t1;
+    MPI_Reduce(tloc, tmax, 2, MPI_DOUBLE, MPI_MAX, 0, cart);
+    MPI_Reduce(&err, &allerr, 1, MPI_INT, MPI_MAX, 0, cart);
+
+    if (rank == 0) {
+        tq = tmax[0];
+        tw = tmax[1];
+        if (allerr) {
+            fprintf(stderr, "Failed to write mesh %s\n", prefix);
+        } else {
+            printf("ranks %d grid %dx%dx%d nodes %dx%dx%d query %.3f s write %.3f s "
+                   "total %.3f s %.2f Mnodes/s\n",
+                   nprocs, pdims[2], pdims[1], pdims[0],
+                   mesh.dims[0], mesh.dims[1], mesh.dims[2], tq, tw, tq + tw,
+                   (double)mesh.dims[0] * mesh.dims[1] * mesh.dims[2] / (tq + tw) / 1.0e6);
+        }
+    }
+
+    free(surface);
+    free(points);
+    free(data);
+    free(buf);
+    free(tmp);
+    linthurber_finalize_mpi();
+
+    MPI_Comm_free(&cart);
+    MPI_Finalize();
+    return (rank == 0 && allerr) ? 1 : 0;
+}
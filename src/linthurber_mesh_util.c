@@ -0,0 +1,180 @@
+/*
+ * @file linthurber_mesh_util.c
+ * @brief Mesh geometry and argument handling shared by the mesh tools.
+ * @author - SCEC
+ * @version 1.0.1
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "linthurber_mesh.h"
+
+/** Mean earth radius in meters, used for the local flat-earth mapping. */
+#define LINTHURBER_MESH_EARTH_RADIUS 6371000.0
+
+/**
+ * Prints the command line usage shared by the mesh tools.
+ *
+ * @param prog The program name.
+ */
+void linthurber_mesh_usage(const char *prog) {
+    fprintf(stderr, "Usage: %s -d ucvm_dir -l label -o lon,lat -n nx,ny,nz -h spacing\n", prog);
+    fprintf(stderr, "          [-r rotation] [-f awp|split] [-t threads] output_prefix\n\n");
+    fprintf(stderr, "   -d  UCVM install directory holding model/<label>/data\n");
+    fprintf(stderr, "   -l  model label (linthurber)\n");
+    fprintf(stderr, "   -o  longitude,latitude of mesh node (0,0)\n");
+    fprintf(stderr, "   -n  number of nodes along x, y and z\n");
+    fprintf(stderr, "   -h  node spacing in meters\n");
+    fprintf(stderr, "   -r  clockwise rotation of the x axis from east, degrees (0)\n");
+    fprintf(stderr, "   -f  awp: one interleaved vp/vs/rho file, split: one file per property (awp)\n");
+    fprintf(stderr, "   -t  number of worker threads (number of online cpus)\n");
+}
+
+/**
+ * Parses the command line options shared by the mesh tools.
+ *
+ * @param argc The number of arguments.
+ * @param argv The argument strings.
+ * @param mesh The mesh description to fill in.
+ * @param dir The UCVM install directory.
+ * @param label The model label.
+ * @param prefix The output file prefix.
+ * @param nthreads The number of worker threads, may be NULL.
+ * @return SUCCESS or FAIL.
+ */
+int linthurber_mesh_parse_args(int argc, char **argv, linthurber_mesh_t *mesh,
+                               char **dir, char **label, char **prefix, int *nthreads) {
+    int opt;
+
+    memset(mesh, 0, sizeof(linthurber_mesh_t));
+    mesh->format = LINTHURBER_MESH_AWP;
+    *dir = NULL;
+    *label = "linthurber";
+    *prefix = NULL;
+    if (nthreads) {
+        *nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        if (*nthreads < 1) *nthreads = 1;
+    }
+
+    while ((opt = getopt(argc, argv, "d:l:o:n:h:r:f:t:")) != -1) {
+        switch (opt) {
+        case 'd':
+            *dir = optarg;
+            break;
+        case 'l':
+            *label = optarg;
+            break;
+        case 'o':
+            if (sscanf(optarg, "%lf,%lf", &mesh->origin[0], &mesh->origin[1]) != 2) return FAIL;
+            break;
+        case 'n':
+            if (sscanf(optarg, "%d,%d,%d", &mesh->dims[0], &mesh->dims[1], &mesh->dims[2]) != 3)
+                return FAIL;
+            break;
+        case 'h':
+            mesh->spacing = atof(optarg);
+            break;
+        case 'r':
+            mesh->rotation = atof(optarg);
+            break;
+        case 'f':
+            if (strcmp(optarg, "awp") == 0) {
+                mesh->format = LINTHURBER_MESH_AWP;
+            } else if (strcmp(optarg, "split") == 0) {
+                mesh->format = LINTHURBER_MESH_SPLIT;
+            } else {
+                return FAIL;
+            }
+            break;
+        case 't':
+            if (nthreads == NULL) return FAIL;
+            *nthreads = atoi(optarg);
+            break;
+        default:
+            return FAIL;
+        }
+    }
+
+    if (optind != argc - 1) return FAIL;
+    *prefix = argv[optind];
+
+    if ((*dir == NULL) || (mesh->spacing <= 0.0) ||
+        (mesh->dims[0] <= 0) || (mesh->dims[1] <= 0) || (mesh->dims[2] <= 0) ||
+        (nthreads && (*nthreads <= 0))) {
+        return FAIL;
+    }
+    return SUCCESS;
+}
+
+/**
+ * Computes the geographic position of a rectangular block of surface nodes.
+ * Nodes are placed on a local flat-earth (equirectangular) plane tangent at
+ * the mesh origin, which is adequate for the regional extent of the model.
+ *
+ * @param mesh The mesh description.
+ * @param x0 The first node index along x.
+ * @param y0 The first node index along y.
+ * @param nx The number of nodes along x.
+ * @param ny The number of nodes along y.
+ * @param points The nx * ny points to fill in, x fastest. Depth is set to 0.
+ * @return SUCCESS
+ */
+int linthurber_mesh_surface(linthurber_mesh_t *mesh, int x0, int y0, int nx, int ny,
+                            linthurber_point_t *points) {
+    int i, j;
+    double theta = mesh->rotation * M_PI / 180.0;
+    double ct = cos(theta), st = sin(theta);
+    double lat_scale = 180.0 / (M_PI * LINTHURBER_MESH_EARTH_RADIUS);
+    double lon_scale = lat_scale / cos(mesh->origin[1] * M_PI / 180.0);
+    double x, y, east, north;
+    linthurber_point_t *pt = points;
+
+    for (j = 0; j < ny; j++) {
+        y = (y0 + j) * mesh->spacing;
+        for (i = 0; i < nx; i++) {
+            x = (x0 + i) * mesh->spacing;
+            /* Rotate clockwise from east */
+            east = x * ct + y * st;
+            north = -x * st + y * ct;
+            pt->longitude = mesh->origin[0] + east * lon_scale;
+            pt->latitude = mesh->origin[1] + north * lat_scale;
+            pt->depth = 0.0;
+            pt++;
+        }
+    }
+    return SUCCESS;
+}
+
+/**
+ * Packs queried material properties into the on-disk layout: interleaved
+ * vp/vs/rho triplets for LINTHURBER_MESH_AWP, or three consecutive planes of
+ * count values each for LINTHURBER_MESH_SPLIT.
+ *
+ * @param mesh The mesh description.
+ * @param data The queried properties.
+ * @param count The number of nodes in data.
+ * @param buf The float buffer of LINTHURBER_MESH_NPROP * count values.
+ */
+void linthurber_mesh_pack(linthurber_mesh_t *mesh, linthurber_properties_t *data,
+                          size_t count, float *buf) {
+    size_t n;
+
+    if (mesh->format == LINTHURBER_MESH_AWP) {
+        for (n = 0; n < count; n++) {
+            buf[3*n] = (float)data[n].vp;
+            buf[3*n + 1] = (float)data[n].vs;
+            buf[3*n + 2] = (float)data[n].rho;
+        }
+    } else {
+        for (n = 0; n < count; n++) {
+            buf[n] = (float)data[n].vp;
+            buf[count + n] = (float)data[n].vs;
+            buf[2*count + n] = (float)data[n].rho;
+        }
+    }
+}
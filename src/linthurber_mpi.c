@@ -0,0 +1,204 @@
+/*
+ * @file linthurber_mpi.c
+ * @brief MPI-aware initialization for the LINTHURBER cvm library.
+ * @author - SCEC
+ * @version 1.0.1
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "linthurber_mpi.h"
+
+/** Largest number of floats moved by a single broadcast. */
+#define LINTHURBER_MPI_CHUNK (1 << 28)
+
+extern FILE *stderrfp;
+extern int linthurber_ucvm_debug;
+extern __thread linthurber_configuration_t *linthurber_configuration;
+extern __thread linthurber_model_t *linthurber_velocity_model;
+
+/** Shared window holding the node's copy of the model, if any. */
+MPI_Win linthurber_mpi_win = MPI_WIN_NULL;
+
+/**
+ * Broadcasts len floats, in chunks small enough for an int count.
+ */
+int _linthurber_bcast_floats(float *buf, size_t len, int root, MPI_Comm comm) {
+    size_t off, n;
+
+    for (off = 0; off < len; off += n) {
+        n = len - off;
+        if (n > LINTHURBER_MPI_CHUNK) n = LINTHURBER_MPI_CHUNK;
+        if (MPI_Bcast(buf + off, (int)n, MPI_FLOAT, root, comm) != MPI_SUCCESS) return FAIL;
+    }
+    return SUCCESS;
+}
+
+/**
+ * Places the model in one shared window per node. Rank 0 of comm copies its
+ * private arrays into its node's window, the window is broadcast between the
+ * node leaders and every other rank maps its leader's window.
+ */
+int _linthurber_share_model(MPI_Comm comm, linthurber_model_t *model) {
+    MPI_Comm node, leaders;
+    MPI_Aint size;
+    int rank, node_rank, disp, err = SUCCESS;
+    size_t total = model->vp_len + model->vs_len + model->dem_len;
+    float *base;
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &node);
+    MPI_Comm_rank(node, &node_rank);
+    /* Rank 0 is always the lowest rank, and therefore the leader, of its node */
+    MPI_Comm_split(comm, (node_rank == 0) ? 0 : MPI_UNDEFINED, rank, &leaders);
+
+    size = (node_rank == 0) ? (MPI_Aint)(total * sizeof(float)) : 0;
+    MPI_Win_allocate_shared(size, sizeof(float), MPI_INFO_NULL, node, &base, &linthurber_mpi_win);
+    if (node_rank != 0) {
+        MPI_Win_shared_query(linthurber_mpi_win, 0, &size, &disp, &base);
+    }
+
+    MPI_Win_fence(0, linthurber_mpi_win);
+    if (node_rank == 0) {
+        if (rank == 0) {
+            memcpy(base, model->vp, model->vp_len * sizeof(float));
+            memcpy(base + model->vp_len, model->vs, model->vs_len * sizeof(float));
+            memcpy(base + model->vp_len + model->vs_len, model->dem, model->dem_len * sizeof(float));
+            free(model->vp);
+            free(model->vs);
+            free(model->dem);
+        }
+        err = _linthurber_bcast_floats(base, total, 0, leaders);
+        MPI_Comm_free(&leaders);
+    }
+    MPI_Win_fence(0, linthurber_mpi_win);
+    MPI_Comm_free(&node);
+
+    model->vp = base;
+    model->vs = base + model->vp_len;
+    model->dem = base + model->vp_len + model->vs_len;
+    model->vp_status = 3;
+    model->vs_status = 3;
+    model->dem_status = 3;
+    return err;
+}
+
+/**
+ * Frees what a failed linthurber_init_mpi loaded, the shared window
+ * included. Collective, called by every rank once they agree on the error.
+ */
+int _linthurber_mpi_abort() {
+    _linthurber_load_abort(NULL);
+    if (linthurber_mpi_win != MPI_WIN_NULL) {
+        MPI_Win_free(&linthurber_mpi_win);
+    }
+    return FAIL;
+}
+
+/**
+ * Initializes the model on every rank of a communicator. Only rank 0 opens
+ * and parses the configuration and the model files; the configuration and
+ * the gridded arrays are then broadcast, so start-up cost on a shared file
+ * system does not grow with the number of ranks. Collective over comm.
+ *
+ * @param comm The communicator of the ranks that will query the model.
+ * @param dir The directory in which UCVM has been installed.
+ * @param label A unique identifier for the velocity model.
+ * @param shared If non-zero, ranks on the same node share one copy of the
+ * arrays through an MPI shared memory window instead of holding their own.
+ * @return Success or failure, identical on every rank.
+ */
+int linthurber_init_mpi(MPI_Comm comm, const char *dir, const char *label, int shared) {
+    linthurber_model_t *model;
+    char configbuf[512];
+    int rank, err = SUCCESS;
+
+    MPI_Comm_rank(comm, &rank);
+
+    /* Only rank 0 keeps a debug log */
+    if (rank != 0) linthurber_ucvm_debug = 0;
+
+    _linthurber_init_state(dir, label, configbuf);
+    model = linthurber_velocity_model;
+
+    if (rank == 0) {
+        if (linthurber_read_configuration(configbuf, linthurber_configuration) != SUCCESS) {
+            err = FAIL;
+        } else if (_linthurber_data_directory(linthurber_configuration, dir, label) != SUCCESS) {
+            err = FAIL;
+        } else if (linthurber_try_reading_model(model) == FAIL) {
+            linthurber_print_error("No model file was found to read from.");
+            err = FAIL;
+        }
+    }
+    MPI_Bcast(&err, 1, MPI_INT, 0, comm);
+    if (err != SUCCESS) return _linthurber_load_abort(NULL);
+
+    /* Ranks are assumed to share one binary representation of the struct */
+    MPI_Bcast(linthurber_configuration, sizeof(linthurber_configuration_t), MPI_BYTE, 0, comm);
+    _linthurber_model_lengths(linthurber_configuration, model);
+
+    if (shared) {
+        err = _linthurber_share_model(comm, model);
+    } else {
+        if (rank != 0) {
+            model->vp = _linthurber_grid_alloc(linthurber_configuration, model->vp_len);
+            model->vs = _linthurber_grid_alloc(linthurber_configuration, model->vs_len);
+            model->dem = _linthurber_grid_alloc(linthurber_configuration, model->dem_len);
+            if ((model->vp == NULL) || (model->vs == NULL) || (model->dem == NULL)) {
+                fprintf(stderr, "Failed to allocate buffers Lin-Thurber model\n");
+                MPI_Abort(comm, 1);
+            }
+            model->vp_status = 2;
+            model->vs_status = 2;
+            model->dem_status = 2;
+        }
+        if ((_linthurber_bcast_floats(model->vp, model->vp_len, 0, comm) != SUCCESS) ||
+            (_linthurber_bcast_floats(model->vs, model->vs_len, 0, comm) != SUCCESS) ||
+            (_linthurber_bcast_floats(model->dem, model->dem_len, 0, comm) != SUCCESS)) {
+            err = FAIL;
+        }
+    }
+    /* Only the ranks in a failed broadcast see it, the node leaders when shared */
+    MPI_Allreduce(MPI_IN_PLACE, &err, 1, MPI_INT, MPI_MAX, comm);
+    if (err != SUCCESS) return _linthurber_mpi_abort();
+
+    /* The optional site map is small, every rank keeps its own copy */
+    MPI_Bcast(&model->site_status, 1, MPI_INT, 0, comm);
+    if (model->site_status == 2) {
+        MPI_Bcast(model->site_dims, 3, MPI_INT, 0, comm);
+        MPI_Bcast(&model->site_spacing, 1, MPI_DOUBLE, 0, comm);
+        model->site_len = _linthurber_grid_len(model->site_dims);
+        if (rank != 0) {
+            model->site = malloc(model->site_len * sizeof(float));
+            if (model->site == NULL) {
+                fprintf(stderr, "Failed to allocate Lin-Thurber site map\n");
+                MPI_Abort(comm, 1);
+            }
+        }
+        if (_linthurber_bcast_floats(model->site, model->site_len, 0, comm) != SUCCESS) err = FAIL;
+        MPI_Allreduce(MPI_IN_PLACE, &err, 1, MPI_INT, MPI_MAX, comm);
+        if (err != SUCCESS) return _linthurber_mpi_abort();
+    }
+
+    return _linthurber_init_done(configbuf);
+}
+
+/**
+ * Cleans up a model initialized with linthurber_init_mpi, releasing the
+ * shared window if one was created. Collective over the communicator given
+ * to linthurber_init_mpi.
+ *
+ * @return SUCCESS
+ */
+int linthurber_finalize_mpi() {
+    int err = linthurber_finalize();
+
+    if (linthurber_mpi_win != MPI_WIN_NULL) {
+        MPI_Win_free(&linthurber_mpi_win);
+    }
+    return err;
+}
@@ -0,0 +1,24 @@
+/**
+ * @file linthurber_mpi.h
+ * @brief MPI-aware initialization for the LINTHURBER cvm library.
+ * @author - SCEC
+ * @version 1.0.1
+ *
+ * Provided by liblinthurber_mpi, which is built with --enable-mpi and linked
+ * in addition to liblinthurber.
+ *
+ */
+
+#ifndef LINTHURBER_MPI_H
+#define LINTHURBER_MPI_H
+
+#include <mpi.h>
+
+#include "linthurber.h"
+
+/** Initializes the model on every rank of comm from a single read on rank 0. */
+int linthurber_init_mpi(MPI_Comm comm, const char *dir, const char *label, int shared);
+/** Cleans up a model initialized with linthurber_init_mpi. Collective. */
+int linthurber_finalize_mpi();
+
+#endif
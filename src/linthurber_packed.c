@@ -0,0 +1,86 @@
+/*
+ * @file linthurber_packed.c
+ * @brief Corner-packed storage of the LINTHURBER vp and vs grids.
+ * @author - SCEC
+ * @version 1.0.1
+ *
+ * In the node layout the eight corners of a cell lie in two layers and two
+ * rows each, so a trilinear evaluation at a scattered point touches up to
+ * four cache lines. With layout = packed in the model configuration, the
+ * vp and vs grids are also stored cell by cell: the eight corner values of
+ * every cell are kept together in one aligned 32-byte block, ordered
+ * [z][y][x] like the corners of _linthurber_getcell, and an evaluation
+ * reads a single block. This takes eight times the memory of the node grid,
+ * which is kept for the other APIs.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "linthurber.h"
+
+/**
+ * Packs the cells of a padded grid. Cell (i, j, k) spans nodes i..i+1,
+ * j..j+1 and k..k+1; those past the last node come from the padding.
+ *
+ * @param buf The padded node grid.
+ * @param dims The grid dimensions, padding excluded.
+ * @return The packed cells, or NULL if they cannot be allocated.
+ */
+float *_linthurber_pack_grid(float *buf, int *dims) {
+    size_t sy = dims[0] + 1, sz = sy * (dims[1] + 1), n;
+    float *cells, *cell, *node;
+    void *ptr;
+    int i, j, k;
+
+    if (posix_memalign(&ptr, 32, (size_t)dims[0] * dims[1] * dims[2] *
+                       LINTHURBER_CELL_SIZE * sizeof(float)) != 0) return NULL;
+    cells = ptr;
+
+    n = 0;
+    for (k = 0; k < dims[2]; k++) {
+        for (j = 0; j < dims[1]; j++) {
+            for (i = 0; i < dims[0]; i++) {
+                node = buf + LINTHURBER_NODE(dims, i, j, k);
+                cell = cells + n * LINTHURBER_CELL_SIZE;
+                cell[0] = node[0];
+                cell[1] = node[1];
+                cell[2] = node[sy];
+                cell[3] = node[sy + 1];
+                cell[4] = node[sz];
+                cell[5] = node[sz + 1];
+                cell[6] = node[sz + sy];
+                cell[7] = node[sz + sy + 1];
+                n++;
+            }
+        }
+    }
+    return cells;
+}
+
+/**
+ * Builds the corner-packed vp and vs cells of a loaded model if its
+ * configuration asks for them and interpolates trilinearly.
+ *
+ * @param config The model configuration.
+ * @param model The model, with its node grids in place.
+ * @return SUCCESS, or FAIL if the cells cannot be allocated.
+ */
+int _linthurber_pack_model(linthurber_configuration_t *config, linthurber_model_t *model) {
+    /* Only the trilinear kernel reads whole cells */
+    if ((config->layout != LINTHURBER_LAYOUT_PACKED) ||
+        (config->interpolation != LINTHURBER_INTERP_TRILINEAR)) return SUCCESS;
+
+    model->vp_cells = _linthurber_pack_grid(model->vp, config->vp_dims);
+    model->vs_cells = _linthurber_pack_grid(model->vs, config->vs_dims);
+    if ((model->vp_cells == NULL) || (model->vs_cells == NULL)) {
+        free(model->vp_cells);
+        free(model->vs_cells);
+        model->vp_cells = NULL;
+        model->vs_cells = NULL;
+        return FAIL;
+    }
+    return SUCCESS;
+}
+
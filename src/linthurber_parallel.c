@@ -0,0 +1,555 @@
+/*
+ * @file linthurber_parallel.c
+ * @brief Internal thread helpers for the LINTHURBER cvm library.
+ * @author - SCEC
+ * @version 1.0.1
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "linthurber.h"
+#include "linthurber_parallel.h"
+
+/** Requested number of threads, 0 for one per online cpu. One by default,
+    the calling thread, since UCVM and MPI tools often run a process per cpu. */
+int linthurber_num_threads = 1;
+
+/** A range of items of a group, split further by whoever runs it. */
+typedef struct linthurber_task_t {
+     linthurber_range_fn fn;
+     void *arg;
+     int begin;
+     int end;
+     int grain;
+     linthurber_group_t *group;
+} linthurber_task_t;
+
+/**
+ * Double-ended queue of tasks of one worker. The owner pushes and pops at
+ * the bottom, other workers steal the oldest, largest ranges from the top.
+ */
+typedef struct linthurber_deque_t {
+     linthurber_task_t *tasks;
+     int cap;
+     int top;
+     int count;
+     pthread_mutex_t lock;
+} linthurber_deque_t;
+
+/** Scheduler counters of one worker, padded to its own cache line. */
+typedef struct linthurber_worker_stats_t {
+     long tasks;
+     long steals;
+     double idle;
+     char pad[40];
+} linthurber_worker_stats_t;
+
+/** Persistent work-stealing pool behind the parallel and asynchronous APIs. */
+typedef struct linthurber_pool_t {
+     /** Workers asked for, each with a deque that every worker serves */
+     int nworkers;
+     /** Workers whose threads started, the first of threads */
+     int started;
+     pthread_t *threads;
+     linthurber_deque_t *deques;
+     linthurber_worker_stats_t *stats;
+     /** Time of the last counter reset; earlier idle time is not counted */
+     double reset_time;
+     /** Tasks sitting in any deque */
+     int queued;
+     /** Workers waiting for tasks */
+     int sleeping;
+     /** Deque receiving the next submitted group */
+     int next_deque;
+     /** Submitters between getting the pool and queuing on it, under linthurber_pool_lock */
+     int users;
+     int stop;
+     pthread_mutex_t lock;
+     pthread_cond_t cond;
+} linthurber_pool_t;
+
+/** Started on first use, NULL when not running. */
+linthurber_pool_t *linthurber_pool = NULL;
+pthread_mutex_t linthurber_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+/** Signaled when a pool being shut down has no users left. */
+pthread_cond_t linthurber_pool_released = PTHREAD_COND_INITIALIZER;
+
+/** Index of the pool worker running on this thread, -1 elsewhere. */
+__thread int linthurber_pool_self = -1;
+
+/** A parallel loop run on the pool by a waiting caller. */
+typedef struct linthurber_loop_t {
+     /** Completion of the loop, first so done() can cast back */
+     linthurber_group_t group;
+     int finished;
+     pthread_mutex_t lock;
+     pthread_cond_t cond;
+} linthurber_loop_t;
+
+/**
+ * Sets the number of threads used by the batch and parallel APIs. Safe
+ * while queries and submitted batches are running: the current pool
+ * finishes the work queued on it before it stops, and this call waits for
+ * that. Must not be called from a linthurber_submit callback, which runs
+ * on a pool thread.
+ *
+ * @param n The number of threads, 0 for one per online cpu. The default
+ * is 1, which runs every query on the calling thread.
+ * @return SUCCESS or FAIL.
+ */
+int linthurber_set_num_threads(int n) {
+    if (n < 0) return FAIL;
+    __atomic_store_n(&linthurber_num_threads, n, __ATOMIC_RELAXED);
+    /* The pool restarts with the new size on next use */
+    _linthurber_pool_shutdown();
+    return SUCCESS;
+}
+
+int _linthurber_num_threads() {
+    long n = __atomic_load_n(&linthurber_num_threads, __ATOMIC_RELAXED);
+
+    if (n == 0) n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n < 1) ? 1 : (int)n;
+}
+
+void _linthurber_loop_done(linthurber_group_t *group) {
+    linthurber_loop_t *loop = (linthurber_loop_t *)group;
+
+    pthread_mutex_lock(&loop->lock);
+    loop->finished = 1;
+    pthread_cond_signal(&loop->cond);
+    pthread_mutex_unlock(&loop->lock);
+}
+
+/**
+ * Runs fn over the items [0, count) on the work-stealing pool and waits
+ * for it. Workers split the loop into ranges of at most grain items and
+ * steal ranges from each other, so uneven item costs even out. Runs inline
+ * when a single thread suffices, when called from a pool worker, whose
+ * siblings are already busy with the enclosing work, and when the pool
+ * cannot be started.
+ *
+ * @param count The number of items.
+ * @param grain The largest number of items per call to fn.
+ * @param fn The function processing a range of items.
+ * @param arg The argument passed to fn.
+ * @return SUCCESS; fn has run over every item.
+ */
+int _linthurber_parallel_for(int count, int grain, linthurber_range_fn fn, void *arg) {
+    linthurber_loop_t loop;
+    int err;
+
+    if (count <= 0) return SUCCESS;
+    if (grain < 1) grain = 1;
+
+    if ((count <= grain) || (linthurber_pool_self >= 0) || (_linthurber_num_threads() <= 1)) {
+        fn(arg, 0, count);
+        return SUCCESS;
+    }
+
+    loop.group.done = _linthurber_loop_done;
+    loop.finished = 0;
+    pthread_mutex_init(&loop.lock, NULL);
+    pthread_cond_init(&loop.cond, NULL);
+
+    err = _linthurber_pool_submit(&loop.group, count, grain, fn, arg);
+    if (err == SUCCESS) {
+        pthread_mutex_lock(&loop.lock);
+        while (!loop.finished) pthread_cond_wait(&loop.cond, &loop.lock);
+        pthread_mutex_unlock(&loop.lock);
+    }
+
+    pthread_mutex_destroy(&loop.lock);
+    pthread_cond_destroy(&loop.cond);
+
+    /* Nothing was queued; the loop still runs, on the calling thread */
+    if (err != SUCCESS) fn(arg, 0, count);
+    return SUCCESS;
+}
+
+/** Returns a monotonic time in seconds. */
+double _linthurber_now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+}
+
+int _linthurber_deque_push(linthurber_deque_t *dq, linthurber_task_t *task) {
+    linthurber_task_t *tasks;
+    int i;
+
+    pthread_mutex_lock(&dq->lock);
+    if (dq->count == dq->cap) {
+        tasks = malloc(2 * dq->cap * sizeof(linthurber_task_t));
+        if (tasks == NULL) {
+            pthread_mutex_unlock(&dq->lock);
+            return FAIL;
+        }
+        for (i = 0; i < dq->count; i++) tasks[i] = dq->tasks[(dq->top + i) % dq->cap];
+        free(dq->tasks);
+        dq->tasks = tasks;
+        dq->cap *= 2;
+        dq->top = 0;
+    }
+    dq->tasks[(dq->top + dq->count) % dq->cap] = *task;
+    dq->count++;
+    pthread_mutex_unlock(&dq->lock);
+    return SUCCESS;
+}
+
+/** Takes the newest task, from the bottom. */
+int _linthurber_deque_pop(linthurber_deque_t *dq, linthurber_task_t *task) {
+    int found = 0;
+
+    pthread_mutex_lock(&dq->lock);
+    if (dq->count > 0) {
+        dq->count--;
+        *task = dq->tasks[(dq->top + dq->count) % dq->cap];
+        found = 1;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return found;
+}
+
+/** Takes the oldest task, from the top. */
+int _linthurber_deque_steal(linthurber_deque_t *dq, linthurber_task_t *task) {
+    int found = 0;
+
+    pthread_mutex_lock(&dq->lock);
+    if (dq->count > 0) {
+        *task = dq->tasks[dq->top];
+        dq->top = (dq->top + 1) % dq->cap;
+        dq->count--;
+        found = 1;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return found;
+}
+
+/**
+ * Queues a task on a deque and wakes a sleeping worker if there is one.
+ */
+int _linthurber_pool_push(linthurber_pool_t *pool, int d, linthurber_task_t *task) {
+    if (_linthurber_deque_push(&pool->deques[d], task) != SUCCESS) return FAIL;
+    __atomic_fetch_add(&pool->queued, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&pool->sleeping, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_signal(&pool->cond);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    return SUCCESS;
+}
+
+/**
+ * Finds the next task of worker self: its own newest task first, then the
+ * oldest task of another worker. Sleeps while there is none.
+ *
+ * @return 1 with a task, 0 once the pool is stopping and drained.
+ */
+int _linthurber_pool_next(linthurber_pool_t *pool, int self, linthurber_task_t *task) {
+    linthurber_worker_stats_t *stats = &pool->stats[self];
+    double t0 = 0.0;
+    int i, found, idle = 0;
+
+    while (1) {
+        found = _linthurber_deque_pop(&pool->deques[self], task);
+        for (i = 1; !found && i < pool->nworkers; i++) {
+            found = _linthurber_deque_steal(&pool->deques[(self + i) % pool->nworkers], task);
+            if (found) stats->steals++;
+        }
+        if (found) {
+            __atomic_fetch_sub(&pool->queued, 1, __ATOMIC_SEQ_CST);
+            if (idle) {
+                if (t0 < pool->reset_time) t0 = pool->reset_time;
+                stats->idle += _linthurber_now() - t0;
+            }
+            stats->tasks++;
+            return 1;
+        }
+        if (!idle) {
+            t0 = _linthurber_now();
+            idle = 1;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        __atomic_fetch_add(&pool->sleeping, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&pool->queued, __ATOMIC_SEQ_CST) == 0) {
+            if (pool->stop) {
+                __atomic_fetch_sub(&pool->sleeping, 1, __ATOMIC_SEQ_CST);
+                pthread_mutex_unlock(&pool->lock);
+                return 0;
+            }
+            pthread_cond_wait(&pool->cond, &pool->lock);
+        }
+        __atomic_fetch_sub(&pool->sleeping, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+/**
+ * Runs a task on worker self. Ranges above the grain are halved, and the
+ * upper half is left on the worker's deque for itself or for thieves.
+ */
+void _linthurber_pool_run(linthurber_pool_t *pool, int self, linthurber_task_t *task) {
+    linthurber_task_t half;
+    int n;
+
+    while (task->end - task->begin > task->grain) {
+        half = *task;
+        half.begin = task->begin + (task->end - task->begin) / 2;
+        if (_linthurber_pool_push(pool, self, &half) != SUCCESS) break;
+        task->end = half.begin;
+    }
+
+    /* The submitter keeps the group's model alive until the last item */
+    _linthurber_state_enter(task->group->state);
+    task->fn(task->arg, task->begin, task->end);
+    _linthurber_state_exit();
+    n = task->end - task->begin;
+    if (__atomic_fetch_sub(&task->group->remaining, n, __ATOMIC_ACQ_REL) == n) {
+        task->group->done(task->group);
+    }
+}
+
+/** Argument of a pool worker thread. */
+typedef struct linthurber_pool_worker_t {
+     linthurber_pool_t *pool;
+     int self;
+} linthurber_pool_worker_t;
+
+void *_linthurber_pool_worker(void *ptr) {
+    linthurber_pool_worker_t *worker = ptr;
+    linthurber_pool_t *pool = worker->pool;
+    int self = worker->self;
+    linthurber_task_t task;
+
+    free(worker);
+    linthurber_pool_self = self;
+    while (_linthurber_pool_next(pool, self, &task)) {
+        _linthurber_pool_run(pool, self, &task);
+    }
+    return NULL;
+}
+
+/**
+ * Frees a pool whose workers have stopped, or never started.
+ */
+void _linthurber_pool_free(linthurber_pool_t *pool) {
+    int i;
+
+    for (i = 0; i < pool->nworkers; i++) {
+        free(pool->deques[i].tasks);
+        pthread_mutex_destroy(&pool->deques[i].lock);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->cond);
+    free(pool->deques);
+    free(pool->stats);
+    free(pool->threads);
+    free(pool);
+}
+
+/**
+ * Returns the running pool, starting it with _linthurber_num_threads()
+ * workers on first use. Workers whose thread fails to start are left out;
+ * their deques are served by the others. The pool is not stopped until
+ * the caller hands it back with _linthurber_pool_put.
+ *
+ * @return The pool, or NULL if no worker could be started.
+ */
+linthurber_pool_t *_linthurber_pool_get() {
+    linthurber_pool_t *pool;
+    linthurber_pool_worker_t *worker;
+    int i;
+
+    pthread_mutex_lock(&linthurber_pool_lock);
+    pool = linthurber_pool;
+    if (pool == NULL) {
+        pool = calloc(1, sizeof(linthurber_pool_t));
+        if (pool == NULL) goto out;
+        pool->nworkers = _linthurber_num_threads();
+        pool->threads = calloc(pool->nworkers, sizeof(pthread_t));
+        pool->deques = calloc(pool->nworkers, sizeof(linthurber_deque_t));
+        pool->stats = calloc(pool->nworkers, sizeof(linthurber_worker_stats_t));
+        if ((pool->threads == NULL) || (pool->deques == NULL) || (pool->stats == NULL)) {
+            free(pool->threads);
+            free(pool->deques);
+            free(pool->stats);
+            free(pool);
+            pool = NULL;
+            goto out;
+        }
+        for (i = 0; i < pool->nworkers; i++) {
+            pool->deques[i].cap = 16;
+            pool->deques[i].tasks = malloc(16 * sizeof(linthurber_task_t));
+            pthread_mutex_init(&pool->deques[i].lock, NULL);
+        }
+        pthread_mutex_init(&pool->lock, NULL);
+        pthread_cond_init(&pool->cond, NULL);
+        for (i = 0; i < pool->nworkers; i++) {
+            if (pool->deques[i].tasks == NULL) {
+                fprintf(stderr, "Failed to allocate Lin-Thurber thread pool\n");
+                _linthurber_pool_free(pool);
+                pool = NULL;
+                goto out;
+            }
+        }
+        pool->reset_time = _linthurber_now();
+        for (i = 0; i < pool->nworkers; i++) {
+            worker = malloc(sizeof(linthurber_pool_worker_t));
+            if (worker == NULL) break;
+            worker->pool = pool;
+            worker->self = i;
+            if (pthread_create(&pool->threads[pool->started], NULL, _linthurber_pool_worker,
+                               worker) != 0) {
+                free(worker);
+                break;
+            }
+            pool->started++;
+        }
+        if (pool->started == 0) {
+            fprintf(stderr, "Failed to start Lin-Thurber thread pool\n");
+            _linthurber_pool_free(pool);
+            pool = NULL;
+            goto out;
+        }
+        linthurber_pool = pool;
+    }
+    pool->users++;
+out:
+    pthread_mutex_unlock(&linthurber_pool_lock);
+    return pool;
+}
+
+/**
+ * Hands back a pool returned by _linthurber_pool_get, once the caller's
+ * work is queued on it.
+ */
+void _linthurber_pool_put(linthurber_pool_t *pool) {
+    pthread_mutex_lock(&linthurber_pool_lock);
+    if (--pool->users == 0) pthread_cond_broadcast(&linthurber_pool_released);
+    pthread_mutex_unlock(&linthurber_pool_lock);
+}
+
+/**
+ * Queues the items [0, count) of a group on the pool. The group's done
+ * callback runs on the worker that completes the last item. Items are
+ * evaluated on the caller's model, which must stay alive until then.
+ *
+ * @param group The group, with done set; remaining is set here.
+ * @param count The number of items.
+ * @param grain The largest number of items per call to fn.
+ * @param fn The function processing a range of items.
+ * @param arg The argument passed to fn.
+ * @return SUCCESS or FAIL.
+ */
+int _linthurber_pool_submit(linthurber_group_t *group, int count, int grain,
+                            linthurber_range_fn fn, void *arg) {
+    linthurber_pool_t *pool;
+    linthurber_task_t task;
+    int d, err;
+
+    group->remaining = count;
+    group->state = _linthurber_state_view();
+    if (count <= 0) {
+        group->done(group);
+        return SUCCESS;
+    }
+
+    pool = _linthurber_pool_get();
+    if (pool == NULL) return FAIL;
+
+    task.fn = fn;
+    task.arg = arg;
+    task.begin = 0;
+    task.end = count;
+    task.grain = (grain < 1) ? 1 : grain;
+    task.group = group;
+    d = __atomic_fetch_add(&pool->next_deque, 1, __ATOMIC_RELAXED) % pool->nworkers;
+    err = _linthurber_pool_push(pool, d, &task);
+    _linthurber_pool_put(pool);
+    return err;
+}
+
+/**
+ * Stops the pool once all queued work is done and joins its workers. New
+ * work goes to a new pool meanwhile, and work still being queued on this
+ * one is waited for. Must not be called from a pool thread.
+ */
+void _linthurber_pool_shutdown() {
+    linthurber_pool_t *pool;
+    int i;
+
+    pthread_mutex_lock(&linthurber_pool_lock);
+    pool = linthurber_pool;
+    linthurber_pool = NULL;
+    while ((pool != NULL) && (pool->users > 0)) {
+        pthread_cond_wait(&linthurber_pool_released, &linthurber_pool_lock);
+    }
+    pthread_mutex_unlock(&linthurber_pool_lock);
+    if (pool == NULL) return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+    for (i = 0; i < pool->started; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    _linthurber_pool_free(pool);
+}
+
+/**
+ * Returns the scheduler counters of the thread pool, summed over its
+ * workers since it started or since the last reset. Zero while no pool
+ * is running. Counters are updated without locks, so readings taken while
+ * work is running are approximate.
+ *
+ * @param stats The counters returned.
+ * @return SUCCESS
+ */
+int linthurber_get_sched_stats(linthurber_sched_stats_t *stats) {
+    linthurber_pool_t *pool;
+    int i;
+
+    stats->threads = 0;
+    stats->tasks = 0;
+    stats->steals = 0;
+    stats->idle_time = 0.0;
+
+    pthread_mutex_lock(&linthurber_pool_lock);
+    pool = linthurber_pool;
+    if (pool) {
+        stats->threads = pool->started;
+        for (i = 0; i < pool->nworkers; i++) {
+            stats->tasks += pool->stats[i].tasks;
+            stats->steals += pool->stats[i].steals;
+            stats->idle_time += pool->stats[i].idle;
+        }
+    }
+    pthread_mutex_unlock(&linthurber_pool_lock);
+    return SUCCESS;
+}
+
+/**
+ * Clears the scheduler counters of the thread pool.
+ *
+ * @return SUCCESS
+ */
+int linthurber_reset_sched_stats() {
+    pthread_mutex_lock(&linthurber_pool_lock);
+    if (linthurber_pool) {
+        memset(linthurber_pool->stats, 0, linthurber_pool->nworkers * sizeof(linthurber_worker_stats_t));
+        linthurber_pool->reset_time = _linthurber_now();
+    }
+    pthread_mutex_unlock(&linthurber_pool_lock);
+    return SUCCESS;
+}
@@ -0,0 +1,38 @@
+/**
+ * @file linthurber_parallel.h
+ * @brief Internal thread helpers for the LINTHURBER cvm library.
+ * @author - SCEC
+ * @version 1.0.1
+ *
+ */
+
+#ifndef LINTHURBER_PARALLEL_H
+#define LINTHURBER_PARALLEL_H
+
+#include "linthurber.h"
+
+/** Processes items [begin, end) of a parallel loop. */
+typedef void (*linthurber_range_fn)(void *arg, int begin, int end);
+
+/** A set of items processed on the pool, completed as a whole. */
+typedef struct linthurber_group_t {
+     /** Items not yet processed */
+     int remaining;
+     /** Called on the thread that processes the last item */
+     void (*done)(struct linthurber_group_t *group);
+     /** The model the items are evaluated on, that of the submitter */
+     linthurber_state_t *state;
+} linthurber_group_t;
+
+/** Returns the number of threads used by the parallel APIs. */
+int _linthurber_num_threads();
+/** Runs fn over [0, count) in chunks of at most grain items on several threads. */
+int _linthurber_parallel_for(int count, int grain, linthurber_range_fn fn, void *arg);
+
+/** Queues the items [0, count) of a group on the work-stealing pool. */
+int _linthurber_pool_submit(linthurber_group_t *group, int count, int grain,
+                            linthurber_range_fn fn, void *arg);
+/** Stops the pool after the queued work and joins its threads. */
+void _linthurber_pool_shutdown();
+
+#endif
@@ -0,0 +1,274 @@
+/*
+ * @file linthurber_ray.c
+ * @brief Travel times along ray paths through the LINTHURBER model.
+ * @author - SCEC
+ * @version 1.0.1
+ *
+ * Each ray segment is a straight line in model x/y and depth below mean sea
+ * level. The segment is walked cell by cell (3D DDA) through the velocity
+ * grid: x/y cell faces are crossed at integer grid indices and z faces at
+ * the depths_msl layers. Inside a cell the trilinear field is a smooth
+ * polynomial along the segment, so slowness is integrated there with a
+ * fixed Gauss-Legendre rule using the cell's eight corners fetched once.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "ucvm_utils.h"
+
+#include "linthurber.h"
+#include "linthurber_parallel.h"
+
+/** Number of Gauss-Legendre nodes per cell */
+#define LINTHURBER_RAY_GAUSS 4
+
+/** Rays handed to a thread at a time by the batch API */
+#define LINTHURBER_RAY_GRAIN 16
+
+extern __thread linthurber_configuration_t *linthurber_configuration;
+
+/* Gauss-Legendre nodes and weights on [-1, 1] */
+const double linthurber_gauss_x[LINTHURBER_RAY_GAUSS] =
+    { -0.861136311594053, -0.339981043584856, 0.339981043584856, 0.861136311594053 };
+const double linthurber_gauss_w[LINTHURBER_RAY_GAUSS] =
+    { 0.347854845137454, 0.652145154862546, 0.652145154862546, 0.347854845137454 };
+
+/** A ray endpoint in grid index and depth space. */
+typedef struct linthurber_ray_node_t {
+     /** Fractional x and y grid indices */
+     double i;
+     double j;
+     /** Depth below mean sea level in kilometers */
+     double depth_msl;
+     /** Model x and y in meters */
+     double x;
+     double y;
+} linthurber_ray_node_t;
+
+/**
+ * Projects a point and converts its depth below the surface to a depth below
+ * mean sea level, as linthurber_query does.
+ */
+int _linthurber_ray_node(linthurber_configuration_t *config, linthurber_point_t *pt,
+                         double spacing, linthurber_ray_node_t *node) {
+    ucvm_point_t geo, xy;
+    double elev = 0.0;
+
+    geo.coord[0] = pt->longitude;
+    geo.coord[1] = pt->latitude;
+    if (ucvm_bilinear_geo2xy(&(config->proj), &geo, &xy) != 0) return FAIL;
+
+    node->x = xy.coord[0];
+    node->y = xy.coord[1];
+    if (_linthurber_getval(node->x / config->spacing_dem, node->y / config->spacing_dem,
+                           0.0, LINTHURBER_DEM, &elev) != SUCCESS) return FAIL;
+    node->depth_msl = (pt->depth - elev) / 1000.0;
+    node->i = node->x / spacing;
+    node->j = node->y / spacing;
+    return SUCCESS;
+}
+
+/**
+ * Returns the parameter of the first integer grid line crossed after
+ * parameter 0 along the index range [a, a + d], or 2.0 if none.
+ */
+double _linthurber_ray_first_face(double a, double d, double *face) {
+    if (d > 0.0) {
+        *face = floor(a) + 1.0;
+    } else if (d < 0.0) {
+        *face = ceil(a) - 1.0;
+    } else {
+        return 2.0;
+    }
+    return (*face - a) / d;
+}
+
+/**
+ * Integrates slowness along one segment.
+ *
+ * @return The travel time in seconds, or -1.0 if the segment leaves the
+ * model or crosses cells without data.
+ */
+double _linthurber_ray_segment(linthurber_configuration_t *config, int prop,
+                               linthurber_ray_node_t *a, linthurber_ray_node_t *b) {
+    double di = b->i - a->i, dj = b->j - a->j, dd = b->depth_msl - a->depth_msl;
+    double length, t, tn, tx, ty, tz, fx = 0.0, fy = 0.0, tm, tg, h, v, sum, total = 0.0;
+    double q[2][2][2], f[3], c[3], g[3];
+    double ci, cj, cz, dzdd;
+    int k, n;
+
+    length = sqrt((b->x - a->x) * (b->x - a->x) + (b->y - a->y) * (b->y - a->y) +
+                  1.0e6 * dd * dd);
+    if (length == 0.0) return 0.0;
+
+    tx = _linthurber_ray_first_face(a->i, di, &fx);
+    ty = _linthurber_ray_first_face(a->j, dj, &fy);
+
+    /* Next depth layer crossed, in the direction of travel */
+    k = 0;
+    tz = 2.0;
+    if (dd > 0.0) {
+        for (k = 0; k < config->num_z; k++) {
+            if (config->depths_msl[k] > a->depth_msl) break;
+        }
+        if (k < config->num_z) tz = (config->depths_msl[k] - a->depth_msl) / dd;
+    } else if (dd < 0.0) {
+        for (k = config->num_z - 1; k >= 0; k--) {
+            if (config->depths_msl[k] < a->depth_msl) break;
+        }
+        if (k >= 0) tz = (config->depths_msl[k] - a->depth_msl) / dd;
+    }
+
+    t = 0.0;
+    while (t < 1.0) {
+        tn = 1.0;
+        if (tx < tn) tn = tx;
+        if (ty < tn) tn = ty;
+        if (tz < tn) tn = tz;
+
+        if (tn > t) {
+            /* Fetch the cell holding the middle of the piece once */
+            tm = 0.5 * (t + tn);
+            ci = a->i + tm * di;
+            cj = a->j + tm * dj;
+            cz = _linthurber_depth_index(config, a->depth_msl + tm * dd, &dzdd);
+            if (_linthurber_getcell(ci, cj, cz, prop, q, f) != SUCCESS) return -1.0;
+
+            /* Within the piece z is linear in depth, so fractions are linear in t */
+            h = 0.5 * (tn - t);
+            sum = 0.0;
+            for (n = 0; n < LINTHURBER_RAY_GAUSS; n++) {
+                tg = tm + h * linthurber_gauss_x[n];
+                c[0] = f[0] + (tg - tm) * di;
+                c[1] = f[1] + (tg - tm) * dj;
+                c[2] = f[2] + (tg - tm) * dd * dzdd;
+                g[0] = 1.0 - c[0];
+                g[1] = 1.0 - c[1];
+                g[2] = 1.0 - c[2];
+                v = g[2] * (g[1] * (g[0] * q[0][0][0] + c[0] * q[0][0][1]) +
+                            c[1] * (g[0] * q[0][1][0] + c[0] * q[0][1][1])) +
+                    c[2] * (g[1] * (g[0] * q[1][0][0] + c[0] * q[1][0][1]) +
+                            c[1] * (g[0] * q[1][1][0] + c[0] * q[1][1][1]));
+                if (v <= 0.0) return -1.0;
+                sum += linthurber_gauss_w[n] / v;
+            }
+            total += h * sum;
+        }
+
+        /* Step across whichever faces lie at tn */
+        t = tn;
+        if (tx <= t) {
+            fx += (di > 0.0) ? 1.0 : -1.0;
+            tx = (fx - a->i) / di;
+        }
+        if (ty <= t) {
+            fy += (dj > 0.0) ? 1.0 : -1.0;
+            ty = (fy - a->j) / dj;
+        }
+        if (tz <= t) {
+            k += (dd > 0.0) ? 1 : -1;
+            if ((k < 0) || (k >= config->num_z)) {
+                tz = 2.0;
+            } else {
+                tz = (config->depths_msl[k] - a->depth_msl) / dd;
+            }
+        }
+    }
+    return total * length;
+}
+
+/**
+ * Computes the travel time along each segment of a polyline ray path by
+ * integrating the slowness of the chosen velocity through the grid cells
+ * each segment crosses. Segments are straight in model x/y and in depth
+ * below mean sea level; vertex depths are below the surface, as for
+ * linthurber_query.
+ *
+ * @param points The numpoints vertices of the path.
+ * @param numpoints The number of vertices.
+ * @param prop LINTHURBER_VP or LINTHURBER_VS.
+ * @param times The numpoints - 1 segment travel times in seconds, -1.0 for
+ * segments that leave the model or cross cells without data.
+ * @return SUCCESS or FAIL.
+ */
+int linthurber_traveltime(linthurber_point_t *points, int numpoints, int prop, double *times) {
+    int err;
+
+    if (_linthurber_state_enter(NULL) != SUCCESS) return FAIL;
+    err = _linthurber_traveltime(points, numpoints, prop, times);
+    _linthurber_state_exit();
+    return err;
+}
+
+int _linthurber_traveltime(linthurber_point_t *points, int numpoints, int prop, double *times) {
+    linthurber_configuration_t *config = linthurber_configuration;
+    linthurber_ray_node_t a, b;
+    int p, a_ok, b_ok;
+    double spacing;
+
+    if (prop == LINTHURBER_VP) {
+        spacing = config->spacing_vp;
+    } else if (prop == LINTHURBER_VS) {
+        spacing = config->spacing_vs;
+    } else {
+        return FAIL;
+    }
+
+    if (numpoints < 2) return SUCCESS;
+
+    b_ok = (_linthurber_ray_node(config, &points[0], spacing, &b) == SUCCESS);
+    for (p = 1; p < numpoints; p++) {
+        a = b;
+        a_ok = b_ok;
+        b_ok = (_linthurber_ray_node(config, &points[p], spacing, &b) == SUCCESS);
+        if (a_ok && b_ok) {
+            times[p - 1] = _linthurber_ray_segment(config, prop, &a, &b);
+        } else {
+            times[p - 1] = -1.0;
+        }
+    }
+    return SUCCESS;
+}
+
+/** Arguments of a batch of rays. */
+typedef struct linthurber_ray_batch_t {
+     linthurber_ray_t *rays;
+     int prop;
+} linthurber_ray_batch_t;
+
+void _linthurber_ray_range(void *arg, int begin, int end) {
+    linthurber_ray_batch_t *batch = arg;
+    int r;
+
+    for (r = begin; r < end; r++) {
+        _linthurber_traveltime(batch->rays[r].points, batch->rays[r].numpoints,
+                              batch->prop, batch->rays[r].times);
+    }
+}
+
+/**
+ * Computes segment travel times for a batch of rays in parallel, using the
+ * number of threads set with linthurber_set_num_threads.
+ *
+ * @param rays The rays, each with its own vertices and output times.
+ * @param numrays The number of rays.
+ * @param prop LINTHURBER_VP or LINTHURBER_VS.
+ * @return SUCCESS or FAIL.
+ */
+int linthurber_traveltime_batch(linthurber_ray_t *rays, int numrays, int prop) {
+    linthurber_ray_batch_t batch;
+    int err;
+
+    if ((prop != LINTHURBER_VP) && (prop != LINTHURBER_VS)) return FAIL;
+    if (_linthurber_state_enter(NULL) != SUCCESS) return FAIL;
+
+    batch.rays = rays;
+    batch.prop = prop;
+    err = _linthurber_parallel_for(numrays, LINTHURBER_RAY_GRAIN, _linthurber_ray_range, &batch);
+    _linthurber_state_exit();
+    return err;
+}
@@ -0,0 +1,263 @@
+/*
+ * @file linthurber_sitemap.c
+ * @brief Precomputed Vs30, Z1.0 and Z2.5 maps of the LINTHURBER model.
+ * @author - SCEC
+ * @version 1.0.1
+ *
+ * The site map holds the site parameters of linthurber_query_site on a
+ * raster aligned with the vp grid nodes. It is built offline with
+ * linthurber_build_sitemap, stored as lin-thurber.site next to the model
+ * files and loaded with the model when present. A site query is then a
+ * bilinear lookup instead of a column integration.
+ *
+ * File layout: linthurber_sitemap_header_t, followed by the vs30, z1p0 and
+ * z2p5 rasters as native-endian floats, x fastest. In memory the three
+ * rasters are the layers of a padded grid like vp, so that the bilinear
+ * lookup reads them with the same cell offsets.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "ucvm_utils.h"
+#include "ucvm_config.h"
+
+#include "linthurber.h"
+#include "linthurber_parallel.h"
+
+/** Raster nodes handed to a thread at a time by the builder */
+#define LINTHURBER_SITEMAP_GRAIN 256
+
+#define LINTHURBER_SITEMAP_MAGIC "LTSITE1"
+
+extern __thread linthurber_configuration_t *linthurber_configuration;
+extern __thread linthurber_model_t *linthurber_velocity_model;
+
+/** Header of a site map file. */
+typedef struct linthurber_sitemap_header_t {
+     char magic[8];
+     /** Raster nodes along x and y */
+     int dims[2];
+     /** Raster spacing in meters */
+     double spacing;
+} linthurber_sitemap_header_t;
+
+/** Arguments of the builder. */
+typedef struct linthurber_sitemap_build_t {
+     int dims[2];
+     double spacing;
+     float *site;
+} linthurber_sitemap_build_t;
+
+void _linthurber_sitemap_range(void *arg, int begin, int end) {
+    linthurber_sitemap_build_t *build = arg;
+    size_t len = (size_t)build->dims[0] * build->dims[1];
+    linthurber_column_t col;
+    linthurber_site_t site;
+    int n;
+
+    for (n = begin; n < end; n++) {
+        _linthurber_column_init_xy((n % build->dims[0]) * build->spacing,
+                                   (n / build->dims[0]) * build->spacing, &col);
+        _linthurber_column_site(&col, &site);
+        build->site[n] = (float)site.vs30;
+        build->site[len + n] = (float)site.z1p0;
+        build->site[2 * len + n] = (float)site.z2p5;
+    }
+}
+
+/**
+ * Builds the site map of the loaded model on the vp grid nodes and writes
+ * it to a file, computing the raster nodes in parallel.
+ *
+ * @param filename The output file, NULL for lin-thurber.site in the model
+ * data directory.
+ * @return SUCCESS or FAIL.
+ */
+int linthurber_build_sitemap(const char *filename) {
+    int err;
+
+    if (_linthurber_state_enter(NULL) != SUCCESS) return FAIL;
+    err = _linthurber_build_sitemap(filename);
+    _linthurber_state_exit();
+    return err;
+}
+
+int _linthurber_build_sitemap(const char *filename) {
+    linthurber_configuration_t *config = linthurber_configuration;
+    linthurber_sitemap_header_t header;
+    linthurber_sitemap_build_t build;
+    char path[UCVM_MAX_PATH_LEN];
+    size_t len;
+    FILE *fp;
+    int err = SUCCESS;
+
+    build.dims[0] = config->vp_dims[0];
+    build.dims[1] = config->vp_dims[1];
+    build.spacing = config->spacing_vp;
+    len = (size_t)build.dims[0] * build.dims[1];
+    build.site = malloc(3 * len * sizeof(float));
+    if (build.site == NULL) {
+        fprintf(stderr, "Failed to allocate Lin-Thurber site map\n");
+        return(FAIL);
+    }
+
+    _linthurber_parallel_for((int)len, LINTHURBER_SITEMAP_GRAIN, _linthurber_sitemap_range, &build);
+
+    if (filename == NULL) {
+        sprintf(path, "%s/lin-thurber.site", config->data_directory);
+        filename = path;
+    }
+    fp = fopen(filename, "wb");
+    if (fp == NULL) {
+        fprintf(stderr, "Failed to open Lin-Thurber site map %s\n", filename);
+        free(build.site);
+        return(FAIL);
+    }
+
+    memset(&header, 0, sizeof(header));
+    strcpy(header.magic, LINTHURBER_SITEMAP_MAGIC);
+    header.dims[0] = build.dims[0];
+    header.dims[1] = build.dims[1];
+    header.spacing = build.spacing;
+    if ((fwrite(&header, sizeof(header), 1, fp) != 1) ||
+        (fwrite(build.site, sizeof(float), 3 * len, fp) != 3 * len)) {
+        fprintf(stderr, "Failed to write Lin-Thurber site map %s\n", filename);
+        err = FAIL;
+    }
+    fclose(fp);
+    free(build.site);
+    return(err);
+}
+
+/**
+ * Loads the site map from the model data directory, if one was built.
+ *
+ * @param model The model to attach the site map to.
+ * @return SUCCESS if loaded, FAIL if absent, unreadable or built for other grids.
+ */
+int _linthurber_read_sitemap(linthurber_model_t *model) {
+    linthurber_sitemap_header_t header;
+    char filename[UCVM_MAX_PATH_LEN];
+    FILE *fp;
+    int j, k;
+
+    model->site_status = 0;
+    sprintf(filename, "%s/lin-thurber.site", linthurber_configuration->data_directory);
+    fp = fopen(filename, "rb");
+    if (fp == NULL) return(FAIL);
+
+    if ((fread(&header, sizeof(header), 1, fp) != 1) ||
+        (strncmp(header.magic, LINTHURBER_SITEMAP_MAGIC, sizeof(header.magic)) != 0) ||
+        (header.dims[0] <= 0) || (header.dims[1] <= 0)) {
+        fprintf(stderr, "Ignoring invalid Lin-Thurber site map %s\n", filename);
+        fclose(fp);
+        return(FAIL);
+    }
+
+    /* A map built for another release of the grids is stale */
+    if ((header.dims[0] != linthurber_configuration->vp_dims[0]) ||
+        (header.dims[1] != linthurber_configuration->vp_dims[1]) ||
+        (header.spacing != linthurber_configuration->spacing_vp)) {
+        fprintf(stderr, "Ignoring stale Lin-Thurber site map %s, built for a %dx%d grid at %f m\n",
+                filename, header.dims[0], header.dims[1], header.spacing);
+        fclose(fp);
+        return(FAIL);
+    }
+
+    model->site_dims[0] = header.dims[0];
+    model->site_dims[1] = header.dims[1];
+    model->site_dims[2] = 3;
+    model->site_spacing = header.spacing;
+    model->site_len = _linthurber_grid_len(model->site_dims);
+    model->site = malloc(model->site_len * sizeof(float));
+    if (model->site == NULL) {
+        fprintf(stderr, "Failed to allocate Lin-Thurber site map\n");
+        fclose(fp);
+        return(FAIL);
+    }
+
+    /* One row at a time, into the padded layout */
+    for (k = 0; k < 3; k++) {
+        for (j = 0; j < header.dims[1]; j++) {
+            if (fread(model->site + LINTHURBER_NODE(model->site_dims, 0, j, k), sizeof(float),
+                      header.dims[0], fp) != (size_t)header.dims[0]) {
+                fprintf(stderr, "Failed to read Lin-Thurber site map %s\n", filename);
+                free(model->site);
+                model->site = NULL;
+                fclose(fp);
+                return(FAIL);
+            }
+        }
+    }
+    fclose(fp);
+    _linthurber_pad_grid(model->site, model->site_dims);
+
+    model->site_status = 2;
+    return(SUCCESS);
+}
+
+/**
+ * Samples one raster of the site map, -1.0 if any contributing node is
+ * undefined.
+ */
+double _linthurber_sitemap_sample(linthurber_hcell_t *cell, float *raster) {
+    int n;
+
+    for (n = 0; n < 4; n++) {
+        if (raster[cell->offset[n]] < 0.0) return -1.0;
+    }
+    return _linthurber_hcell_layer(cell, raster, 0);
+}
+
+/**
+ * Looks up Vs30, Z1.0 and Z2.5 in the precomputed site map, bilinearly
+ * interpolated between raster nodes. Much cheaper than
+ * linthurber_query_site, at the cost of the raster resolution.
+ *
+ * @param points The sites; depths are ignored.
+ * @param sites The site parameters returned, -1.0 where undefined.
+ * @param numpoints The number of sites.
+ * @return SUCCESS, or FAIL if no site map was loaded.
+ */
+int linthurber_query_sitemap(linthurber_point_t *points, linthurber_site_t *sites, int numpoints) {
+    int err;
+
+    if (_linthurber_state_enter(NULL) != SUCCESS) return FAIL;
+    err = _linthurber_query_sitemap(points, sites, numpoints);
+    _linthurber_state_exit();
+    return err;
+}
+
+int _linthurber_query_sitemap(linthurber_point_t *points, linthurber_site_t *sites, int numpoints) {
+    linthurber_configuration_t *config = linthurber_configuration;
+    linthurber_model_t *model = linthurber_velocity_model;
+    size_t len = LINTHURBER_NODE(model->site_dims, 0, 0, 1);
+    linthurber_hcell_t cell;
+    ucvm_point_t geo, xy;
+    int p;
+
+    if (model->site_status != 2) return(FAIL);
+
+    for (p = 0; p < numpoints; p++) {
+        sites[p].vs30 = -1.0;
+        sites[p].z1p0 = -1.0;
+        sites[p].z2p5 = -1.0;
+
+        geo.coord[0] = points[p].longitude;
+        geo.coord[1] = points[p].latitude;
+        if (ucvm_bilinear_geo2xy(&(config->proj), &geo, &xy) != 0) continue;
+
+        _linthurber_hcell_init(&cell, xy.coord[0] / model->site_spacing,
+                               xy.coord[1] / model->site_spacing, model->site_dims);
+        if (!cell.valid) continue;
+
+        sites[p].vs30 = _linthurber_sitemap_sample(&cell, model->site);
+        sites[p].z1p0 = _linthurber_sitemap_sample(&cell, model->site + len);
+        sites[p].z2p5 = _linthurber_sitemap_sample(&cell, model->site + 2 * len);
+    }
+    return(SUCCESS);
+}
@@ -0,0 +1,356 @@
+/*
+ * @file linthurber_slice.c
+ * @brief Depth slices and vertical cross-sections of the LINTHURBER model.
+ * @author - SCEC
+ * @version 1.0.1
+ *
+ * Both extractions fill a caller-provided float image, row-major, with -1.0
+ * where the model has no data, and agree with linthurber_query at every
+ * pixel, whatever the interpolation setting. Every pixel of a depth slice
+ * is a different position, so each image row goes through the query loop
+ * as one batch: points outside of the model are culled in blocks and the
+ * rest projected with the kernels of the instruction set level. A
+ * cross-section sets up one column per image column along the path, once
+ * for all of its depths, and evaluates it with the query kernel. With
+ * trilinear interpolation it blends the layer values of each column once
+ * instead; every row is then a linear interpolation between two of those
+ * layers, done row by row over arrays that are contiguous along the row.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "ucvm_utils.h"
+
+#include "linthurber.h"
+#include "linthurber_parallel.h"
+
+/** Image rows handed to a thread at a time */
+#define LINTHURBER_SLICE_GRAIN 1
+/** Cross-section columns handed to a thread at a time while setting up */
+#define LINTHURBER_SECTION_GRAIN 16
+
+extern __thread linthurber_configuration_t *linthurber_configuration;
+extern __thread linthurber_model_t *linthurber_velocity_model;
+
+/** Arguments of a depth slice. */
+typedef struct linthurber_slice_t {
+     double lon0, lat0, lon1, lat1;
+     double depth;
+     int nx, ny;
+     int prop;
+     float *buf;
+} linthurber_slice_t;
+
+/** Arguments of a cross-section. */
+typedef struct linthurber_section_t {
+     /** Positions of the image columns along the path */
+     double *lon;
+     double *lat;
+     double depth0, depth1;
+     int nh, nz;
+     int prop;
+     /** Surface elevation of each column, NAN where it has no data */
+     double *elev;
+     /** The column set up at each position */
+     linthurber_column_t *cols;
+     /** 1 if rows blend the layer values, with trilinear interpolation */
+     int layered;
+     /** Layer values, layer-major: layers[k * nh + c] */
+     double *layers;
+     float *buf;
+} linthurber_section_t;
+
+/**
+ * Returns the node grid and horizontal cell a property is interpolated
+ * from, vp for density; with eval set, the buffer the query kernel reads
+ * instead of the node grid.
+ */
+float *_linthurber_prop_grid(linthurber_column_t *col, int prop, int eval, linthurber_hcell_t **cell) {
+    linthurber_model_t *model = linthurber_velocity_model;
+
+    if (prop == LINTHURBER_VS) {
+        *cell = &col->vs;
+        return eval ? model->vs_eval : model->vs;
+    }
+    *cell = &col->vp;
+    return eval ? model->vp_eval : model->vp;
+}
+
+/**
+ * Converts an interpolated vp or vs to the pixel value of a property.
+ */
+float _linthurber_prop_pixel(double v, int prop) {
+    if (prop == LINTHURBER_RHO) return (v > 0.0) ? (float)_get_rho(v) : -1.0f;
+    return (float)v;
+}
+
+void _linthurber_slice_range(void *arg, int begin, int end) {
+    linthurber_slice_t *slice = arg;
+    linthurber_query_desc_t desc;
+    linthurber_point_t *points;
+    linthurber_properties_t *data;
+    float *row;
+    double lat, v;
+    int r, c;
+
+    points = malloc(slice->nx * sizeof(linthurber_point_t));
+    data = malloc(slice->nx * sizeof(linthurber_properties_t));
+    if ((points == NULL) || (data == NULL)) {
+        for (r = begin; r < end; r++) {
+            row = slice->buf + (size_t)r * slice->nx;
+            for (c = 0; c < slice->nx; c++) row[c] = -1.0f;
+        }
+        free(points);
+        free(data);
+        return;
+    }
+
+    /* The longitudes and the depth are the same on every row */
+    for (c = 0; c < slice->nx; c++) {
+        points[c].longitude = (slice->nx > 1) ?
+            slice->lon0 + (slice->lon1 - slice->lon0) * c / (slice->nx - 1) : slice->lon0;
+        points[c].depth = slice->depth;
+    }
+    _linthurber_desc_init(&desc, points, data);
+
+    for (r = begin; r < end; r++) {
+        lat = (slice->ny > 1) ? slice->lat0 + (slice->lat1 - slice->lat0) * r / (slice->ny - 1)
+                              : slice->lat0;
+        for (c = 0; c < slice->nx; c++) points[c].latitude = lat;
+        _linthurber_query_points(&desc, 0, slice->nx, LINTHURBER_DEPTH_SURFACE);
+
+        row = slice->buf + (size_t)r * slice->nx;
+        for (c = 0; c < slice->nx; c++) {
+            v = (slice->prop == LINTHURBER_VP) ? data[c].vp :
+                (slice->prop == LINTHURBER_VS) ? data[c].vs : data[c].rho;
+            row[c] = (float)v;
+        }
+    }
+    free(points);
+    free(data);
+}
+
+/**
+ * Extracts a depth slice on a regular longitude/latitude grid. Pixel (c, r)
+ * lies at lon0 + (lon1 - lon0) * c / (nx - 1) and lat0 + (lat1 - lat0) * r
+ * / (ny - 1), rows are filled in parallel.
+ *
+ * @param lon0 The longitude of the first image column.
+ * @param lat0 The latitude of the first image row.
+ * @param lon1 The longitude of the last image column.
+ * @param lat1 The latitude of the last image row.
+ * @param depth The depth below the surface in meters.
+ * @param nx The number of image columns.
+ * @param ny The number of image rows.
+ * @param prop LINTHURBER_VP, LINTHURBER_VS or LINTHURBER_RHO.
+ * @param buf The nx * ny image returned, row-major, -1.0 where undefined.
+ * @return SUCCESS or FAIL.
+ */
+int linthurber_slice(double lon0, double lat0, double lon1, double lat1, double depth,
+                     int nx, int ny, int prop, float *buf) {
+    linthurber_slice_t slice;
+    int err;
+
+    if ((prop != LINTHURBER_VP) && (prop != LINTHURBER_VS) && (prop != LINTHURBER_RHO)) return FAIL;
+    if ((nx < 1) || (ny < 1)) return FAIL;
+
+    slice.lon0 = lon0;
+    slice.lat0 = lat0;
+    slice.lon1 = lon1;
+    slice.lat1 = lat1;
+    slice.depth = depth;
+    slice.nx = nx;
+    slice.ny = ny;
+    slice.prop = prop;
+    slice.buf = buf;
+
+    if (_linthurber_state_enter(NULL) != SUCCESS) return FAIL;
+    err = _linthurber_parallel_for(ny, LINTHURBER_SLICE_GRAIN, _linthurber_slice_range, &slice);
+    _linthurber_state_exit();
+    return err;
+}
+
+/**
+ * Samples n points along the great circle from (lon0, lat0) to (lon1, lat1),
+ * evenly spaced in arc length.
+ */
+void _linthurber_great_circle(double lon0, double lat0, double lon1, double lat1, int n,
+                              double *lon, double *lat) {
+    double a[3], b[3], p[3], axb[3], omega, s, wa, wb, t;
+    int i, k;
+
+    a[0] = cos(lat0 * M_PI / 180.0) * cos(lon0 * M_PI / 180.0);
+    a[1] = cos(lat0 * M_PI / 180.0) * sin(lon0 * M_PI / 180.0);
+    a[2] = sin(lat0 * M_PI / 180.0);
+    b[0] = cos(lat1 * M_PI / 180.0) * cos(lon1 * M_PI / 180.0);
+    b[1] = cos(lat1 * M_PI / 180.0) * sin(lon1 * M_PI / 180.0);
+    b[2] = sin(lat1 * M_PI / 180.0);
+
+    axb[0] = a[1] * b[2] - a[2] * b[1];
+    axb[1] = a[2] * b[0] - a[0] * b[2];
+    axb[2] = a[0] * b[1] - a[1] * b[0];
+    omega = atan2(sqrt(axb[0] * axb[0] + axb[1] * axb[1] + axb[2] * axb[2]),
+                  a[0] * b[0] + a[1] * b[1] + a[2] * b[2]);
+    s = sin(omega);
+
+    for (i = 0; i < n; i++) {
+        t = (n > 1) ? (double)i / (n - 1) : 0.0;
+        /* Spherical interpolation, linear when the endpoints coincide */
+        if (s < 1.0e-12) {
+            wa = 1.0 - t;
+            wb = t;
+        } else {
+            wa = sin((1.0 - t) * omega) / s;
+            wb = sin(t * omega) / s;
+        }
+        for (k = 0; k < 3; k++) p[k] = wa * a[k] + wb * b[k];
+        lon[i] = atan2(p[1], p[0]) * 180.0 / M_PI;
+        lat[i] = atan2(p[2], sqrt(p[0] * p[0] + p[1] * p[1])) * 180.0 / M_PI;
+    }
+}
+
+/**
+ * Sets up image columns of a cross-section: projects each position once
+ * and, for trilinear interpolation, blends the horizontal corners of every
+ * layer.
+ */
+void _linthurber_section_columns(void *arg, int begin, int end) {
+    linthurber_section_t *section = arg;
+    linthurber_column_t *col;
+    linthurber_hcell_t *cell;
+    float *grid;
+    int c, k, nz = linthurber_configuration->num_z;
+
+    for (c = begin; c < end; c++) {
+        col = &section->cols[c];
+        section->elev[c] = NAN;
+        if (_linthurber_column_init(section->lon[c], section->lat[c], col) != SUCCESS) continue;
+        grid = _linthurber_prop_grid(col, section->prop, 0, &cell);
+        if (!cell->valid) continue;
+
+        section->elev[c] = col->elev;
+        if (!section->layered) continue;
+        for (k = 0; k < nz; k++) {
+            section->layers[(size_t)k * section->nh + c] = _linthurber_hcell_layer(cell, grid, k);
+        }
+    }
+}
+
+/**
+ * Fills rows of a cross-section. Each pixel is a blend of two layer values
+ * of its column, read from arrays that run along the row, or without the
+ * layer values the query kernel evaluated on its column.
+ */
+void _linthurber_section_rows(void *arg, int begin, int end) {
+    linthurber_section_t *section = arg;
+    linthurber_configuration_t *config = linthurber_configuration;
+    linthurber_model_t *model = linthurber_velocity_model;
+    linthurber_hcell_t *cell;
+    int nh = section->nh, r, c, k0, k1;
+    double depth, z, fz;
+    float *row, *grid;
+
+    for (r = begin; r < end; r++) {
+        depth = (section->nz > 1) ?
+            section->depth0 + (section->depth1 - section->depth0) * r / (section->nz - 1) :
+            section->depth0;
+        row = section->buf + (size_t)r * nh;
+        for (c = 0; c < nh; c++) {
+            if (isnan(section->elev[c])) {
+                row[c] = -1.0f;
+                continue;
+            }
+            z = _linthurber_depth_index(config, (depth - section->elev[c]) / 1000.0, NULL);
+            if (!section->layered) {
+                grid = _linthurber_prop_grid(&section->cols[c], section->prop, 1, &cell);
+                row[c] = _linthurber_prop_pixel(model->kernel(cell, grid, z), section->prop);
+                continue;
+            }
+            k0 = (int)z;
+            k1 = (k0 + 1 < config->num_z) ? k0 + 1 : config->num_z - 1;
+            fz = z - k0;
+            row[c] = _linthurber_prop_pixel((1.0 - fz) * section->layers[(size_t)k0 * nh + c] +
+                                            fz * section->layers[(size_t)k1 * nh + c],
+                                            section->prop);
+        }
+    }
+}
+
+/**
+ * Extracts a vertical cross-section along the great circle from (lon0,
+ * lat0) to (lon1, lat1). Image column c lies at arc fraction c / (nh - 1)
+ * of the path and row r at depth0 + (depth1 - depth0) * r / (nz - 1)
+ * below the surface. Each position is projected once for all depths, and
+ * with trilinear interpolation also interpolated horizontally once.
+ *
+ * @param lon0 The longitude of the start of the path.
+ * @param lat0 The latitude of the start of the path.
+ * @param lon1 The longitude of the end of the path.
+ * @param lat1 The latitude of the end of the path.
+ * @param depth0 The depth of the first image row in meters.
+ * @param depth1 The depth of the last image row in meters.
+ * @param nh The number of image columns along the path.
+ * @param nz The number of image rows.
+ * @param prop LINTHURBER_VP, LINTHURBER_VS or LINTHURBER_RHO.
+ * @param buf The nh * nz image returned, row-major, -1.0 where undefined.
+ * @return SUCCESS or FAIL.
+ */
+int linthurber_cross_section(double lon0, double lat0, double lon1, double lat1,
+                             double depth0, double depth1, int nh, int nz, int prop, float *buf) {
+    int err;
+
+    if ((prop != LINTHURBER_VP) && (prop != LINTHURBER_VS) && (prop != LINTHURBER_RHO)) return FAIL;
+    if ((nh < 1) || (nz < 1)) return FAIL;
+
+    if (_linthurber_state_enter(NULL) != SUCCESS) return FAIL;
+    err = _linthurber_cross_section(lon0, lat0, lon1, lat1, depth0, depth1, nh, nz, prop, buf);
+    _linthurber_state_exit();
+    return err;
+}
+
+int _linthurber_cross_section(double lon0, double lat0, double lon1, double lat1,
+                              double depth0, double depth1, int nh, int nz, int prop, float *buf) {
+    linthurber_section_t section;
+    int err;
+
+    section.layered = (linthurber_configuration->interpolation == LINTHURBER_INTERP_TRILINEAR);
+    section.lon = malloc(nh * sizeof(double));
+    section.lat = malloc(nh * sizeof(double));
+    section.elev = malloc(nh * sizeof(double));
+    section.cols = malloc(nh * sizeof(linthurber_column_t));
+    section.layers = section.layered ?
+        malloc((size_t)nh * linthurber_configuration->num_z * sizeof(double)) : NULL;
+    if ((section.lon == NULL) || (section.lat == NULL) || (section.elev == NULL) ||
+        (section.cols == NULL) || (section.layered && (section.layers == NULL))) {
+        free(section.lon);
+        free(section.lat);
+        free(section.elev);
+        free(section.cols);
+        free(section.layers);
+        return FAIL;
+    }
+
+    _linthurber_great_circle(lon0, lat0, lon1, lat1, nh, section.lon, section.lat);
+    section.depth0 = depth0;
+    section.depth1 = depth1;
+    section.nh = nh;
+    section.nz = nz;
+    section.prop = prop;
+    section.buf = buf;
+
+    err = _linthurber_parallel_for(nh, LINTHURBER_SECTION_GRAIN, _linthurber_section_columns, &section);
+    if (err == SUCCESS) {
+        err = _linthurber_parallel_for(nz, LINTHURBER_SLICE_GRAIN, _linthurber_section_rows, &section);
+    }
+
+    free(section.lon);
+    free(section.lat);
+    free(section.elev);
+    free(section.cols);
+    free(section.layers);
+    return err;
+}
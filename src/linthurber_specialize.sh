@@ -0,0 +1,70 @@
+#!/bin/bash
+#
+# Generates linthurber_constants.h, the grid constants of one model release,
+# from its data/config. The specialized library (make specialized) is built
+# against it.
+#
+#   ./linthurber_specialize.sh config > linthurber_constants.h
+#
+# The grid dimensions are computed the way read_configuration does. The
+# library checks the constants against the config it loads and falls back
+# to the generic code if they differ.
+
+CONFIG=$1
+
+if [[ -z ${CONFIG} || ! -r ${CONFIG} ]]; then
+  echo "Usage: $0 config" 1>&2
+  exit 1
+fi
+
+awk -v config="${CONFIG}" '
+function trim(s) { sub(/^[ \t]+/, "", s); sub(/[ \t\r]+$/, "", s); return s }
+/^[ \t]*#/ { next }
+index($0, "=") > 0 {
+  key = trim(substr($0, 1, index($0, "=") - 1))
+  value[key] = trim(substr($0, index($0, "=") + 1))
+}
+END {
+  split("spacing_vp spacing_vs spacing_dem num_z depths_msl proj_dims", need, " ")
+  for (n in need) {
+    if (!(need[n] in value)) {
+      printf("%s has no %s entry\n", config, need[n]) > "/dev/stderr"
+      exit 1
+    }
+  }
+  split(value["proj_dims"], dims, /[ \t]*,[ \t]*/)
+  nz = value["num_z"] + 0
+  nd = split(value["depths_msl"], depths, /[ \t]*,[ \t]*/)
+  if (nd != nz) {
+    printf("%s lists %d depths_msl for num_z = %d\n", config, nd, nz) > "/dev/stderr"
+    exit 1
+  }
+
+  print "/**"
+  print " * @file linthurber_constants.h"
+  print " * @brief Grid constants of one LINTHURBER model release."
+  print " *"
+  print " * Generated by linthurber_specialize.sh from " config ", do not edit."
+  print " *"
+  print " */"
+  print ""
+  print "#ifndef LINTHURBER_CONSTANTS_H"
+  print "#define LINTHURBER_CONSTANTS_H"
+  print ""
+  printf("#define LINTHURBER_FIXED_SPACING_VP %s\n", value["spacing_vp"])
+  printf("#define LINTHURBER_FIXED_SPACING_VS %s\n", value["spacing_vs"])
+  printf("#define LINTHURBER_FIXED_SPACING_DEM %s\n", value["spacing_dem"])
+  printf("#define LINTHURBER_FIXED_NUM_Z %d\n", nz)
+  print ""
+  printf("static const int linthurber_fixed_vp_dims[3] = { %d, %d, %d };\n",
+         int(dims[1] / value["spacing_vp"] + 1), int(dims[2] / value["spacing_vp"] + 1), nz)
+  printf("static const int linthurber_fixed_vs_dims[3] = { %d, %d, %d };\n",
+         int(dims[1] / value["spacing_vs"] + 1), int(dims[2] / value["spacing_vs"] + 1), nz)
+  printf("static const int linthurber_fixed_dem_dims[3] = { %d, %d, 1 };\n",
+         int(dims[1] / value["spacing_dem"] + 1), int(dims[2] / value["spacing_dem"] + 1))
+  printf("static const double linthurber_fixed_depths_msl[LINTHURBER_FIXED_NUM_Z] = {")
+  for (k = 1; k <= nz; k++) printf(" %s%s", depths[k], (k < nz) ? "," : " ")
+  print "};"
+  print ""
+  print "#endif"
+}' "${CONFIG}"
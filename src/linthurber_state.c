@@ -0,0 +1,239 @@
+/*
+ * @file linthurber_state.c
+ * @brief Publication and reclamation of the loaded LINTHURBER model.
+ * @author - SCEC
+ * @version 1.0.1
+ *
+ * The configuration and model form one state, published through a single
+ * pointer. Every public query pins the current state on entry: it records
+ * the global epoch in its thread's reader record, loads the pointer and
+ * points the thread's linthurber_configuration and linthurber_velocity_model
+ * at that state until it returns. A reload publishes a new state with an
+ * atomic exchange and then waits for a grace period: once every reader has
+ * left or has pinned since the epoch was advanced, nobody can still see the
+ * old state, and it is freed after its asynchronous batches finish. Queries
+ * never block on a reload.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "linthurber.h"
+
+/** Epoch-based reader record of one thread. */
+typedef struct linthurber_reader_t {
+     /** Epoch seen when the thread pinned the state, 0 when not pinned */
+     unsigned long epoch;
+     /** 1 while owned by a live thread */
+     int used;
+     struct linthurber_reader_t *next;
+     char pad[40];
+} linthurber_reader_t;
+
+/** The published state, NULL when no model is loaded. */
+linthurber_state_t *linthurber_state = NULL;
+unsigned long linthurber_epoch = 1;
+unsigned long linthurber_state_serial = 0;
+
+/** Reader records of every thread that ever queried, never freed. */
+linthurber_reader_t *linthurber_readers = NULL;
+
+__thread linthurber_reader_t *linthurber_reader = NULL;
+__thread int linthurber_pin_depth = 0;
+/** The state this thread is working on */
+__thread linthurber_state_t *linthurber_view = NULL;
+
+extern __thread linthurber_configuration_t *linthurber_configuration;
+extern __thread linthurber_model_t *linthurber_velocity_model;
+
+pthread_key_t linthurber_reader_key;
+pthread_once_t linthurber_reader_once = PTHREAD_ONCE_INIT;
+
+void _linthurber_reader_release(void *ptr) {
+    linthurber_reader_t *reader = ptr;
+
+    __atomic_store_n(&reader->epoch, 0, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&reader->used, 0, __ATOMIC_RELEASE);
+}
+
+void _linthurber_reader_key_init() {
+    pthread_key_create(&linthurber_reader_key, _linthurber_reader_release);
+}
+
+/**
+ * Returns the calling thread's reader record, reusing the record of an
+ * exited thread or adding a new one.
+ */
+linthurber_reader_t *_linthurber_reader_get() {
+    linthurber_reader_t *reader;
+    int unused;
+
+    if (linthurber_reader) return linthurber_reader;
+    pthread_once(&linthurber_reader_once, _linthurber_reader_key_init);
+
+    for (reader = __atomic_load_n(&linthurber_readers, __ATOMIC_ACQUIRE); reader; reader = reader->next) {
+        unused = 0;
+        if (__atomic_compare_exchange_n(&reader->used, &unused, 1, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) break;
+    }
+    if (reader == NULL) {
+        reader = calloc(1, sizeof(linthurber_reader_t));
+        if (reader == NULL) return NULL;
+        reader->used = 1;
+        reader->next = __atomic_load_n(&linthurber_readers, __ATOMIC_ACQUIRE);
+        while (!__atomic_compare_exchange_n(&linthurber_readers, &reader->next, reader, 0,
+                                            __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+    }
+    pthread_setspecific(linthurber_reader_key, reader);
+    linthurber_reader = reader;
+    return reader;
+}
+
+/**
+ * Makes a state the calling thread's view. Nested calls keep the outermost
+ * view, so one public call sees one state throughout.
+ *
+ * @param state The state to use, kept alive by the caller, or NULL to pin
+ * the published state.
+ * @return SUCCESS, or FAIL if no model is loaded.
+ */
+int _linthurber_state_enter(linthurber_state_t *state) {
+    linthurber_reader_t *reader;
+
+    if (linthurber_pin_depth++ > 0) return SUCCESS;
+
+    if (state == NULL) {
+        reader = _linthurber_reader_get();
+        if (reader == NULL) {
+            linthurber_pin_depth--;
+            return FAIL;
+        }
+        __atomic_store_n(&reader->epoch, __atomic_load_n(&linthurber_epoch, __ATOMIC_SEQ_CST),
+                         __ATOMIC_SEQ_CST);
+        state = __atomic_load_n(&linthurber_state, __ATOMIC_SEQ_CST);
+        if (state == NULL) {
+            __atomic_store_n(&reader->epoch, 0, __ATOMIC_RELEASE);
+            linthurber_pin_depth--;
+            return FAIL;
+        }
+    }
+
+    linthurber_view = state;
+    linthurber_configuration = state->config;
+    linthurber_velocity_model = state->model;
+    return SUCCESS;
+}
+
+/**
+ * Leaves the view entered with _linthurber_state_enter.
+ */
+void _linthurber_state_exit() {
+    if (--linthurber_pin_depth > 0) return;
+    _linthurber_uniform_flush();
+    _linthurber_cull_flush();
+    if (linthurber_reader) __atomic_store_n(&linthurber_reader->epoch, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * Returns the calling thread's current state.
+ */
+linthurber_state_t *_linthurber_state_view() {
+    return linthurber_view;
+}
+
+/**
+ * Switches the view of a thread that is inside a query to another state
+ * kept alive by its current one, such as one of its coarser views.
+ *
+ * @param state The state to use.
+ * @return The state used before, to switch back to.
+ */
+linthurber_state_t *_linthurber_state_use(linthurber_state_t *state) {
+    linthurber_state_t *prev = linthurber_view;
+
+    linthurber_view = state;
+    linthurber_configuration = state->config;
+    linthurber_velocity_model = state->model;
+    return prev;
+}
+
+/**
+ * Waits until no thread can still be reading a state unpublished before
+ * the call.
+ */
+void _linthurber_state_synchronize() {
+    linthurber_reader_t *reader;
+    unsigned long target, epoch;
+
+    target = __atomic_add_fetch(&linthurber_epoch, 1, __ATOMIC_SEQ_CST);
+    for (reader = __atomic_load_n(&linthurber_readers, __ATOMIC_ACQUIRE); reader; reader = reader->next) {
+        while (1) {
+            epoch = __atomic_load_n(&reader->epoch, __ATOMIC_SEQ_CST);
+            if ((epoch == 0) || (epoch >= target)) break;
+            usleep(100);
+        }
+    }
+}
+
+/**
+ * Wraps a loaded configuration and model into a new state.
+ *
+ * @return The state, or NULL if it cannot be allocated.
+ */
+linthurber_state_t *_linthurber_state_new(linthurber_configuration_t *config, linthurber_model_t *model) {
+    linthurber_state_t *state = calloc(1, sizeof(linthurber_state_t));
+
+    if (state == NULL) return NULL;
+    state->config = config;
+    state->model = model;
+    state->serial = __atomic_add_fetch(&linthurber_state_serial, 1, __ATOMIC_RELAXED);
+    return state;
+}
+
+/**
+ * Frees a state with its configuration and the model buffers it owns.
+ */
+void _linthurber_state_free(linthurber_state_t *state) {
+    linthurber_model_t *model = state->model;
+
+    _linthurber_warmup_release(state);
+    _linthurber_lod_free(state);
+    free(state->config);
+    if (model) {
+      if (model->vp_status == 2) { free(model->vp); }
+      if (model->vs_status == 2) { free(model->vs); }
+      if (model->dem_status == 2) { free(model->dem); }
+      if (model->site_status == 2) { free(model->site); }
+      free(model->vp_cells);
+      free(model->vs_cells);
+      free(model->vp_coef);
+      free(model->vs_coef);
+      free(model->vp_uniform);
+      free(model->vs_uniform);
+      free(model->dem_uniform);
+      free(model);
+    }
+    free(state);
+}
+
+/**
+ * Publishes a state, then reclaims the one it replaces once no query can
+ * reach it and its asynchronous batches are done. The calling thread must
+ * not be inside a query.
+ *
+ * @param state The new state, NULL to unpublish.
+ */
+void _linthurber_state_publish(linthurber_state_t *state) {
+    linthurber_state_t *old;
+
+    old = __atomic_exchange_n(&linthurber_state, state, __ATOMIC_SEQ_CST);
+    if (old == NULL) return;
+    __atomic_store_n(&old->retired, 1, __ATOMIC_RELAXED);
+
+    _linthurber_state_synchronize();
+    while (__atomic_load_n(&old->refs, __ATOMIC_ACQUIRE) > 0) usleep(1000);
+    _linthurber_state_free(old);
+}
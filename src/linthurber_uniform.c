@@ -0,0 +1,182 @@
+/*
+ * @file linthurber_uniform.c
+ * @brief Cells of the LINTHURBER grids whose eight corners are equal.
+ * @author - SCEC
+ * @version 1.0.1
+ *
+ * Large parts of the model are uniform: layers of the starting model the
+ * inversion did not update, and the regions without data, where every
+ * node is -1. Within a cell whose eight corners hold the same value the
+ * trilinear interpolant is that value, so a bitmap with one bit per cell,
+ * built at load time, lets _linthurber_getval and the trilinear query
+ * kernels return the corner instead of reading and blending all eight.
+ * The result can differ from the blend in the last bit.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "linthurber.h"
+
+extern __thread linthurber_configuration_t *linthurber_configuration;
+extern __thread linthurber_model_t *linthurber_velocity_model;
+
+/** Evaluations that consulted a bitmap, and those that found a uniform cell */
+__thread long linthurber_uniform_evals = 0;
+__thread long linthurber_uniform_hits = 0;
+/** The same, over all threads, since the last reset */
+long linthurber_uniform_total_evals = 0;
+long linthurber_uniform_total_hits = 0;
+
+/**
+ * Builds the bitmap of the uniform cells of a padded grid. Cell (i, j, k)
+ * has bit k * dims[0] * dims[1] + j * dims[0] + i, the cells ordered like
+ * the corner-packed layout; cells on the last node of an axis reach into
+ * the padding.
+ *
+ * @param buf The padded node grid.
+ * @param dims The grid dimensions, padding excluded.
+ * @return The bitmap, or NULL if it cannot be allocated.
+ */
+unsigned char *_linthurber_uniform_grid(float *buf, int *dims) {
+    size_t sy = dims[0] + 1, sz = sy * (dims[1] + 1);
+    size_t n = (size_t)dims[0] * dims[1] * dims[2];
+    unsigned char *map;
+    float *q, v;
+    int i, j, k;
+
+    map = calloc((n + 7) / 8, 1);
+    if (map == NULL) return NULL;
+
+    n = 0;
+    for (k = 0; k < dims[2]; k++) {
+        for (j = 0; j < dims[1]; j++) {
+            for (i = 0; i < dims[0]; i++, n++) {
+                q = buf + LINTHURBER_NODE(dims, i, j, k);
+                v = q[0];
+                if ((q[1] == v) && (q[sy] == v) && (q[sy + 1] == v) &&
+                    (q[sz] == v) && (q[sz + 1] == v) && (q[sz + sy] == v) && (q[sz + sy + 1] == v)) {
+                    map[n >> 3] |= 1 << (n & 7);
+                }
+            }
+        }
+    }
+    return map;
+}
+
+/**
+ * Builds the uniform cell bitmaps of vp, vs and the DEM.
+ *
+ * @param config The model configuration.
+ * @param model The model, with its node grids in place.
+ * @return SUCCESS, or FAIL if the bitmaps cannot be allocated.
+ */
+int _linthurber_uniform_model(linthurber_configuration_t *config, linthurber_model_t *model) {
+    model->vp_uniform = _linthurber_uniform_grid(model->vp, config->vp_dims);
+    model->vs_uniform = _linthurber_uniform_grid(model->vs, config->vs_dims);
+    model->dem_uniform = _linthurber_uniform_grid(model->dem, config->dem_dims);
+    if ((model->vp_uniform == NULL) || (model->vs_uniform == NULL) || (model->dem_uniform == NULL)) {
+        free(model->vp_uniform);
+        free(model->vs_uniform);
+        free(model->dem_uniform);
+        model->vp_uniform = NULL;
+        model->vs_uniform = NULL;
+        model->dem_uniform = NULL;
+        return FAIL;
+    }
+    return SUCCESS;
+}
+
+/**
+ * Returns the value of a grid at fractional indices if they fall in one of
+ * its uniform cells, the fast path of _linthurber_getval.
+ *
+ * @param i The fractional x index.
+ * @param j The fractional y index.
+ * @param k The fractional z index.
+ * @param prop LINTHURBER_DEM, LINTHURBER_VP or LINTHURBER_VS.
+ * @param val The value returned.
+ * @return SUCCESS, or FAIL if the cell is not uniform or outside of the grid.
+ */
+int _linthurber_uniform_value(double i, double j, double k, int prop, double *val) {
+    linthurber_configuration_t *config = linthurber_configuration;
+    linthurber_model_t *model = linthurber_velocity_model;
+    unsigned char *map;
+    float *buf;
+    int *dims;
+    int i0 = (int)i, j0 = (int)j, k0 = (int)k;
+    int a = round(i), b = round(j), c = round(k);
+    size_t n;
+
+    switch (prop) {
+    case LINTHURBER_DEM:
+        dims = config->dem_dims;
+        buf = model->dem;
+        map = model->dem_uniform;
+        break;
+    case LINTHURBER_VP:
+        dims = config->vp_dims;
+        buf = model->vp;
+        map = model->vp_uniform;
+        break;
+    case LINTHURBER_VS:
+        dims = config->vs_dims;
+        buf = model->vs;
+        map = model->vs_uniform;
+        break;
+    default:
+        return FAIL;
+    }
+    if (map == NULL) return FAIL;
+
+    /* The bounds of _linthurber_getcell */
+    if ((a < 0) || (b < 0) || (c < 0) ||
+        (a >= dims[0]) || (b >= dims[1]) || (c >= dims[2])) return FAIL;
+
+    linthurber_uniform_evals++;
+    n = ((size_t)k0 * dims[1] + j0) * dims[0] + i0;
+    if (!LINTHURBER_UNIFORM(map, n)) return FAIL;
+    linthurber_uniform_hits++;
+    *val = buf[LINTHURBER_NODE(dims, i0, j0, k0)];
+    return SUCCESS;
+}
+
+/**
+ * Adds the calling thread's counts to the global counters, when it leaves
+ * a query.
+ */
+void _linthurber_uniform_flush() {
+    if (linthurber_uniform_evals == 0) return;
+    __atomic_fetch_add(&linthurber_uniform_total_evals, linthurber_uniform_evals, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&linthurber_uniform_total_hits, linthurber_uniform_hits, __ATOMIC_RELAXED);
+    linthurber_uniform_evals = 0;
+    linthurber_uniform_hits = 0;
+}
+
+/**
+ * Returns how many trilinear evaluations consulted the uniform cell bitmaps
+ * over all threads since the last reset, and how many of them fell in a
+ * uniform cell and returned its corner.
+ *
+ * @param evals The number of evaluations returned.
+ * @param hits The number of uniform cells returned.
+ * @return SUCCESS
+ */
+int linthurber_get_uniform_stats(long *evals, long *hits) {
+    *evals = __atomic_load_n(&linthurber_uniform_total_evals, __ATOMIC_RELAXED);
+    *hits = __atomic_load_n(&linthurber_uniform_total_hits, __ATOMIC_RELAXED);
+    return SUCCESS;
+}
+
+/**
+ * Clears the uniform cell counters.
+ *
+ * @return SUCCESS
+ */
+int linthurber_reset_uniform_stats() {
+    __atomic_store_n(&linthurber_uniform_total_evals, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&linthurber_uniform_total_hits, 0, __ATOMIC_RELAXED);
+    return SUCCESS;
+}
@@ -0,0 +1,211 @@
+/*
+ * @file linthurber_warmup.c
+ * @brief Prefaulting of the LINTHURBER model memory.
+ * @author - SCEC
+ * @version 1.0.1
+ *
+ * Pages of the model buffers that a process has not touched yet, such as
+ * the node shared MPI window on ranks other than the first, or buffers
+ * swapped out since the load, fault on the first queries that read them.
+ * With warmup = background in the model configuration, a thread touches
+ * every page of every buffer queries read as soon as a model is loaded,
+ * while queries are already being served; with warmup = block the load
+ * does so before it returns. mlock = on also locks the buffers in memory,
+ * and huge_pages = on asks for transparent huge pages, which are in place
+ * from the start for the node grids and collapsed later for the rest.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "linthurber.h"
+
+/** Size of a transparent huge page */
+#define LINTHURBER_HUGE_PAGE (2UL << 20)
+
+/** Pages touched between checks for a background warmup to stop */
+#define LINTHURBER_WARMUP_BATCH 256
+
+/** Most buffers of one state: grids, site map, pyramid levels, cells, coefficients, bitmaps */
+#define LINTHURBER_WARMUP_BUFFERS (4 + 3 * LINTHURBER_MAX_LOD + 4 + 3)
+
+/**
+ * Allocates a model grid of len floats, aligned to and advised for huge
+ * pages if the configuration asks for them. Free it with free().
+ *
+ * @param config The model configuration.
+ * @param len The number of floats.
+ * @return The grid, or NULL if it cannot be allocated.
+ */
+float *_linthurber_grid_alloc(linthurber_configuration_t *config, size_t len) {
+    size_t size = len * sizeof(float);
+    void *ptr;
+
+    if (!config->huge_pages) return malloc(size);
+    if (posix_memalign(&ptr, LINTHURBER_HUGE_PAGE, size) != 0) return NULL;
+#ifdef MADV_HUGEPAGE
+    /* Only whole huge pages, the tail may be shared with other allocations */
+    if (size >= LINTHURBER_HUGE_PAGE) {
+        madvise(ptr, size & ~(LINTHURBER_HUGE_PAGE - 1), MADV_HUGEPAGE);
+    }
+#endif
+    return ptr;
+}
+
+/**
+ * Lists the buffers queries on a state read.
+ *
+ * @param state The state.
+ * @param buf The buffers returned.
+ * @param size Their sizes in bytes.
+ * @return The number of buffers.
+ */
+int _linthurber_warmup_buffers(linthurber_state_t *state, void **buf, size_t *size) {
+    linthurber_configuration_t *config = state->config;
+    linthurber_model_t *model = state->model;
+    linthurber_pyramid_t *pyr[3] = { &model->vp_lod, &model->vs_lod, &model->dem_lod };
+    size_t vp_cells = (size_t)config->vp_dims[0] * config->vp_dims[1] * config->vp_dims[2];
+    size_t vs_cells = (size_t)config->vs_dims[0] * config->vs_dims[1] * config->vs_dims[2];
+    size_t dem_cells = (size_t)config->dem_dims[0] * config->dem_dims[1] * config->dem_dims[2];
+    int n = 0, g, l;
+
+#define LINTHURBER_WARMUP_ADD(b, s) if (b) { buf[n] = (b); size[n] = (s); n++; }
+    LINTHURBER_WARMUP_ADD(model->vp, model->vp_len * sizeof(float));
+    LINTHURBER_WARMUP_ADD(model->vs, model->vs_len * sizeof(float));
+    LINTHURBER_WARMUP_ADD(model->dem, model->dem_len * sizeof(float));
+    LINTHURBER_WARMUP_ADD(model->site, model->site_len * sizeof(float));
+    for (g = 0; g < 3; g++) {
+        /* Level 0 is the grid itself */
+        for (l = 1; l < pyr[g]->levels; l++) {
+            LINTHURBER_WARMUP_ADD(pyr[g]->buf[l], _linthurber_grid_len(pyr[g]->dims[l]) * sizeof(float));
+        }
+    }
+    LINTHURBER_WARMUP_ADD(model->vp_cells, vp_cells * LINTHURBER_CELL_SIZE * sizeof(float));
+    LINTHURBER_WARMUP_ADD(model->vs_cells, vs_cells * LINTHURBER_CELL_SIZE * sizeof(float));
+    LINTHURBER_WARMUP_ADD(model->vp_coef, vp_cells * LINTHURBER_CUBIC_SIZE * sizeof(float));
+    LINTHURBER_WARMUP_ADD(model->vs_coef, vs_cells * LINTHURBER_CUBIC_SIZE * sizeof(float));
+    LINTHURBER_WARMUP_ADD(model->vp_uniform, (vp_cells + 7) / 8);
+    LINTHURBER_WARMUP_ADD(model->vs_uniform, (vs_cells + 7) / 8);
+    LINTHURBER_WARMUP_ADD(model->dem_uniform, (dem_cells + 7) / 8);
+#undef LINTHURBER_WARMUP_ADD
+    return n;
+}
+
+/**
+ * Locks, advises and touches every page of the buffers of a state, giving
+ * up as soon as the state is replaced, so that a reload or finalize does
+ * not wait for the rest of a model no query will read.
+ *
+ * @return The number of pages touched.
+ */
+size_t _linthurber_warmup_run(linthurber_state_t *state) {
+    void *buf[LINTHURBER_WARMUP_BUFFERS];
+    size_t size[LINTHURBER_WARMUP_BUFFERS];
+    size_t page = sysconf(_SC_PAGESIZE), pages = 0, off;
+    volatile char sink;
+    int b, n;
+
+    n = _linthurber_warmup_buffers(state, buf, size);
+    for (b = 0; b < n; b++) {
+        if (__atomic_load_n(&state->retired, __ATOMIC_RELAXED)) break;
+        if (state->config->mlock && (mlock(buf[b], size[b]) != 0)) {
+            fprintf(stderr, "WARNING: Could not lock %zu bytes of the model in memory.\n", size[b]);
+        }
+#ifdef MADV_HUGEPAGE
+        if (state->config->huge_pages) {
+            /* The whole huge pages inside the buffer */
+            off = ((size_t)buf[b] + LINTHURBER_HUGE_PAGE - 1) & ~(LINTHURBER_HUGE_PAGE - 1);
+            if (off + LINTHURBER_HUGE_PAGE <= (size_t)buf[b] + size[b]) {
+                madvise((void *)off, ((size_t)buf[b] + size[b] - off) & ~(LINTHURBER_HUGE_PAGE - 1),
+                        MADV_HUGEPAGE);
+            }
+        }
+#endif
+        /* A read is enough to map a page that is already backed */
+        for (off = 0; off < size[b]; off += page, pages++) {
+            if (((pages % LINTHURBER_WARMUP_BATCH) == 0) &&
+                __atomic_load_n(&state->retired, __ATOMIC_RELAXED)) break;
+            sink = ((volatile char *)buf[b])[off];
+        }
+    }
+    (void)sink;
+    return pages;
+}
+
+void *_linthurber_warmup_thread(void *arg) {
+    linthurber_state_t *state = arg;
+
+    _linthurber_warmup_run(state);
+    __atomic_store_n(&state->warm, 1, __ATOMIC_RELEASE);
+    __atomic_fetch_sub(&state->refs, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/**
+ * Warms up a loaded state as its configuration asks: not at all, in a
+ * background thread, or before returning. Called before the state is
+ * published; a background warmup holds a reference, so a reload waits
+ * for it before freeing the state, but it stops within a batch of pages
+ * once the state is replaced.
+ *
+ * @param state The state.
+ */
+void _linthurber_warmup_start(linthurber_state_t *state) {
+    pthread_t thread;
+
+    switch (state->config->warmup) {
+    case LINTHURBER_WARMUP_BACKGROUND:
+        __atomic_fetch_add(&state->refs, 1, __ATOMIC_ACQUIRE);
+        if (pthread_create(&thread, NULL, _linthurber_warmup_thread, state) == 0) {
+            pthread_detach(thread);
+            return;
+        }
+        /* No thread, warm up here instead */
+        __atomic_fetch_sub(&state->refs, 1, __ATOMIC_RELEASE);
+        _linthurber_warmup_run(state);
+        break;
+    case LINTHURBER_WARMUP_BLOCK:
+        _linthurber_warmup_run(state);
+        break;
+    default:
+        break;
+    }
+    __atomic_store_n(&state->warm, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Unlocks the buffers of a state that is about to be freed, if they were
+ * locked. Freed heap memory would otherwise stay locked.
+ *
+ * @param state The state.
+ */
+void _linthurber_warmup_release(linthurber_state_t *state) {
+    void *buf[LINTHURBER_WARMUP_BUFFERS];
+    size_t size[LINTHURBER_WARMUP_BUFFERS];
+    int b, n;
+
+    if ((state->config == NULL) || (state->model == NULL) || !state->config->mlock) return;
+    n = _linthurber_warmup_buffers(state, buf, size);
+    for (b = 0; b < n; b++) munlock(buf[b], size[b]);
+}
+
+/**
+ * Waits until the memory of the current model has been warmed up, for
+ * services that use warmup = background but must not answer their first
+ * requests before it is done. Returns at once with any other setting.
+ *
+ * @return SUCCESS, or FAIL if no model is loaded.
+ */
+int linthurber_wait_warm() {
+    linthurber_state_t *state;
+
+    if (_linthurber_state_enter(NULL) != SUCCESS) return FAIL;
+    state = _linthurber_state_view();
+    while (!__atomic_load_n(&state->warm, __ATOMIC_ACQUIRE)) usleep(1000);
+    _linthurber_state_exit();
+    return SUCCESS;
+}
@@ -0,0 +1,320 @@
+/**
+ * @file linthurberd.c
+ * @brief Query daemon for the LINTHURBER model.
+ * @author - SCEC
+ * @version 1.0.1
+ *
+ * Loads the model once and serves linthurber_query over a Unix domain
+ * socket, using the protocol in linthurber_client.h. Each connection has a
+ * reader thread that keeps accepting requests while earlier ones are being
+ * evaluated, and pushes them onto a shared job queue. A pool of worker
+ * threads runs the queries and writes each response as soon as it is done,
+ * so several requests of one client are evaluated at once. SIGHUP reloads
+ * the model in the background while requests keep being served.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "linthurber.h"
+#include "linthurber_client.h"
+
+/** A client connection, freed when its reader and all its jobs are done. */
+typedef struct linthurber_conn_t {
+     int fd;
+     /** Reader plus queued or running jobs */
+     int refs;
+     /** Serializes responses */
+     pthread_mutex_t write_lock;
+} linthurber_conn_t;
+
+/** One request waiting for a worker. */
+typedef struct linthurber_job_t {
+     linthurber_conn_t *conn;
+     linthurber_wire_header_t header;
+     linthurber_point_t *points;
+     struct linthurber_job_t *next;
+} linthurber_job_t;
+
+/** FIFO of jobs shared by all connections. */
+linthurber_job_t *job_head = NULL;
+linthurber_job_t *job_tail = NULL;
+pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t job_cond = PTHREAD_COND_INITIALIZER;
+
+pthread_mutex_t conn_lock = PTHREAD_MUTEX_INITIALIZER;
+
+volatile sig_atomic_t daemon_stop = 0;
+volatile sig_atomic_t daemon_reload = 0;
+
+/** Model location, for reloads */
+char *daemon_dir;
+char *daemon_label;
+
+void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s -d ucvm_dir [-l label] [-s socket] [-t workers]\n", prog);
+}
+
+void _on_signal(int sig) {
+    if (sig == SIGHUP) {
+        daemon_reload = 1;
+    } else {
+        daemon_stop = 1;
+    }
+}
+
+/**
+ * Reloads the model off the accept loop; queries keep running meanwhile.
+ */
+void *_reloader(void *arg) {
+    (void)arg;
+    if (linthurber_reload(daemon_dir, daemon_label) == SUCCESS) {
+        printf("linthurberd reloaded the model\n");
+    } else {
+        fprintf(stderr, "Reload failed, still serving the previous model\n");
+    }
+    fflush(stdout);
+    return NULL;
+}
+
+/**
+ * Drops one reference to a connection, closing it with the last one.
+ */
+void _conn_release(linthurber_conn_t *conn) {
+    int refs;
+
+    pthread_mutex_lock(&conn_lock);
+    refs = --conn->refs;
+    pthread_mutex_unlock(&conn_lock);
+    if (refs == 0) {
+        close(conn->fd);
+        pthread_mutex_destroy(&conn->write_lock);
+        free(conn);
+    }
+}
+
+void _job_push(linthurber_job_t *job) {
+    job->next = NULL;
+    pthread_mutex_lock(&job_lock);
+    if (job_tail) {
+        job_tail->next = job;
+    } else {
+        job_head = job;
+    }
+    job_tail = job;
+    pthread_cond_signal(&job_cond);
+    pthread_mutex_unlock(&job_lock);
+}
+
+linthurber_job_t *_job_pop() {
+    linthurber_job_t *job;
+
+    pthread_mutex_lock(&job_lock);
+    while (job_head == NULL) pthread_cond_wait(&job_cond, &job_lock);
+    job = job_head;
+    job_head = job->next;
+    if (job_head == NULL) job_tail = NULL;
+    pthread_mutex_unlock(&job_lock);
+    return job;
+}
+
+/**
+ * Worker body. Evaluates requests and sends their responses.
+ */
+void *_worker(void *arg) {
+    linthurber_query_desc_t desc;
+    double *vals = NULL;
+    linthurber_job_t *job;
+    int n;
+
+    (void)arg;
+    vals = malloc(LINTHURBER_WIRE_MAX_POINTS * LINTHURBER_WIRE_NPROP * sizeof(double));
+    if (vals == NULL) {
+        fprintf(stderr, "Failed to allocate worker buffers\n");
+        exit(1);
+    }
+
+    /* Results go straight into the response, vp, vs and rho per point */
+    desc.point_stride = sizeof(linthurber_point_t);
+    desc.lon_offset = offsetof(linthurber_point_t, longitude);
+    desc.lat_offset = offsetof(linthurber_point_t, latitude);
+    desc.depth_offset = offsetof(linthurber_point_t, depth);
+    desc.data = vals;
+    desc.data_stride = LINTHURBER_WIRE_NPROP * sizeof(double);
+    desc.vp_offset = 0;
+    desc.vs_offset = sizeof(double);
+    desc.rho_offset = 2 * sizeof(double);
+
+    while (1) {
+        job = _job_pop();
+        n = job->header.numpoints;
+        desc.points = job->points;
+        job->header.status = linthurber_query_strided(&desc, n, LINTHURBER_DEPTH_DEFAULT);
+
+        /* A failed write means the client is gone; its reader cleans up */
+        pthread_mutex_lock(&job->conn->write_lock);
+        if (_linthurber_write_full(job->conn->fd, &job->header, sizeof(job->header)) == SUCCESS) {
+            _linthurber_write_full(job->conn->fd, vals, n * LINTHURBER_WIRE_NPROP * sizeof(double));
+        }
+        pthread_mutex_unlock(&job->conn->write_lock);
+
+        _conn_release(job->conn);
+        free(job->points);
+        free(job);
+    }
+    return NULL;
+}
+
+/**
+ * Connection reader. Queues every request of a client until it hangs up
+ * or sends something malformed.
+ */
+void *_reader(void *arg) {
+    linthurber_conn_t *conn = arg;
+    linthurber_wire_header_t header;
+    linthurber_job_t *job;
+
+    while (_linthurber_read_full(conn->fd, &header, sizeof(header)) == SUCCESS) {
+        if ((header.magic != LINTHURBER_WIRE_MAGIC) ||
+            (header.numpoints > LINTHURBER_WIRE_MAX_POINTS)) {
+            fprintf(stderr, "Dropping client after a malformed request\n");
+            break;
+        }
+        job = malloc(sizeof(linthurber_job_t));
+        if (job == NULL) break;
+        job->points = malloc((header.numpoints + 1) * sizeof(linthurber_point_t));
+        if ((job->points == NULL) ||
+            (_linthurber_read_full(conn->fd, job->points,
+                                   header.numpoints * sizeof(linthurber_point_t)) != SUCCESS)) {
+            free(job->points);
+            free(job);
+            break;
+        }
+        job->conn = conn;
+        job->header = header;
+
+        pthread_mutex_lock(&conn_lock);
+        conn->refs++;
+        pthread_mutex_unlock(&conn_lock);
+        _job_push(job);
+    }
+
+    /* Stop taking requests; queued ones are still answered */
+    shutdown(conn->fd, SHUT_RD);
+    _conn_release(conn);
+    return NULL;
+}
+
+/**
+ * Serves queries until interrupted.
+ *
+ * @param argc The number of arguments.
+ * @param argv The argument strings.
+ * @return Zero on success.
+ */
+int main(int argc, char **argv) {
+    char *dir = NULL, *label = "linthurber", *path = LINTHURBER_SOCKET_PATH;
+    struct sockaddr_un addr;
+    struct sigaction sa;
+    linthurber_conn_t *conn;
+    pthread_t thread;
+    int opt, i, fd, lfd, nworkers = 0;
+
+    while ((opt = getopt(argc, argv, "d:l:s:t:")) != -1) {
+        switch (opt) {
+        case 'd':
+            dir = optarg;
+            break;
+        case 'l':
+            label = optarg;
+            break;
+        case 's':
+            path = optarg;
+            break;
+        case 't':
+            nworkers = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if ((dir == NULL) || (nworkers < 0) || (strlen(path) >= sizeof(addr.sun_path))) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (nworkers == 0) nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nworkers < 1) nworkers = 1;
+
+    daemon_dir = dir;
+    daemon_label = label;
+    if (linthurber_init(dir, label) != SUCCESS) {
+        fprintf(stderr, "Failed to initialize the model\n");
+        return 1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if ((lfd < 0) || (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) != 0) ||
+        (listen(lfd, 64) != 0)) {
+        fprintf(stderr, "Failed to listen on %s\n", path);
+        linthurber_finalize();
+        return 1;
+    }
+
+    /* Let accept() return on SIGINT/SIGTERM/SIGHUP; ignore writes to gone clients */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = _on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGHUP, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    for (i = 0; i < nworkers; i++) {
+        if (pthread_create(&thread, NULL, _worker, NULL) != 0) {
+            fprintf(stderr, "Failed to start worker %d\n", i);
+            return 1;
+        }
+        pthread_detach(thread);
+    }
+    printf("linthurberd serving on %s with %d workers\n", path, nworkers);
+    fflush(stdout);
+
+    while (!daemon_stop) {
+        if (daemon_reload) {
+            daemon_reload = 0;
+            if (pthread_create(&thread, NULL, _reloader, NULL) == 0) pthread_detach(thread);
+        }
+        fd = accept(lfd, NULL, NULL);
+        if (fd < 0) continue;
+
+        conn = malloc(sizeof(linthurber_conn_t));
+        if (conn == NULL) {
+            close(fd);
+            continue;
+        }
+        conn->fd = fd;
+        conn->refs = 1;
+        pthread_mutex_init(&conn->write_lock, NULL);
+        if (pthread_create(&thread, NULL, _reader, conn) != 0) {
+            _conn_release(conn);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+
+    close(lfd);
+    unlink(path);
+    return 0;
+}
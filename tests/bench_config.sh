@@ -0,0 +1,50 @@
+#!/bin/bash
+#
+# Compares query throughput across values of one model config setting.
+#
+#   ./bench_config.sh key value... [-- ucvm_dir [points]]
+#
+# e.g. ./bench_config.sh layout grid packed
+#      ./bench_config.sh interpolation nearest bilinear trilinear
+#
+# Makes a copy of the installed model in BENCH_DIR (default /tmp) for each
+# value, differing only in that setting and with the data files linked
+# rather than copied, and runs bench_query on each.
+
+KEY=$1
+shift
+VALUES=""
+while [[ $# -gt 0 && $1 != "--" ]]; do
+  VALUES="${VALUES} $1"
+  shift
+done
+[[ $1 == "--" ]] && shift
+UCVM_DIR=${1:-${UCVM_INSTALL_PATH:-..}}
+NPOINTS=${2:-1000000}
+BENCH_DIR=${BENCH_DIR:-/tmp}
+BENCH=./bench_query
+DATA=${UCVM_DIR}/model/linthurber/data
+
+if [[ -z ${KEY} || -z ${VALUES} ]]; then
+  echo "Usage: $0 key value... [-- ucvm_dir [points]]"
+  exit 1
+fi
+if [[ ! -x ${BENCH} ]]; then
+  echo "${BENCH} not found, build the tests first"
+  exit 1
+fi
+
+MODEL_DIR=`grep "^model_dir" ${DATA}/config | sed 's/.*= *//; s/ *$//'`
+WORK=${BENCH_DIR}/linthurber_config_$$
+
+for value in ${VALUES}; do
+  mkdir -p ${WORK}/${value}/model/linthurber/data
+  ln -s `cd ${DATA}/${MODEL_DIR} && pwd` ${WORK}/${value}/model/linthurber/data/${MODEL_DIR}
+  grep -v "^${KEY} *=" ${DATA}/config > ${WORK}/${value}/model/linthurber/data/config
+  echo "${KEY} = ${value}" >> ${WORK}/${value}/model/linthurber/data/config
+
+  echo "== ${KEY} = ${value}"
+  ${BENCH} -d ${WORK}/${value} -l linthurber -n ${NPOINTS}
+done
+
+rm -rf ${WORK}
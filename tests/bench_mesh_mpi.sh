@@ -0,0 +1,42 @@
+#!/bin/bash
+#
+# Strong and weak scaling benchmark for linthurber_mesh_mpi on one machine.
+#
+#   ./bench_mesh_mpi.sh [max_ranks] [ucvm_dir]
+#
+# Strong scaling keeps a 400x300x200 mesh fixed while the rank count grows,
+# weak scaling gives every rank a 400x300x50 slab. Output files are written
+# to BENCH_DIR (default /tmp) and removed afterwards.
+
+MAX_NP=${1:-4}
+UCVM_DIR=${2:-${UCVM_INSTALL_PATH:-..}}
+BENCH_DIR=${BENCH_DIR:-/tmp}
+MPIRUN=${MPIRUN:-mpirun}
+MESH=../src/linthurber_mesh_mpi
+OUT=${BENCH_DIR}/linthurber_bench_$$.awp
+
+if [[ ! -x ${MESH} ]]; then
+  echo "${MESH} not found, configure with --enable-mpi and build first"
+  exit 1
+fi
+
+NP_LIST=""
+np=1
+while [[ ${np} -le ${MAX_NP} ]]; do
+  NP_LIST="${NP_LIST} ${np}"
+  np=$((np * 2))
+done
+
+echo "== strong scaling, 400x300x200 nodes"
+for np in ${NP_LIST}; do
+  ${MPIRUN} -np ${np} ${MESH} -d ${UCVM_DIR} -l linthurber -o -121.0,35.0 \
+      -n 400,300,200 -h 500 ${OUT} | grep ranks
+done
+
+echo "== weak scaling, 400x300x50 nodes per rank"
+for np in ${NP_LIST}; do
+  ${MPIRUN} -np ${np} ${MESH} -d ${UCVM_DIR} -l linthurber -o -121.0,35.0 \
+      -n 400,300,$((50 * np)) -h 500 ${OUT} | grep ranks
+done
+
+rm -f ${OUT}
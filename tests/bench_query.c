@@ -0,0 +1,143 @@
+/**
+ * @file bench_query.c
+ * @brief Single-thread query throughput of the LINTHURBER model.
+ * @author - SCEC
+ * @version 1.0.1
+ *
+ * Times linthurber_query on two workloads: scattered points at random
+ * positions and depths, and a coherent mesh walked x fastest, one depth
+ * plane after another. Run it against model installs that differ only in
+ * their configuration to compare storage layouts or builds, or force an
+ * instruction set level of the kernels with -i (0 baseline to 3 AVX-512).
+ *
+ *   bench_query -d ucvm_dir [-l label] [-n points] [-r repeats] [-i level]
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "linthurber.h"
+
+/** Region sampled by both workloads, inside the model */
+#define BENCH_LON0 -126.0
+#define BENCH_LON1 -113.5
+#define BENCH_LAT0 31.0
+#define BENCH_LAT1 42.0
+#define BENCH_DEPTH 45000.0
+
+double _bench_now() {
+    struct timeval t;
+
+    gettimeofday(&t, NULL);
+    return t.tv_sec + t.tv_usec / 1.0e6;
+}
+
+/**
+ * Runs repeats queries of the points and prints the best time per point.
+ */
+void _bench_run(const char *name, linthurber_point_t *points, linthurber_properties_t *data,
+                int n, int repeats) {
+    double t, best = -1.0;
+    int r;
+
+    for (r = 0; r < repeats; r++) {
+        t = _bench_now();
+        linthurber_query(points, data, n);
+        t = _bench_now() - t;
+        if ((best < 0.0) || (t < best)) best = t;
+    }
+    printf("%-10s %9d points %8.1f ns/point %8.2f Mpoints/s\n", name, n,
+           best * 1.0e9 / n, n / best / 1.0e6);
+}
+
+int main(int argc, char **argv) {
+    char *dir = NULL, *label = "linthurber";
+    const char *isa;
+    linthurber_point_t *points;
+    linthurber_properties_t *data;
+    int opt, n = 1000000, repeats = 5, level = LINTHURBER_ISA_AUTO, nx, ny, nz, i, j, k, p;
+
+    while ((opt = getopt(argc, argv, "d:l:n:r:i:")) != -1) {
+        switch (opt) {
+        case 'd':
+            dir = optarg;
+            break;
+        case 'l':
+            label = optarg;
+            break;
+        case 'n':
+            n = atoi(optarg);
+            break;
+        case 'r':
+            repeats = atoi(optarg);
+            break;
+        case 'i':
+            level = atoi(optarg);
+            break;
+        default:
+            dir = NULL;
+            break;
+        }
+    }
+    if ((dir == NULL) || (n < 1000) || (repeats < 1)) {
+        fprintf(stderr, "Usage: %s -d ucvm_dir [-l label] [-n points] [-r repeats] [-i level]\n",
+                argv[0]);
+        return 1;
+    }
+    if (linthurber_set_isa(level) != SUCCESS) {
+        fprintf(stderr, "This CPU does not support instruction set level %d\n", level);
+        return 1;
+    }
+
+    if (linthurber_init(dir, label) != SUCCESS) {
+        fprintf(stderr, "Failed to initialize the model\n");
+        return 1;
+    }
+    linthurber_set_num_threads(1);
+    linthurber_get_isa(&isa);
+    printf("kernels: %s\n", isa);
+
+    points = malloc(n * sizeof(linthurber_point_t));
+    data = malloc(n * sizeof(linthurber_properties_t));
+    if ((points == NULL) || (data == NULL)) {
+        fprintf(stderr, "Failed to allocate %d points\n", n);
+        return 1;
+    }
+
+    /* Every position is new, so the column cache only adds overhead */
+    linthurber_set_column_cache(0);
+    srand(1);
+    for (p = 0; p < n; p++) {
+        points[p].longitude = BENCH_LON0 + (BENCH_LON1 - BENCH_LON0) * rand() / RAND_MAX;
+        points[p].latitude = BENCH_LAT0 + (BENCH_LAT1 - BENCH_LAT0) * rand() / RAND_MAX;
+        points[p].depth = BENCH_DEPTH * rand() / RAND_MAX;
+    }
+    _bench_run("scattered", points, data, n, repeats);
+
+    /* A mesh of about n nodes with 20 depth planes */
+    linthurber_set_column_cache(2048);
+    nz = 20;
+    nx = 1;
+    while ((nx + 1) * (nx + 1) * nz <= n) nx++;
+    ny = nx;
+    p = 0;
+    for (k = 0; k < nz; k++) {
+        for (j = 0; j < ny; j++) {
+            for (i = 0; i < nx; i++) {
+                points[p].longitude = BENCH_LON0 + (BENCH_LON1 - BENCH_LON0) * i / nx;
+                points[p].latitude = BENCH_LAT0 + (BENCH_LAT1 - BENCH_LAT0) * j / ny;
+                points[p].depth = BENCH_DEPTH * k / nz;
+                p++;
+            }
+        }
+    }
+    _bench_run("coherent", points, data, p, repeats);
+
+    free(points);
+    free(data);
+    linthurber_finalize();
+    return 0;
+}
@@ -1,9 +1,49 @@
 #!/bin/bash
+#
+# Runs test_linthurber against the model installed under a UCVM directory,
+# the first argument, or UCVM_INSTALL_PATH, or the parent directory. A
+# linthurberd serving the same model is started for the daemon test, the
+# mesh tools are run from ../src, and the specialized library built for the
+# model is compared with the generic one.
 
-if [[ -z "${UCVM_INSTALL_PATH}" ]]; then
-  if [[ -f "${UCVM_INSTALL_PATH}/model/linthurber/lib" ]]; then
-    env DYLD_LIBRARY_PATH=${UCVM_INSTALL_PATH}/model/linthurber/lib ./test_linthurber
-    exit
+UCVM_DIR=${1:-${UCVM_INSTALL_PATH:-..}}
+SOCKET=/tmp/linthurberd_test.$$.sock
+
+../src/linthurberd -d ${UCVM_DIR} -s ${SOCKET} &
+DAEMON=$!
+
+# The socket appears once the model is loaded
+for i in $(seq 1 60); do
+  if [[ -S ${SOCKET} ]] || ! kill -0 ${DAEMON} 2>/dev/null; then
+    break
   fi
+  sleep 1
+done
+if [[ -S ${SOCKET} ]]; then
+  export LINTHURBER_TEST_SOCKET=${SOCKET}
 fi
-env DYLD_LIBRARY_PATH=../src ./test_linthurber
+
+# The mesh test runs the tools against the same model
+export LINTHURBER_TEST_TOOLS=../src
+
+./test_linthurber ${UCVM_DIR}
+STATUS=$?
+
+# The specialized library must answer as the generic one, bit for bit
+if [[ ${STATUS} -eq 0 && -x ./test_linthurber_dump_fixed ]]; then
+  ./test_linthurber_dump ${UCVM_DIR} /tmp/linthurber_dump.$$ 0 &&
+    ./test_linthurber_dump_fixed ${UCVM_DIR} /tmp/linthurber_dump_fixed.$$ 1 &&
+    cmp /tmp/linthurber_dump.$$ /tmp/linthurber_dump_fixed.$$
+  STATUS=$?
+  rm -f /tmp/linthurber_dump.$$ /tmp/linthurber_dump_fixed.$$
+fi
+
+# And the MPI initialization, when make check names a launcher
+if [[ ${STATUS} -eq 0 && -n "${LINTHURBER_TEST_MPIRUN}" ]]; then
+  ${LINTHURBER_TEST_MPIRUN} ./test_linthurber_mpi ${UCVM_DIR}
+  STATUS=$?
+fi
+
+kill ${DAEMON} 2>/dev/null
+wait ${DAEMON} 2>/dev/null
+exit ${STATUS}
@@ -10,9 +10,1248 @@
  */
 
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
+#include <math.h>
+#include <pthread.h>
+#include <limits.h>
+#include <unistd.h>
+#include "ucvm_utils.h"
 #include "linthurber.h"
+#include "linthurber_client.h"
+#include "linthurber_mesh.h"
+#include "test_util.h"
+
+/**
+ * Tells whether a site map value agrees with the computed one, within
+ * the rounding of the raster to floats and of the projection round trip.
+ */
+int site_close(double map, double full) {
+	return fabs(map - full) <= 1.0e-3 * fabs(full) + 1.0e-2;
+}
+
+/**
+ * Tests that the analytic gradient agrees with central differences, in
+ * the default depth mode and below sea level.
+ *
+ * @param pt The point to test at.
+ */
+void test_gradient(linthurber_point_t pt) {
+	linthurber_point_t fd[2], msl;
+	linthurber_properties_t ret, fdret[2];
+	linthurber_gradient_t grad;
+
+	assert(linthurber_query_gradient(&pt, &ret, &grad, 1, LINTHURBER_GRAD_GEO) == 0);
+	fd[0] = pt;
+	fd[1] = pt;
+	fd[0].latitude -= 1.0e-5;
+	fd[1].latitude += 1.0e-5;
+	linthurber_query(fd, fdret, 2);
+	assert(fabs((fdret[1].vp - fdret[0].vp) / 2.0e-5 - grad.vp[1]) <
+	       1.0e-3 * (fabs(grad.vp[1]) + 1.0));
+
+	// And so in the other depth modes, here along depth below sea level.
+	assert(linthurber_set_depth_mode(LINTHURBER_DEPTH_MSL) == 0);
+	fd[0] = pt;
+	fd[1] = pt;
+	fd[0].depth = 3000.0 - 1.0;
+	fd[1].depth = 3000.0 + 1.0;
+	msl = pt;
+	msl.depth = 3000.0;
+	assert(linthurber_query_gradient(&msl, &ret, &grad, 1, LINTHURBER_GRAD_GEO) == 0);
+	linthurber_query(fd, fdret, 2);
+	assert(fabs((fdret[1].vp - fdret[0].vp) / 2.0 - grad.vp[2]) <
+	       1.0e-3 * (fabs(grad.vp[2]) + 1.0));
+	assert(linthurber_set_depth_mode(LINTHURBER_DEPTH_SURFACE) == 0);
+
+	printf("Gradient query was successful.\n");
+}
+
+/**
+ * Tests that a failed reload leaves the current model in place.
+ *
+ * @param dir The UCVM directory.
+ * @param pt The point to test at.
+ */
+void test_failed_reload(const char *dir, linthurber_point_t pt) {
+	linthurber_properties_t before, ret;
+	char *cfg, cfgcopy[LINTHURBER_CONFIG_MAX];
+	int cfgsz;
+
+	linthurber_query(&pt, &before, 1);
+	assert(linthurber_config(&cfg, &cfgsz) == 0);
+	strcpy(cfgcopy, cfg);
+	assert(linthurber_reload(dir, "no-such-model") != 0);
+	linthurber_query(&pt, &ret, 1);
+	assert((ret.vp == before.vp) && (ret.vs == before.vs));
+	assert(linthurber_config(&cfg, &cfgsz) == 0);
+	assert(strcmp(cfg, cfgcopy) == 0);
+
+	printf("Failed reload was harmless.\n");
+}
+
+/**
+ * Tests that the site map agrees with query_site at its raster nodes,
+ * the last row and column included. The map is built into a variant of
+ * the installed model, where loading it leaves the installed one alone.
+ *
+ * @param dir The UCVM directory.
+ */
+void test_sitemap(const char *dir) {
+	char sitefile[2 * PATH_MAX], variant[PATH_MAX];
+	linthurber_configuration_t *config;
+	linthurber_point_t nodes[16];
+	linthurber_site_t full[16], map[16];
+	double spacing;
+	int i, j, n = 0;
+	FILE *fp;
+
+	// Not through a link to a map the installed model may have.
+	make_variant(dir, "", variant);
+	assert(linthurber_reload(variant, "linthurber") == 0);
+	assert(_linthurber_state_enter(NULL) == 0);
+	sprintf(sitefile, "%s/lin-thurber.site", _linthurber_state_view()->config->data_directory);
+	_linthurber_state_exit();
+	remove(sitefile);
+	assert(linthurber_build_sitemap(NULL) == 0);
+	assert(linthurber_reload(variant, "linthurber") == 0);
+	assert(_linthurber_state_enter(NULL) == 0);
+	config = _linthurber_state_view()->config;
+	spacing = 2.0 * config->spacing_vp;
+	for (j = 0; j < 4; j++) {
+		for (i = 0; i < 4; i++, n++) {
+			bilinear_xy2geo(&config->proj,
+			                (i * (config->vp_dims[0] - 1) / 3) * config->spacing_vp,
+			                (j * (config->vp_dims[1] - 1) / 3) * config->spacing_vp,
+			                &nodes[n].longitude, &nodes[n].latitude);
+			nodes[n].depth = 0;
+		}
+	}
+	_linthurber_state_exit();
+	assert(linthurber_query_site(nodes, full, n) == 0);
+	assert(linthurber_query_sitemap(nodes, map, n) == 0);
+	for (i = 0; i < n; i++) {
+		assert(site_close(map[i].vs30, full[i].vs30));
+		assert(site_close(map[i].z1p0, full[i].z1p0));
+		assert(site_close(map[i].z2p5, full[i].z2p5));
+	}
+
+	// A map whose raster is not the vp grid, left from another release, is ignored.
+	assert((fp = fopen(sitefile, "r+b")) != NULL);
+	assert(fseek(fp, 8 + 2 * sizeof(int), SEEK_SET) == 0);
+	assert(fwrite(&spacing, sizeof(double), 1, fp) == 1);
+	fclose(fp);
+	assert(linthurber_reload(variant, "linthurber") == 0);
+	assert(linthurber_query_sitemap(nodes, map, n) != 0);
+
+	assert(linthurber_reload(dir, "linthurber") == 0);
+	remove_variant(variant);
+
+	printf("Site map query was successful.\n");
+}
+
+/**
+ * Tests that the travel time down a vertical ray matches the integral of
+ * the slowness of queried points, and that a batch of rays gives the
+ * times of single rays.
+ *
+ * @param pt The point to test at.
+ */
+void test_traveltime(linthurber_point_t pt) {
+	int n = 8001, i;
+	linthurber_point_t *pts = malloc(n * sizeof(linthurber_point_t));
+	linthurber_properties_t *props = malloc(n * sizeof(linthurber_properties_t));
+	linthurber_point_t path[3];
+	linthurber_ray_t rays[2];
+	double sum = 0.0, time, times[2][2], single[2];
+
+	// One meter steps from 1 km to 9 km below the surface.
+	for (i = 0; i < n; i++) {
+		pts[i] = pt;
+		pts[i].depth = 1000.0 + i;
+	}
+	assert(linthurber_query(pts, props, n) == 0);
+	for (i = 0; i < n; i++) {
+		assert(props[i].vp > 0);
+		sum += ((i == 0) || (i == n - 1)) ? 0.5 / props[i].vp : 1.0 / props[i].vp;
+	}
+	path[0] = pts[0];
+	path[1] = pts[n - 1];
+	assert(linthurber_traveltime(path, 2, LINTHURBER_VP, &time) == 0);
+	assert(fabs(time - sum) < 1.0e-6 * sum);
+
+	// A vertical ray and a slanted one, in a batch.
+	path[2] = pts[n - 1];
+	path[2].longitude += 0.3;
+	path[2].latitude -= 0.2;
+	rays[0].points = path;
+	rays[0].numpoints = 2;
+	rays[0].times = times[0];
+	rays[1].points = &path[1];
+	rays[1].numpoints = 2;
+	rays[1].times = times[1];
+	assert(linthurber_traveltime_batch(rays, 2, LINTHURBER_VS) == 0);
+	assert(linthurber_traveltime(path, 3, LINTHURBER_VS, single) == 0);
+	assert((times[0][0] == single[0]) && (times[1][0] == single[1]));
+	assert(single[1] > 0);
+
+	free(pts);
+	free(props);
+
+	printf("Travel time query was successful.\n");
+}
+
+/**
+ * Tests that the site parameters agree with Vs sampled densely down the
+ * column with linthurber_query: Vs30 with the time-averaged Vs over the
+ * top 30 m, and Z1.0 and Z2.5 with the first crossings of 1.0 and 2.5
+ * km/s. Tests the profile integrals they come from on a profile with
+ * known answers first.
+ *
+ * @param pt The point to test around.
+ */
+void test_site(linthurber_point_t pt) {
+	double d[4] = { -1000.0, 0.0, 1000.0, 3000.0 }, v[4] = { 500.0, 500.0, 1500.0, 3000.0 };
+	double targets[2] = { 1000.0, 2500.0 }, step[2] = { 0.01, 2.0 }, sum, reach[2];
+	int n[2] = { 3001, 30001 }, c, s, i;
+	linthurber_point_t sites[9], *pts = malloc(n[1] * sizeof(linthurber_point_t));
+	linthurber_properties_t *props = malloc(n[1] * sizeof(linthurber_properties_t));
+	linthurber_site_t site[9];
+
+	// Vs is 500 + z from the surface to 1 km, then rises by 0.75 per meter.
+	assert(fabs(_linthurber_profile_time(d, v, 4, 30.0) - log(530.0 / 500.0)) < 1.0e-12);
+	assert(fabs(_linthurber_profile_reach(d, v, 4, 1000.0) - 500.0) < 1.0e-9);
+	assert(fabs(_linthurber_profile_reach(d, v, 4, 2500.0) - 3000.0 * 7.0 / 9.0) < 1.0e-9);
+	assert(_linthurber_profile_reach(d, v, 4, 4000.0) == -1.0);
+
+	for (c = 0; c < 9; c++) {
+		sites[c] = pt;
+		sites[c].longitude += 0.3 * (c % 3 - 1);
+		sites[c].latitude += 0.3 * (c / 3 - 1);
+	}
+	assert(linthurber_query_site(sites, site, 9) == 0);
+	for (c = 0, s = 0; c < 9; c++) {
+		// The top 30 m in centimeter steps.
+		for (i = 0; i < n[0]; i++) {
+			pts[i] = sites[c];
+			pts[i].depth = step[0] * i;
+		}
+		assert(linthurber_query(pts, props, n[0]) == 0);
+		for (i = 0, sum = 0.0; i < n[0]; i++) {
+			assert(props[i].vs > 0);
+			sum += ((i == 0) || (i == n[0] - 1)) ? 0.5 / props[i].vs : 1.0 / props[i].vs;
+		}
+		assert(fabs(site[c].vs30 - 30.0 / (step[0] * sum)) <= 1.0e-6 * site[c].vs30);
+
+		// Down to 60 km in 2 m steps, past the last layer.
+		for (i = 0; i < n[1]; i++) {
+			pts[i] = sites[c];
+			pts[i].depth = step[1] * i;
+		}
+		assert(linthurber_query(pts, props, n[1]) == 0);
+		for (s = 0; s < 2; s++) {
+			reach[s] = -1.0;
+			for (i = 0; i < n[1]; i++) {
+				if (props[i].vs < targets[s]) continue;
+				reach[s] = (i == 0) ? 0.0 : step[1] * (i - 1 + (targets[s] - props[i - 1].vs) /
+				                                          (props[i].vs - props[i - 1].vs));
+				break;
+			}
+		}
+		assert((reach[0] == -1.0) == (site[c].z1p0 == -1.0));
+		assert((reach[1] == -1.0) == (site[c].z2p5 == -1.0));
+		assert(fabs(site[c].z1p0 - reach[0]) <= step[1]);
+		assert(fabs(site[c].z2p5 - reach[1]) <= step[1]);
+	}
+
+	free(pts);
+	free(props);
+
+	printf("Site query was successful.\n");
+}
+
+/**
+ * Tests that a vertical profile matches querying its depths one point
+ * at a time.
+ *
+ * @param pt The point to test at.
+ */
+void test_column(linthurber_point_t pt) {
+	linthurber_point_t pts[81];
+	linthurber_properties_t col[81], ret[81];
+	double depths[81];
+	int i;
+
+	for (i = 0; i < 81; i++) {
+		depths[i] = 500.0 * i;
+		pts[i] = pt;
+		pts[i].depth = depths[i];
+	}
+	assert(linthurber_query_column(&pt, depths, col, 81) == 0);
+	assert(linthurber_query(pts, ret, 81) == 0);
+	for (i = 0; i < 81; i++) {
+		assert(props_close(&col[i], &ret[i], 1.0e-12));
+	}
+
+	printf("Column query was successful.\n");
+}
+
+/**
+ * Tests that depth slices and cross-sections match linthurber_query at
+ * every pixel, to within the rounding of the image to floats.
+ */
+void test_slice() {
+	int nx = 17, ny = 9, nh = 11, nz = 21, c, r;
+	float slice[17 * 9], section[11 * 21];
+	linthurber_point_t pt;
+	linthurber_properties_t ret;
+
+	assert(linthurber_slice(-119.0, 33.0, -117.0, 35.0, 2000.0, nx, ny, LINTHURBER_VP, slice) == 0);
+	for (r = 0; r < ny; r++) {
+		for (c = 0; c < nx; c++) {
+			pt.longitude = -119.0 + 2.0 * c / (nx - 1);
+			pt.latitude = 33.0 + 2.0 * r / (ny - 1);
+			pt.depth = 2000.0;
+			linthurber_query(&pt, &ret, 1);
+			assert(fabs(slice[r * nx + c] - ret.vp) <= 1.0e-6 * fabs(ret.vp));
+		}
+	}
+
+	// Along a meridian, where the great circle is even in latitude.
+	assert(linthurber_cross_section(-118.0, 33.0, -118.0, 35.0, 0.0, 20000.0, nh, nz,
+	                                LINTHURBER_RHO, section) == 0);
+	for (r = 0; r < nz; r++) {
+		for (c = 0; c < nh; c++) {
+			pt.longitude = -118.0;
+			pt.latitude = 33.0 + 2.0 * c / (nh - 1);
+			pt.depth = 20000.0 * r / (nz - 1);
+			linthurber_query(&pt, &ret, 1);
+			assert(fabs(section[r * nh + c] - ret.rho) <= 1.0e-6 * fabs(ret.rho));
+		}
+	}
+
+	printf("Slice and cross-section were successful.\n");
+}
+
+/**
+ * Tests that linthurberd, serving the same model, returns what
+ * linthurber_query does. Runs when run_test_linthurber.sh has started a
+ * daemon and named its socket in LINTHURBER_TEST_SOCKET.
+ */
+void test_daemon() {
+	const char *sock = getenv("LINTHURBER_TEST_SOCKET");
+	linthurber_point_t pts[100];
+	linthurber_properties_t local[100], remote[100];
+	int i;
+
+	if (sock == NULL) {
+		printf("No daemon to test, skipped.\n");
+		return;
+	}
+	for (i = 0; i < 100; i++) {
+		pts[i].longitude = -120.0 + 0.05 * i;
+		pts[i].latitude = 33.0 + 0.03 * i;
+		pts[i].depth = 250.0 * i;
+	}
+	assert(linthurber_client_init(sock) == 0);
+	assert(linthurber_client_query(pts, remote, 100) == 0);
+	assert(linthurber_client_finalize() == 0);
+	assert(linthurber_query(pts, local, 100) == 0);
+	for (i = 0; i < 100; i++) {
+		assert((remote[i].vp == local[i].vp) && (remote[i].vs == local[i].vs) &&
+		       (remote[i].rho == local[i].rho));
+	}
+
+	printf("Daemon query was successful.\n");
+}
+
+/** The mesh the mesh tools extract in the tests, and its options */
+#define TEST_MESH_NX 7
+#define TEST_MESH_NY 5
+#define TEST_MESH_NZ 4
+#define TEST_MESH_OPTS "-o -118.5,34.0 -n 7,5,4 -h 3000"
+
+/**
+ * Tests that linthurber_mesh_mpi writes the same file as linthurber_mesh,
+ * byte for byte. Runs when run_test_linthurber.sh has named the MPI
+ * launcher to start it with in LINTHURBER_TEST_MPIRUN.
+ *
+ * @param dir The UCVM directory.
+ * @param tools The directory of the mesh tools.
+ * @param serial The file written by linthurber_mesh.
+ */
+void test_mesh_mpi(const char *dir, const char *tools, const char *serial) {
+	const char *mpirun = getenv("LINTHURBER_TEST_MPIRUN");
+	char cmd[4 * PATH_MAX], file[64];
+	FILE *a, *b;
+	int c;
+
+	if (mpirun == NULL) {
+		printf("No MPI launcher to test with, skipped.\n");
+		return;
+	}
+	sprintf(file, "%s.mpi", serial);
+	sprintf(cmd, "%s %s/linthurber_mesh_mpi -d %s " TEST_MESH_OPTS " %s > /dev/null", mpirun, tools,
+	        dir, file);
+	assert(system(cmd) == 0);
+	assert((a = fopen(serial, "rb")) != NULL);
+	assert((b = fopen(file, "rb")) != NULL);
+	do {
+		c = fgetc(a);
+		assert(fgetc(b) == c);
+	} while (c != EOF);
+	fclose(a);
+	fclose(b);
+	remove(file);
+
+	printf("MPI mesh extraction was successful.\n");
+}
+
+/**
+ * Tests that the mesh extracted by linthurber_mesh holds the values of
+ * linthurber_query at its nodes, rounded to floats. Runs when
+ * run_test_linthurber.sh has named the directory of the tools in
+ * LINTHURBER_TEST_TOOLS.
+ *
+ * @param dir The UCVM directory.
+ */
+void test_mesh(const char *dir) {
+	const char *tools = getenv("LINTHURBER_TEST_TOOLS");
+	int nodes = TEST_MESH_NX * TEST_MESH_NY * TEST_MESH_NZ, n, k;
+	linthurber_mesh_t mesh;
+	linthurber_point_t pts[TEST_MESH_NX * TEST_MESH_NY * TEST_MESH_NZ];
+	linthurber_properties_t ret[TEST_MESH_NX * TEST_MESH_NY * TEST_MESH_NZ];
+	float voxels[3 * TEST_MESH_NX * TEST_MESH_NY * TEST_MESH_NZ];
+	char cmd[4 * PATH_MAX], file[64];
+	FILE *fp;
+
+	if (tools == NULL) {
+		printf("No mesh tools to test, skipped.\n");
+		return;
+	}
+	sprintf(file, "/tmp/linthurber_mesh_test.%d", (int)getpid());
+	sprintf(cmd, "%s/linthurber_mesh -d %s " TEST_MESH_OPTS " -t 2 %s > /dev/null", tools, dir, file);
+	assert(system(cmd) == 0);
+	assert((fp = fopen(file, "rb")) != NULL);
+	assert(fread(voxels, sizeof(float), 3 * nodes, fp) == 3 * nodes);
+	assert(fgetc(fp) == EOF);
+	fclose(fp);
+
+	// Node (i, j, k) lies under surface node (i, j), k spacings down.
+	memset(&mesh, 0, sizeof(linthurber_mesh_t));
+	mesh.origin[0] = -118.5;
+	mesh.origin[1] = 34.0;
+	mesh.spacing = 3000.0;
+	for (k = 0; k < TEST_MESH_NZ; k++) {
+		linthurber_mesh_surface(&mesh, 0, 0, TEST_MESH_NX, TEST_MESH_NY,
+		                        pts + k * TEST_MESH_NX * TEST_MESH_NY);
+		for (n = 0; n < TEST_MESH_NX * TEST_MESH_NY; n++) {
+			pts[k * TEST_MESH_NX * TEST_MESH_NY + n].depth = k * mesh.spacing;
+		}
+	}
+	assert(linthurber_query(pts, ret, nodes) == 0);
+	for (n = 0; n < nodes; n++) {
+		assert((voxels[3 * n] == (float)ret[n].vp) && (voxels[3 * n + 1] == (float)ret[n].vs) &&
+		       (voxels[3 * n + 2] == (float)ret[n].rho));
+	}
+
+	printf("Mesh extraction was successful.\n");
+
+	test_mesh_mpi(dir, tools, file);
+	remove(file);
+}
+
+/**
+ * Counts the batches that have called back, with their status.
+ */
+void count_callback(void *arg, int status) {
+	if (status == 0) __atomic_fetch_add((int *)arg, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Tests that batches submitted in the background, two at a time, return
+ * what linthurber_query does, and call back once each.
+ *
+ * @param region The region grid.
+ */
+void test_submit(test_region_t *region) {
+	linthurber_properties_t *async[2];
+	linthurber_ticket_t *ticket[2];
+	int calls = 0, b;
+
+	assert(linthurber_set_num_threads(4) == 0);
+	for (b = 0; b < 2; b++) {
+		async[b] = malloc(REGION_POINTS * sizeof(linthurber_properties_t));
+		ticket[b] = linthurber_submit(region->points, async[b], REGION_POINTS, count_callback, &calls);
+		assert(ticket[b] != NULL);
+	}
+	for (b = 0; b < 2; b++) {
+		assert(linthurber_wait(ticket[b]) == 0);
+		memcpy(region->ret, async[b], REGION_POINTS * sizeof(linthurber_properties_t));
+		assert(region_same(region, 0.0));
+		free(async[b]);
+	}
+	assert(calls == 2);
+	assert(linthurber_set_num_threads(1) == 0);
+
+	printf("Submitted queries were successful.\n");
+}
+
+/**
+ * Resizes the pool over and over until told to stop.
+ */
+void *resize_thread(void *arg) {
+	int *stop = arg, n = 0;
+
+	while (!__atomic_load_n(stop, __ATOMIC_ACQUIRE)) {
+		assert(linthurber_set_num_threads(1 + n++ % 4) == 0);
+	}
+	return NULL;
+}
+
+/**
+ * Tests that a query run on the pool returns what it does on the calling
+ * thread alone, and that the pool ran it, also while the pool is resized.
+ *
+ * @param region The region grid.
+ */
+void test_threads(test_region_t *region) {
+	linthurber_sched_stats_t stats;
+	pthread_t thread;
+	int stop = 0, r;
+
+	assert(linthurber_set_num_threads(4) == 0);
+	assert(linthurber_reset_sched_stats() == 0);
+	assert(linthurber_query(region->points, region->ret, REGION_POINTS) == 0);
+	assert(linthurber_get_sched_stats(&stats) == 0);
+	assert((stats.threads == 4) && (stats.tasks > 1));
+	assert(region_same(region, 0.0));
+
+	assert(pthread_create(&thread, NULL, resize_thread, &stop) == 0);
+	for (r = 0; r < 10; r++) {
+		assert(linthurber_query(region->points, region->ret, REGION_POINTS) == 0);
+		assert(region_same(region, 0.0));
+	}
+	__atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+	assert(pthread_join(thread, NULL) == 0);
+	assert(linthurber_set_num_threads(1) == 0);
+
+	printf("Threaded query was successful.\n");
+}
+
+/**
+ * Tests that queries answered from the column cache return what they do
+ * with the cache off, and that repeated positions hit it.
+ *
+ * @param region The region grid.
+ */
+void test_column_cache(test_region_t *region) {
+	long hits, misses;
+	int pass;
+
+	assert(linthurber_set_column_cache(0) == 0);
+	assert(linthurber_query(region->points, region->ret, REGION_POINTS) == 0);
+	assert(region_same(region, 0.0));
+	assert(linthurber_set_column_cache(2048) == 0);
+	assert(linthurber_reset_column_cache_stats() == 0);
+
+	// Every position recurs at each depth, and again on the second pass.
+	for (pass = 0; pass < 2; pass++) {
+		assert(linthurber_query(region->points, region->ret, REGION_POINTS) == 0);
+		assert(region_same(region, 0.0));
+	}
+	assert(linthurber_get_column_cache_stats(&hits, &misses) == 0);
+	assert((hits > 0) && (misses > 0));
+
+	printf("Column cache was successful.\n");
+}
+
+/** A thread querying while the model is reloaded. */
+typedef struct reload_query_t {
+	linthurber_point_t *pts;
+	linthurber_properties_t *ref;
+	int numpts;
+	int stop;
+	int queries;
+	int mismatches;
+} reload_query_t;
+
+/**
+ * Queries the same points over and over until told to stop, counting the
+ * answers that differ from the reference.
+ */
+void *reload_query_thread(void *arg) {
+	reload_query_t *rq = arg;
+	linthurber_properties_t *ret = malloc(rq->numpts * sizeof(linthurber_properties_t));
+	int i;
+
+	while (!__atomic_load_n(&rq->stop, __ATOMIC_ACQUIRE)) {
+		if (linthurber_query(rq->pts, ret, rq->numpts) != 0) rq->mismatches++;
+		for (i = 0; i < rq->numpts; i++) {
+			if ((ret[i].vp != rq->ref[i].vp) || (ret[i].vs != rq->ref[i].vs)) rq->mismatches++;
+		}
+		rq->queries++;
+	}
+	free(ret);
+	return NULL;
+}
+
+/**
+ * Tests that queries running on another thread while the model is
+ * reloaded keep returning correct values.
+ *
+ * @param dir The UCVM directory.
+ * @param region The region grid.
+ */
+void test_concurrent_reload(const char *dir, test_region_t *region) {
+	reload_query_t rq;
+	pthread_t thread;
+	int r;
+
+	// One depth below the surface, where the DEM matters too.
+	rq.numpts = REGION_SIDE * REGION_SIDE;
+	rq.pts = region->points + rq.numpts;
+	rq.ref = region->ref + rq.numpts;
+	rq.stop = 0;
+	rq.queries = 0;
+	rq.mismatches = 0;
+
+	assert(pthread_create(&thread, NULL, reload_query_thread, &rq) == 0);
+	for (r = 0; r < 5; r++) {
+		assert(linthurber_reload(dir, "linthurber") == 0);
+	}
+	__atomic_store_n(&rq.stop, 1, __ATOMIC_RELEASE);
+	assert(pthread_join(thread, NULL) == 0);
+	assert((rq.queries > 0) && (rq.mismatches == 0));
+
+	printf("Reload under queries was successful.\n");
+}
+
+/**
+ * Makes a variant of the installed model as make_variant does, with every
+ * fifth line of its vp data left out, so that the vp nodes of those lines
+ * hold -1.0, and loads it.
+ *
+ * @param dir The UCVM directory of the installed model.
+ * @param extra The configuration lines to append.
+ * @param variant The new UCVM directory returned, PATH_MAX long.
+ */
+void thin_variant(const char *dir, const char *extra, char *variant) {
+	char file[PATH_MAX], thin[PATH_MAX + 8], line[256];
+	FILE *in, *out;
+	int n;
+
+	make_variant(dir, extra, variant);
+	assert(linthurber_reload(variant, "linthurber") == 0);
+	assert(_linthurber_state_enter(NULL) == 0);
+	sprintf(file, "%s/lin-thurber.vp", _linthurber_state_view()->config->data_directory);
+	_linthurber_state_exit();
+	sprintf(thin, "%s.thin", file);
+	assert((in = fopen(file, "r")) != NULL);
+	assert((out = fopen(thin, "w")) != NULL);
+	for (n = 0; fgets(line, sizeof(line), in) != NULL; n++) {
+		if (n % 5 != 0) fputs(line, out);
+	}
+	fclose(in);
+	fclose(out);
+	assert(rename(thin, file) == 0);
+	assert(linthurber_reload(variant, "linthurber") == 0);
+}
+
+/**
+ * Tests that a grid read on its first coarse level holds, at each coarse
+ * node, the [1/4 1/2 1/4] weighted average of the fine nodes around it
+ * that have data, clamped to the edges, or -1.0 where none has.
+ *
+ * @param prop LINTHURBER_VP or LINTHURBER_VS.
+ * @param resolution A resolution at which the grid is read on its first coarse level.
+ * @return The number of coarse nodes tested with some, not all, fine nodes missing.
+ */
+int lod_nodes(int prop, double resolution) {
+	double weight[3] = { 0.25, 0.5, 0.25 }, sum, wsum, spacing, *expected, got;
+	int *dims, i, j, k, a, b, x, y, n = 0, p, missing, masked = 0;
+	linthurber_configuration_t *config;
+	linthurber_point_t *pts;
+	linthurber_properties_t *ret;
+	float *grid, v;
+
+	assert(_linthurber_state_enter(NULL) == 0);
+	config = _linthurber_state_view()->config;
+	grid = (prop == LINTHURBER_VP) ? _linthurber_state_view()->model->vp :
+	                                 _linthurber_state_view()->model->vs;
+	dims = (prop == LINTHURBER_VP) ? config->vp_dims : config->vs_dims;
+	spacing = (prop == LINTHURBER_VP) ? config->spacing_vp : config->spacing_vs;
+	pts = malloc(dims[0] * dims[1] * config->num_z * sizeof(linthurber_point_t));
+	expected = malloc(dims[0] * dims[1] * config->num_z * sizeof(double));
+
+	// Every third coarse node along x, every second along y, the edges included.
+	for (k = 1; k < config->num_z; k += 3) {
+		for (j = 0; 2 * j < dims[1]; j += 2) {
+			for (i = 0; 2 * i < dims[0]; i += 3, n++) {
+				sum = 0.0;
+				wsum = 0.0;
+				missing = 0;
+				for (b = -1; b <= 1; b++) {
+					y = (2 * j + b < 0) ? 0 : (2 * j + b >= dims[1]) ? dims[1] - 1 : 2 * j + b;
+					for (a = -1; a <= 1; a++) {
+						x = (2 * i + a < 0) ? 0 : (2 * i + a >= dims[0]) ? dims[0] - 1 : 2 * i + a;
+						v = grid[LINTHURBER_NODE(dims, x, y, k)];
+						if (v <= 0.0) {
+							missing++;
+							continue;
+						}
+						sum += weight[a + 1] * weight[b + 1] * v;
+						wsum += weight[a + 1] * weight[b + 1];
+					}
+				}
+				if ((missing > 0) && (missing < 9)) masked++;
+				expected[n] = (wsum > 0.0) ? sum / wsum : -1.0;
+				bilinear_xy2geo(&config->proj, 2 * i * spacing, 2 * j * spacing,
+				                &pts[n].longitude, &pts[n].latitude);
+				pts[n].depth = 1000.0 * config->depths_msl[k];
+			}
+		}
+	}
+	_linthurber_state_exit();
+
+	ret = malloc(n * sizeof(linthurber_properties_t));
+	assert(linthurber_set_depth_mode(LINTHURBER_DEPTH_MSL) == 0);
+	assert(linthurber_query_lod(pts, ret, n, resolution) == 0);
+	assert(linthurber_set_depth_mode(LINTHURBER_DEPTH_SURFACE) == 0);
+	for (p = 0; p < n; p++) {
+		got = (prop == LINTHURBER_VP) ? ret[p].vp : ret[p].vs;
+		assert(fabs(got - expected[p]) <= 1.0e-6 * fabs(expected[p]));
+	}
+
+	free(pts);
+	free(expected);
+	free(ret);
+	return masked;
+}
+
+/**
+ * Tests that coarse queries read every grid on the level the resolution
+ * calls for, that those levels average the fine grid as they should, and
+ * that coarse queries return no data where linthurber_query has none,
+ * past the last fine node of a grid included.
+ *
+ * @param dir The UCVM directory.
+ * @param region The region grid.
+ */
+void test_lod(const char *dir, test_region_t *region) {
+	double resolutions[3] = { 0.0, 100000.0, 1000000.0 }, spacing[2], edge[2], x, y;
+	linthurber_point_t pts[14];
+	linthurber_properties_t full[14], coarse[14];
+	linthurber_configuration_t *config;
+	char variant[PATH_MAX];
+	int mode, r, p;
+
+	// Finer than every grid, the full resolution answers.
+	assert(linthurber_query_lod(region->points, region->ret, REGION_POINTS, 1.0) == 0);
+	assert(region_same(region, 0.0));
+
+	assert(_linthurber_state_enter(NULL) == 0);
+	config = _linthurber_state_view()->config;
+	spacing[0] = config->spacing_vp;
+	spacing[1] = config->spacing_vs;
+	edge[0] = (config->vp_dims[0] - 1) * spacing[0];
+	edge[1] = (config->vp_dims[1] - 1) * spacing[0];
+
+	// Either side of the last vp node along x and y, and past the first.
+	for (p = 0; p < 7; p++) {
+		x = (double[]){ -8000.0, 0.0, edge[0], edge[0] + 4000.0, edge[0] + 10000.0,
+		                edge[0] + 40000.0, edge[0] / 2 }[p];
+		y = (p < 6) ? edge[1] / 2 : -8000.0;
+		bilinear_xy2geo(&config->proj, x, y, &pts[p].longitude, &pts[p].latitude);
+		bilinear_xy2geo(&config->proj, y * edge[0] / edge[1], (p < 6) ? x * edge[1] / edge[0] : edge[1] + 3000.0,
+		                &pts[7 + p].longitude, &pts[7 + p].latitude);
+	}
+	_linthurber_state_exit();
+	for (p = 0; p < 14; p++) pts[p].depth = 8000.0;
+
+	// Below twice the vp spacing only the DEM is coarser, which depths below sea level skip.
+	assert(linthurber_set_depth_mode(LINTHURBER_DEPTH_MSL) == 0);
+	assert(linthurber_query(region->points, region->ref, REGION_POINTS) == 0);
+	assert(linthurber_query_lod(region->points, region->ret, REGION_POINTS, 2.0 * spacing[0] - 1.0) == 0);
+	assert(region_same(region, 0.0));
+	assert(linthurber_query_lod(region->points, region->ret, REGION_POINTS, 2.0 * spacing[0]) == 0);
+	for (p = 0; p < REGION_POINTS; p++) {
+		assert(region->ret[p].vs == region->ref[p].vs);
+	}
+	assert(linthurber_set_depth_mode(LINTHURBER_DEPTH_SURFACE) == 0);
+	assert(linthurber_query(region->points, region->ref, REGION_POINTS) == 0);
+
+	// The first coarse level of each grid.
+	lod_nodes(LINTHURBER_VP, 2.0 * spacing[0]);
+	lod_nodes(LINTHURBER_VS, 2.0 * spacing[1]);
+
+	// No data where the full resolution has none, in either depth mode.
+	resolutions[0] = 2.0 * spacing[0];
+	for (mode = LINTHURBER_DEPTH_SURFACE; mode <= LINTHURBER_DEPTH_MSL; mode++) {
+		assert(linthurber_query_mode(pts, full, 14, mode) == 0);
+		for (r = 0; r < 3; r++) {
+			assert(linthurber_set_depth_mode(mode) == 0);
+			assert(linthurber_query_lod(pts, coarse, 14, resolutions[r]) == 0);
+			for (p = 0; p < 14; p++) {
+				assert((coarse[p].vp < 0.0) == (full[p].vp < 0.0));
+				assert((coarse[p].vs < 0.0) == (full[p].vs < 0.0));
+			}
+		}
+	}
+	assert(linthurber_set_depth_mode(LINTHURBER_DEPTH_SURFACE) == 0);
+
+	// Vp nodes missing from the model data are left out of the averages.
+	thin_variant(dir, "", variant);
+	assert(lod_nodes(LINTHURBER_VP, 2.0 * spacing[0]) > 0);
+	assert(linthurber_reload(dir, "linthurber") == 0);
+	remove_variant(variant);
+
+	printf("Coarse query was successful.\n");
+}
+
+/**
+ * Tests that the model loaded with the corner-packed layout returns what
+ * the node grids do.
+ *
+ * @param dir The UCVM directory.
+ * @param region The region grid.
+ */
+void test_packed(const char *dir, test_region_t *region) {
+	char variant[PATH_MAX];
+
+	make_variant(dir, "layout = packed\n", variant);
+	assert(linthurber_reload(variant, "linthurber") == 0);
+	assert(linthurber_query(region->points, region->ret, REGION_POINTS) == 0);
+	assert(region_same(region, 0.0));
+	assert(linthurber_reload(dir, "linthurber") == 0);
+	remove_variant(variant);
+
+	printf("Packed layout was successful.\n");
+}
+
+/**
+ * Places points on 27 interior nodes of the vp grid, then on as many of
+ * the vs grid, at depths below sea level.
+ *
+ * @param nodes The 54 points returned.
+ */
+void grid_nodes(linthurber_point_t *nodes) {
+	linthurber_configuration_t *config;
+	double spacing[2];
+	int *dims[2], g, i, j, k, n = 0;
+
+	assert(_linthurber_state_enter(NULL) == 0);
+	config = _linthurber_state_view()->config;
+	spacing[0] = config->spacing_vp;
+	spacing[1] = config->spacing_vs;
+	dims[0] = config->vp_dims;
+	dims[1] = config->vs_dims;
+	for (g = 0; g < 2; g++) {
+		for (k = 1; k < 4; k++) {
+			for (j = 1; j < 4; j++) {
+				for (i = 1; i < 4; i++, n++) {
+					bilinear_xy2geo(&config->proj, (i * (dims[g][0] - 1) / 4) * spacing[g],
+					                (j * (dims[g][1] - 1) / 4) * spacing[g],
+					                &nodes[n].longitude, &nodes[n].latitude);
+					nodes[n].depth = 1000.0 * config->depths_msl[k * (config->num_z - 1) / 4];
+				}
+			}
+		}
+	}
+	_linthurber_state_exit();
+}
+
+/** Points cell_values places, 8 in each of 36 cells */
+#define CELL_POINTS 288
+
+/**
+ * Tests the values an interpolation setting returns between the nodes of
+ * the vp or vs grid, at fractions 0.3 and 0.7 of every side of interior
+ * cells in turn: the value of the nearest node for nearest, the bilinear
+ * value in the nearest layer for bilinear, and for cubic the trilinear
+ * value in cells whose 4x4x4 nodes include one with no data.
+ *
+ * @param prop LINTHURBER_VP or LINTHURBER_VS.
+ * @param interpolation The interpolation setting of the loaded model.
+ * @return The number of points tested in cubic cells next to missing data.
+ */
+int cell_values(int prop, int interpolation) {
+	double f[2] = { 0.3, 0.7 }, idx[3], w, v, spacing, *depths;
+	double expected[CELL_POINTS], tol[CELL_POINTS], got;
+	linthurber_point_t pts[CELL_POINTS];
+	linthurber_properties_t ret[CELL_POINTS];
+	linthurber_configuration_t *config;
+	int *dims, i, j, k, c, a, b, e, node[3], n = 0, missing, fallbacks = 0;
+	float *grid;
+
+	assert(_linthurber_state_enter(NULL) == 0);
+	config = _linthurber_state_view()->config;
+	grid = (prop == LINTHURBER_VP) ? _linthurber_state_view()->model->vp :
+	                                 _linthurber_state_view()->model->vs;
+	dims = (prop == LINTHURBER_VP) ? config->vp_dims : config->vs_dims;
+	spacing = (prop == LINTHURBER_VP) ? config->spacing_vp : config->spacing_vs;
+	depths = config->depths_msl;
+
+	for (k = 1; k < config->num_z - 1; k += 2) {
+		for (j = 1; j < 4; j++) {
+			for (i = 1; i < 4; i++) {
+				for (c = 0; c < 8; c++, n++) {
+					node[0] = i * (dims[0] - 1) / 4;
+					node[1] = j * (dims[1] - 1) / 4;
+					node[2] = k;
+					idx[0] = node[0] + f[c & 1];
+					idx[1] = node[1] + f[(c >> 1) & 1];
+					idx[2] = node[2] + f[c >> 2];
+					bilinear_xy2geo(&config->proj, idx[0] * spacing, idx[1] * spacing,
+					                &pts[n].longitude, &pts[n].latitude);
+					pts[n].depth = 1000.0 * (depths[k] + f[c >> 2] * (depths[k + 1] - depths[k]));
+
+					expected[n] = 0.0;
+					tol[n] = 0.0;
+					if (interpolation == LINTHURBER_INTERP_NEAREST) {
+						expected[n] = grid[LINTHURBER_NODE(dims, (int)round(idx[0]), (int)round(idx[1]),
+						                                   (int)round(idx[2]))];
+						continue;
+					}
+
+					// Corners of the cell in the nearest layer, or in both for trilinear.
+					for (e = 0; e < ((interpolation == LINTHURBER_INTERP_BILINEAR) ? 1 : 2); e++) {
+						for (b = 0; b < 2; b++) {
+							for (a = 0; a < 2; a++) {
+								w = (a ? f[c & 1] : 1.0 - f[c & 1]) * (b ? f[(c >> 1) & 1] : 1.0 - f[(c >> 1) & 1]);
+								if (interpolation == LINTHURBER_INTERP_BILINEAR) {
+									v = grid[LINTHURBER_NODE(dims, node[0] + a, node[1] + b,
+									                         (int)round(idx[2]))];
+								} else {
+									w *= e ? f[c >> 2] : 1.0 - f[c >> 2];
+									v = grid[LINTHURBER_NODE(dims, node[0] + a, node[1] + b, node[2] + e)];
+								}
+								expected[n] += w * v;
+								tol[n] += 1.0e-6 * fabs(w * v);
+							}
+						}
+					}
+
+					// Cubic is only known to be trilinear next to missing data.
+					if (interpolation == LINTHURBER_INTERP_CUBIC) {
+						missing = 0;
+						for (e = -1; e <= 2; e++) {
+							for (b = -1; b <= 2; b++) {
+								for (a = -1; a <= 2; a++) {
+									if (grid[LINTHURBER_NODE(dims, node[0] + a, node[1] + b,
+									                         (node[2] + e < config->num_z) ? node[2] + e :
+									                         config->num_z - 1)] <= 0.0) missing = 1;
+								}
+							}
+						}
+						if (missing) {
+							fallbacks++;
+						} else {
+							tol[n] = -1.0;
+						}
+					}
+				}
+			}
+		}
+	}
+	_linthurber_state_exit();
+
+	assert(linthurber_set_depth_mode(LINTHURBER_DEPTH_MSL) == 0);
+	assert(linthurber_query(pts, ret, CELL_POINTS) == 0);
+	assert(linthurber_set_depth_mode(LINTHURBER_DEPTH_SURFACE) == 0);
+	for (n = 0; n < CELL_POINTS; n++) {
+		if (tol[n] < 0.0) continue;
+		got = (prop == LINTHURBER_VP) ? ret[n].vp : ret[n].vs;
+		assert(fabs(got - expected[n]) <= tol[n]);
+	}
+	return fallbacks;
+}
+
+/**
+ * Tests that every interpolation setting passes through the grid nodes,
+ * where it must return the node values as trilinear interpolation does,
+ * and what each returns between the nodes, vp nodes missing included.
+ *
+ * @param dir The UCVM directory.
+ */
+void test_interpolation(const char *dir) {
+	const char *settings[] = { "interpolation = off\n", "interpolation = nearest\n",
+	                           "interpolation = cubic\n" };
+	int interpolations[] = { LINTHURBER_INTERP_BILINEAR, LINTHURBER_INTERP_NEAREST,
+	                         LINTHURBER_INTERP_CUBIC };
+	int numsettings = sizeof(settings) / sizeof(settings[0]);
+	linthurber_point_t nodes[54];
+	linthurber_properties_t trilinear[54], ret[54];
+	char variant[PATH_MAX];
+	int s, i;
+
+	grid_nodes(nodes);
+	assert(linthurber_set_depth_mode(LINTHURBER_DEPTH_MSL) == 0);
+	assert(linthurber_query(nodes, trilinear, 54) == 0);
+	for (s = 0; s < numsettings; s++) {
+		make_variant(dir, settings[s], variant);
+		assert(linthurber_reload(variant, "linthurber") == 0);
+		assert(linthurber_query(nodes, ret, 54) == 0);
+		for (i = 0; i < 27; i++) {
+			assert(fabs(ret[i].vp - trilinear[i].vp) <= 1.0e-6 * fabs(trilinear[i].vp));
+			assert(fabs(ret[27 + i].vs - trilinear[27 + i].vs) <= 1.0e-6 * fabs(trilinear[27 + i].vs));
+		}
+		remove_variant(variant);
+	}
+	assert(linthurber_set_depth_mode(LINTHURBER_DEPTH_SURFACE) == 0);
+
+	for (s = 0; s < numsettings; s++) {
+		thin_variant(dir, settings[s], variant);
+		cell_values(LINTHURBER_VS, interpolations[s]);
+		i = cell_values(LINTHURBER_VP, interpolations[s]);
+		assert((interpolations[s] != LINTHURBER_INTERP_CUBIC) || (i > 0));
+		remove_variant(variant);
+	}
+	assert(linthurber_reload(dir, "linthurber") == 0);
+
+	printf("Interpolation settings were successful.\n");
+}
+
+/**
+ * Tests that the depth modes agree: a depth below the surface is the
+ * depth below sea level plus the elevation of the surface, and an
+ * elevation is the depth below sea level negated.
+ *
+ * @param region The region grid.
+ */
+void test_depth_modes(test_region_t *region) {
+	int n = REGION_SIDE * REGION_SIDE, i;
+	linthurber_point_t *msl = malloc(n * sizeof(linthurber_point_t));
+	linthurber_properties_t *surface = region->ref + 2 * n;
+	linthurber_properties_t *below = malloc(n * sizeof(linthurber_properties_t));
+	linthurber_properties_t *above = malloc(n * sizeof(linthurber_properties_t));
+	char *dem = calloc(n, 1);
+	linthurber_configuration_t *config;
+	ucvm_point_t geo, xy;
+	double elev;
+
+	// The depth of 7 km below the surface, below sea level where the DEM has it.
+	assert(_linthurber_state_enter(NULL) == 0);
+	config = _linthurber_state_view()->config;
+	for (i = 0; i < n; i++) {
+		msl[i] = region->points[2 * n + i];
+		geo.coord[0] = msl[i].longitude;
+		geo.coord[1] = msl[i].latitude;
+		if ((ucvm_bilinear_geo2xy(&config->proj, &geo, &xy) == 0) &&
+		    (_linthurber_getval(xy.coord[0] / config->spacing_dem, xy.coord[1] / config->spacing_dem,
+		                        0.0, LINTHURBER_DEM, &elev) == 0)) {
+			msl[i].depth -= elev;
+			dem[i] = 1;
+		}
+	}
+	_linthurber_state_exit();
+
+	assert(linthurber_set_depth_mode(LINTHURBER_DEPTH_MSL) == 0);
+	assert(linthurber_query(msl, below, n) == 0);
+	assert(linthurber_set_depth_mode(LINTHURBER_DEPTH_SURFACE) == 0);
+	for (i = 0; i < n; i++) {
+		if (dem[i]) {
+			assert(fabs(below[i].vp - surface[i].vp) <= 1.0e-9 * fabs(surface[i].vp));
+			assert(fabs(below[i].vs - surface[i].vs) <= 1.0e-9 * fabs(surface[i].vs));
+		}
+		msl[i].depth = -msl[i].depth;
+	}
+	assert(linthurber_query_mode(msl, above, n, LINTHURBER_ELEVATION) == 0);
+	for (i = 0; i < n; i++) {
+		assert(props_close(&above[i], &below[i], 0.0));
+	}
+
+	free(msl);
+	free(below);
+	free(above);
+	free(dem);
+
+	printf("Depth modes were successful.\n");
+}
+
+/**
+ * Tests that the kernels of every instruction set level the CPU supports
+ * return the same values, bit for bit.
+ *
+ * @param dir The UCVM directory.
+ * @param region The region grid.
+ */
+void test_isa(const char *dir, test_region_t *region) {
+	int level;
+
+	for (level = LINTHURBER_ISA_BASELINE; level <= LINTHURBER_ISA_AVX512; level++) {
+		if (linthurber_set_isa(level) != 0) continue;
+		assert(linthurber_reload(dir, "linthurber") == 0);
+		assert(linthurber_get_isa(NULL) == level);
+		assert(linthurber_query(region->points, region->ret, REGION_POINTS) == 0);
+		assert(region_same(region, 0.0));
+	}
+	assert(linthurber_set_isa(LINTHURBER_ISA_AUTO) == 0);
+	assert(linthurber_reload(dir, "linthurber") == 0);
+
+	printf("Instruction set levels were successful.\n");
+}
+
+/**
+ * Tests that a model warmed up in the background, or before its load
+ * returns, answers as the model without warmup does, during the warmup
+ * too, and that waiting for the warmup returns.
+ *
+ * @param dir The UCVM directory.
+ * @param region The region grid.
+ */
+void test_warmup(const char *dir, test_region_t *region) {
+	const char *settings[] = { "warmup = background\n", "warmup = block\n" };
+	char variant[PATH_MAX];
+	int s, pass;
+
+	for (s = 0; s < 2; s++) {
+		make_variant(dir, settings[s], variant);
+		assert(linthurber_reload(variant, "linthurber") == 0);
+		for (pass = 0; pass < 2; pass++) {
+			assert(linthurber_query(region->points, region->ret, REGION_POINTS) == 0);
+			assert(region_same(region, 0.0));
+			assert(linthurber_wait_warm() == 0);
+		}
+		remove_variant(variant);
+	}
+	assert(linthurber_reload(dir, "linthurber") == 0);
+
+	printf("Warmup was successful.\n");
+}
+
+/** A caller's own point and material record, for the strided query. */
+typedef struct strided_record_t {
+	int id;
+	double lat;
+	double lon;
+	double depth;
+	double vs;
+	double vp;
+	double rho;
+} strided_record_t;
+
+/**
+ * Tests that a query over records of the caller's own layout, in place,
+ * returns what linthurber_query does, and leaves unselected fields alone.
+ *
+ * @param region The region grid.
+ */
+void test_strided(test_region_t *region) {
+	linthurber_point_t *pts = region->points;
+	strided_record_t *rec = malloc(REGION_POINTS * sizeof(strided_record_t));
+	linthurber_query_desc_t desc;
+	int i;
+
+	for (i = 0; i < REGION_POINTS; i++) {
+		rec[i].id = i;
+		rec[i].lat = pts[i].latitude;
+		rec[i].lon = pts[i].longitude;
+		rec[i].depth = pts[i].depth;
+		rec[i].rho = -2.0;
+	}
+	desc.points = rec;
+	desc.point_stride = sizeof(strided_record_t);
+	desc.lon_offset = offsetof(strided_record_t, lon);
+	desc.lat_offset = offsetof(strided_record_t, lat);
+	desc.depth_offset = offsetof(strided_record_t, depth);
+	desc.data = rec;
+	desc.data_stride = sizeof(strided_record_t);
+	desc.vp_offset = offsetof(strided_record_t, vp);
+	desc.vs_offset = offsetof(strided_record_t, vs);
+	desc.rho_offset = LINTHURBER_FIELD_NONE;
+
+	assert(linthurber_query_strided(&desc, REGION_POINTS, LINTHURBER_DEPTH_SURFACE) == 0);
+	for (i = 0; i < REGION_POINTS; i++) {
+		assert((rec[i].vp == region->ref[i].vp) && (rec[i].vs == region->ref[i].vs));
+		assert((rec[i].id == i) && (rec[i].rho == -2.0) && (rec[i].lat == pts[i].latitude));
+	}
+
+	free(rec);
+
+	printf("Strided query was successful.\n");
+}
+
+/**
+ * Tests that queries returning the corner of uniform cells agree with the
+ * full blend, and that the region has uniform cells to return.
+ *
+ * @param region The region grid.
+ */
+void test_uniform(test_region_t *region) {
+	long evals, hits;
+
+	assert(linthurber_reset_uniform_stats() == 0);
+	assert(linthurber_query(region->points, region->ret, REGION_POINTS) == 0);
+	assert(linthurber_get_uniform_stats(&evals, &hits) == 0);
+	assert((evals > 0) && (hits > 0) && (hits <= evals));
+	plain_query(region->points, region->ret, REGION_POINTS);
+	assert(region_same(region, 1.0e-12));
+
+	printf("Uniform cells were successful.\n");
+}
+
+/**
+ * Tests that rejecting points outside of the model region before
+ * projecting them changes no answer, at points on either side of its
+ * edges, and that points of the region grid are rejected.
+ *
+ * @param region The region grid.
+ */
+void test_cull(test_region_t *region) {
+	double offsets[9] = { -0.2, -0.05, -0.01, -0.001, 0.0, 0.001, 0.01, 0.05, 0.2 };
+	int n = 4 * 9 * 9 * 2, e, t, o, d, i = 0;
+	linthurber_point_t *edge = malloc(n * sizeof(linthurber_point_t));
+	linthurber_properties_t *plain = malloc(n * sizeof(linthurber_properties_t));
+	linthurber_properties_t *ret = malloc(n * sizeof(linthurber_properties_t));
+	ucvm_bilinear_t *proj;
+	double lon, lat, clon = 0.0, clat = 0.0, len;
+	long tested, rejected;
+
+	// Across each edge of the corner quadrilateral, towards its center.
+	assert(_linthurber_state_enter(NULL) == 0);
+	proj = &_linthurber_state_view()->config->proj;
+	for (e = 0; e < 4; e++) {
+		clon += proj->xi[e] / 4.0;
+		clat += proj->yi[e] / 4.0;
+	}
+	for (e = 0; e < 4; e++) {
+		for (t = 1; t < 10; t++) {
+			lon = proj->xi[e] + (proj->xi[(e + 1) % 4] - proj->xi[e]) * t / 10.0;
+			lat = proj->yi[e] + (proj->yi[(e + 1) % 4] - proj->yi[e]) * t / 10.0;
+			len = sqrt((clon - lon) * (clon - lon) + (clat - lat) * (clat - lat));
+			for (o = 0; o < 9; o++) {
+				for (d = 0; d < 2; d++, i++) {
+					edge[i].longitude = lon + offsets[o] * (clon - lon) / len;
+					edge[i].latitude = lat + offsets[o] * (clat - lat) / len;
+					edge[i].depth = 5000.0 * d;
+				}
+			}
+		}
+	}
+	_linthurber_state_exit();
+
+	plain_query(edge, plain, n);
+	assert(linthurber_query(edge, ret, n) == 0);
+	for (i = 0; i < n; i++) {
+		assert(props_close(&ret[i], &plain[i], 1.0e-12));
+	}
+
+	assert(linthurber_reset_cull_stats() == 0);
+	assert(linthurber_query(region->points, region->ret, REGION_POINTS) == 0);
+	assert(linthurber_get_cull_stats(&tested, &rejected) == 0);
+	assert((tested == REGION_POINTS) && (rejected > 0) && (rejected < tested));
+	plain_query(region->points, region->ret, REGION_POINTS);
+	assert(region_same(region, 1.0e-12));
+
+	free(edge);
+	free(plain);
+	free(ret);
+
+	printf("Out-of-region points were successful.\n");
+}
 
 /**
  * Initializes and runs the test program. Tests link against the
@@ -20,17 +1259,21 @@
  * issues.
  *
  * @param argc The number of arguments.
- * @param argv The argument strings.
+ * @param argv The argument strings, the UCVM directory optionally first.
  * @return A zero value indicating success.
  */
 int main(int argc, const char* argv[]) {
 
+	// The model is installed under the UCVM directory.
+	const char *dir = (argc > 1) ? argv[1] : "../";
+
 	// Declare the structures.
 	linthurber_point_t pt;
 	linthurber_properties_t ret;
+	test_region_t region;
 
 	// Initialize the model.
-	assert(linthurber_init("../", "linthurber") == 0);
+	assert(linthurber_init(dir, "linthurber") == 0);
 
 	printf("Loaded the model successfully.\n");
 
@@ -47,12 +1290,39 @@ int main(int argc, const char* argv[]) {
 
 	printf("Query was successful.\n");
 
+	test_gradient(pt);
+	test_failed_reload(dir, pt);
+	test_sitemap(dir);
+	test_traveltime(pt);
+	test_site(pt);
+	test_column(pt);
+	test_slice();
+	test_daemon();
+	test_mesh(dir);
+
+	// The rest compare with linthurber_query over the region grid.
+	region_init(&region);
+	test_submit(&region);
+	test_threads(&region);
+	test_column_cache(&region);
+	test_concurrent_reload(dir, &region);
+	test_lod(dir, &region);
+	test_packed(dir, &region);
+	test_interpolation(dir);
+	test_depth_modes(&region);
+	test_isa(dir, &region);
+	test_warmup(dir, &region);
+	test_strided(&region);
+	test_uniform(&region);
+	test_cull(&region);
+	region_free(&region);
+
 	// Close the model.
 	assert(linthurber_finalize() == 0);
 
 	printf("Model closed successfully.\n");
 
-	printf("\nALL LINTHURBER TESTS PASSED");
+	printf("\nALL LINTHURBER TESTS PASSED\n");
 
 	return 0;
 }
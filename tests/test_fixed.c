@@ -0,0 +1,47 @@
+/**
+ * @file test_fixed.c
+ * @brief Writes the answers of the region grid, to compare library builds.
+ * @author - SCEC
+ * @version 1.0
+ *
+ * Linked once against liblinthurber.a and once against the specialized
+ * liblinthurber_fixed.a. run_test_linthurber.sh compares the files the two
+ * write, which must be identical bit for bit.
+ *
+ *   test_linthurber_dump ucvm_dir file specialized
+ *
+ * specialized is 1 if the library must take the specialized paths on the
+ * model, 0 if it must not.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include "test_util.h"
+
+int main(int argc, const char* argv[]) {
+	test_region_t region;
+	FILE *out;
+
+	assert(argc == 4);
+	assert(linthurber_init(argv[1], "linthurber") == 0);
+
+	// A specialized library that fell back to the generic paths compares nothing.
+	assert(_linthurber_state_enter(NULL) == 0);
+	assert(_linthurber_state_view()->config->specialized == atoi(argv[3]));
+	_linthurber_state_exit();
+
+	// Depths below the surface, then below sea level.
+	region_init(&region);
+	assert(linthurber_set_depth_mode(LINTHURBER_DEPTH_MSL) == 0);
+	assert(linthurber_query(region.points, region.ret, REGION_POINTS) == 0);
+	assert((out = fopen(argv[2], "wb")) != NULL);
+	assert(fwrite(region.ref, sizeof(linthurber_properties_t), REGION_POINTS, out) == REGION_POINTS);
+	assert(fwrite(region.ret, sizeof(linthurber_properties_t), REGION_POINTS, out) == REGION_POINTS);
+	fclose(out);
+	region_free(&region);
+
+	assert(linthurber_finalize() == 0);
+	return 0;
+}
@@ -0,0 +1,65 @@
+/**
+ * @file test_mpi.c
+ * @brief Tests the MPI initialization of the LINTHURBER library.
+ * @author - SCEC
+ * @version 1.0
+ *
+ * Run on two or more ranks. Every rank loads the model with linthurber_init,
+ * then with linthurber_init_mpi, privately and shared, and checks that the
+ * two give the same answers over the region grid.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include "linthurber_mpi.h"
+#include "test_util.h"
+
+/**
+ * Initializes and runs the test program on every rank.
+ *
+ * @param argc The number of arguments.
+ * @param argv The argument strings, the UCVM directory optionally first.
+ * @return A zero value if every rank passed.
+ */
+int main(int argc, char* argv[]) {
+
+	// The model is installed under the UCVM directory.
+	const char *dir = (argc > 1) ? argv[1] : "../";
+
+	test_region_t region;
+	int rank, size, shared, failed = 0, anyfailed;
+
+	MPI_Init(&argc, &argv);
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+	MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+	// The reference answers, from a model each rank reads itself.
+	assert(linthurber_init(dir, "linthurber") == 0);
+	region_init(&region);
+	assert(linthurber_finalize() == 0);
+
+	for (shared = 0; shared < 2; shared++) {
+		if (linthurber_init_mpi(MPI_COMM_WORLD, dir, "linthurber", shared) != 0) {
+			fprintf(stderr, "Rank %d could not initialize the model, shared %d.\n", rank, shared);
+			failed = 1;
+			continue;
+		}
+		if ((linthurber_query(region.points, region.ret, REGION_POINTS) != 0) ||
+		    !region_same(&region, 0.0)) {
+			fprintf(stderr, "Rank %d answered differently, shared %d.\n", rank, shared);
+			failed = 1;
+		}
+		if (linthurber_finalize_mpi() != 0) failed = 1;
+	}
+	region_free(&region);
+
+	MPI_Allreduce(&failed, &anyfailed, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+	if ((rank == 0) && !anyfailed) {
+		printf("MPI initialization was successful on %d ranks.\n", size);
+	}
+	MPI_Finalize();
+
+	return anyfailed;
+}
@@ -0,0 +1,229 @@
+/**
+ * @file test_util.c
+ * @brief Points, model variants and comparisons shared by the LINTHURBER tests.
+ * @author - SCEC
+ * @version 1.0
+ *
+ * Builds the region grid the tests query and its reference answers, makes
+ * variants of the installed model with other settings, and compares sets
+ * of material properties.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include <limits.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "test_util.h"
+
+/**
+ * Fills in a grid of points over the model region and half a degree past
+ * it on every side, at depths from the surface to below the last layer,
+ * and the answers of linthurber_query there.
+ *
+ * @param region The region grid returned.
+ */
+void region_init(test_region_t *region) {
+	ucvm_bilinear_t *proj;
+	double lon[2] = { HUGE_VAL, -HUGE_VAL }, lat[2] = { HUGE_VAL, -HUGE_VAL };
+	double depths[REGION_DEPTHS] = { 0.0, 1500.0, 7000.0, 21000.0, 50000.0 };
+	linthurber_point_t *pts;
+	int i, j, k, n = 0;
+
+	region->points = pts = malloc(REGION_POINTS * sizeof(linthurber_point_t));
+	region->ref = malloc(REGION_POINTS * sizeof(linthurber_properties_t));
+	region->ret = malloc(REGION_POINTS * sizeof(linthurber_properties_t));
+	assert((pts != NULL) && (region->ref != NULL) && (region->ret != NULL));
+
+	assert(_linthurber_state_enter(NULL) == 0);
+	proj = &_linthurber_state_view()->config->proj;
+	for (i = 0; i < 4; i++) {
+		lon[0] = fmin(lon[0], proj->xi[i] - 0.5);
+		lon[1] = fmax(lon[1], proj->xi[i] + 0.5);
+		lat[0] = fmin(lat[0], proj->yi[i] - 0.5);
+		lat[1] = fmax(lat[1], proj->yi[i] + 0.5);
+	}
+	_linthurber_state_exit();
+
+	for (k = 0; k < REGION_DEPTHS; k++) {
+		for (j = 0; j < REGION_SIDE; j++) {
+			for (i = 0; i < REGION_SIDE; i++, n++) {
+				pts[n].longitude = lon[0] + (lon[1] - lon[0]) * i / (REGION_SIDE - 1);
+				pts[n].latitude = lat[0] + (lat[1] - lat[0]) * j / (REGION_SIDE - 1);
+				pts[n].depth = depths[k];
+			}
+		}
+	}
+	assert(linthurber_query(pts, region->ref, REGION_POINTS) == 0);
+}
+
+/**
+ * Releases a region grid.
+ *
+ * @param region The region grid.
+ */
+void region_free(test_region_t *region) {
+	free(region->points);
+	free(region->ref);
+	free(region->ret);
+}
+
+/**
+ * Tells whether the answers under test agree with the reference at every
+ * point of the region grid.
+ *
+ * @param region The region grid, with the answers under test in ret.
+ * @param tol The relative tolerance, or 0 for bit for bit.
+ * @return One if they agree, zero if not.
+ */
+int region_same(test_region_t *region, double tol) {
+	int i;
+
+	for (i = 0; i < REGION_POINTS; i++) {
+		if (!props_close(&region->ret[i], &region->ref[i], tol)) {
+			fprintf(stderr, "Point %d differs: %.17g %.17g %.17g, not %.17g %.17g %.17g.\n", i,
+			        region->ret[i].vp, region->ret[i].vs, region->ret[i].rho,
+			        region->ref[i].vp, region->ref[i].vs, region->ref[i].rho);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/**
+ * Tells whether two sets of material properties agree to a relative
+ * tolerance, as different but equivalent evaluation orders do.
+ *
+ * @param a The properties under test.
+ * @param b The reference properties.
+ * @param tol The relative tolerance, or 0 for bit for bit.
+ * @return One if they agree, zero if not.
+ */
+int props_close(linthurber_properties_t *a, linthurber_properties_t *b, double tol) {
+	return (fabs(a->vp - b->vp) <= tol * fabs(b->vp)) &&
+	       (fabs(a->vs - b->vs) <= tol * fabs(b->vs)) &&
+	       (fabs(a->rho - b->rho) <= tol * fabs(b->rho));
+}
+
+/**
+ * Queries points through the gradient query, which blends all eight
+ * corners of every cell and tests no region before projecting, as the
+ * plain path the shortcuts of linthurber_query must agree with.
+ *
+ * @param points The points.
+ * @param data The properties returned.
+ * @param numpoints The number of points.
+ */
+void plain_query(linthurber_point_t *points, linthurber_properties_t *data, int numpoints) {
+	linthurber_gradient_t *grad = malloc(numpoints * sizeof(linthurber_gradient_t));
+
+	assert(linthurber_query_gradient(points, data, grad, numpoints, LINTHURBER_GRAD_MODEL) == 0);
+	free(grad);
+}
+
+/**
+ * Links the files under a directory from another, making its
+ * subdirectories anew so that files written into them stay in the copy.
+ *
+ * @param src The directory to link to.
+ * @param dst The directory to make the links in.
+ * @param skip An entry of src not to link, or NULL.
+ */
+static void link_tree(const char *src, const char *dst, const char *skip) {
+	char from[PATH_MAX], to[PATH_MAX];
+	struct dirent *entry;
+	struct stat st;
+	DIR *data;
+
+	assert((data = opendir(src)) != NULL);
+	while ((entry = readdir(data)) != NULL) {
+		if ((strcmp(entry->d_name, ".") == 0) || (strcmp(entry->d_name, "..") == 0) ||
+		    ((skip != NULL) && (strcmp(entry->d_name, skip) == 0))) continue;
+		sprintf(from, "%s/%s", src, entry->d_name);
+		sprintf(to, "%s/%s", dst, entry->d_name);
+		assert(stat(from, &st) == 0);
+		if (S_ISDIR(st.st_mode)) {
+			assert(mkdir(to, 0755) == 0);
+			link_tree(from, to, NULL);
+		} else {
+			assert(symlink(from, to) == 0);
+		}
+	}
+	closedir(data);
+}
+
+/**
+ * Removes a directory made by link_tree, with everything under it.
+ *
+ * @param path The directory.
+ */
+static void unlink_tree(const char *path) {
+	char file[PATH_MAX];
+	struct dirent *entry;
+	struct stat st;
+	DIR *data;
+
+	assert((data = opendir(path)) != NULL);
+	while ((entry = readdir(data)) != NULL) {
+		if ((strcmp(entry->d_name, ".") == 0) || (strcmp(entry->d_name, "..") == 0)) continue;
+		sprintf(file, "%s/%s", path, entry->d_name);
+		assert(lstat(file, &st) == 0);
+		if (S_ISDIR(st.st_mode)) {
+			unlink_tree(file);
+		} else {
+			assert(unlink(file) == 0);
+		}
+	}
+	closedir(data);
+	assert(rmdir(path) == 0);
+}
+
+/**
+ * Makes a variant of the installed model under a new UCVM directory: a
+ * copy of its configuration with lines appended, which override the
+ * installed settings, and links to its data files.
+ *
+ * @param dir The UCVM directory of the installed model.
+ * @param extra The configuration lines to append.
+ * @param variant The new UCVM directory returned, PATH_MAX long.
+ */
+void make_variant(const char *dir, const char *extra, char *variant) {
+	char src[PATH_MAX], path[PATH_MAX], from[2 * PATH_MAX], to[2 * PATH_MAX], line[1024];
+	FILE *in, *out;
+
+	sprintf(path, "%s/model/linthurber/data", dir);
+	assert(realpath(path, src) != NULL);
+	strcpy(variant, "/tmp/linthurber_testXXXXXX");
+	assert(mkdtemp(variant) != NULL);
+	sprintf(path, "%s/model", variant);
+	assert(mkdir(path, 0755) == 0);
+	sprintf(path, "%s/model/linthurber", variant);
+	assert(mkdir(path, 0755) == 0);
+	sprintf(path, "%s/model/linthurber/data", variant);
+	assert(mkdir(path, 0755) == 0);
+
+	sprintf(from, "%s/config", src);
+	sprintf(to, "%s/config", path);
+	assert((in = fopen(from, "r")) != NULL);
+	assert((out = fopen(to, "w")) != NULL);
+	while (fgets(line, sizeof(line), in) != NULL) fputs(line, out);
+	fprintf(out, "\n%s", extra);
+	fclose(in);
+	fclose(out);
+
+	link_tree(src, path, "config");
+}
+
+/**
+ * Removes a variant made by make_variant, leaving the installed model.
+ *
+ * @param variant The UCVM directory of the variant.
+ */
+void remove_variant(const char *variant) {
+	unlink_tree(variant);
+}
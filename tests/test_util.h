@@ -0,0 +1,48 @@
+/**
+ * @file test_util.h
+ * @brief Points, model variants and comparisons shared by the LINTHURBER tests.
+ * @author - SCEC
+ * @version 1.0
+ *
+ * Most tests query one fixed grid of points, the region grid, and compare
+ * the answers of some API or model setting with those of linthurber_query
+ * on the installed model, computed once before any test runs.
+ *
+ */
+
+#ifndef TEST_UTIL_H
+#define TEST_UTIL_H
+
+#include "linthurber.h"
+
+/** Points per side and depths of the region grid */
+#define REGION_SIDE 40
+#define REGION_DEPTHS 5
+#define REGION_POINTS (REGION_SIDE * REGION_SIDE * REGION_DEPTHS)
+
+/** The region grid, the reference answers and room for the answers under test. */
+typedef struct test_region_t {
+	/** The REGION_POINTS points, x fastest, then y, then depth */
+	linthurber_point_t *points;
+	/** linthurber_query on the installed model */
+	linthurber_properties_t *ref;
+	/** Answers to compare with ref */
+	linthurber_properties_t *ret;
+} test_region_t;
+
+/** Fills in the region grid of the loaded model and its reference answers. */
+void region_init(test_region_t *region);
+/** Releases a region grid. */
+void region_free(test_region_t *region);
+/** Tells whether the answers under test agree with the reference. */
+int region_same(test_region_t *region, double tol);
+/** Tells whether two sets of material properties agree to a relative tolerance. */
+int props_close(linthurber_properties_t *a, linthurber_properties_t *b, double tol);
+/** Queries points through the plain path, with no shortcuts. */
+void plain_query(linthurber_point_t *points, linthurber_properties_t *data, int numpoints);
+/** Makes a variant of the installed model with extra configuration lines. */
+void make_variant(const char *dir, const char *extra, char *variant);
+/** Removes a variant made by make_variant. */
+void remove_variant(const char *variant);
+
+#endif